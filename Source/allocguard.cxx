@@ -0,0 +1,160 @@
+/**
+ * @file allocguard.cxx
+ *
+ * @brief Detection of heap allocations in steady state.
+ *
+ * Only linked into builds with ALLOCGUARD defined. The interposed functions
+ * pass on to the glibc implementations (__libc_malloc, ...).
+ */
+
+/** @addtogroup AllocGuard
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <execinfo.h>
+
+#include "allocguard.hxx"
+
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+}
+
+static bool armed;
+static bool fatal;
+static bool reporting;
+static AllocGuardStats stats;
+
+/**
+ * Count an allocation and report it if the guard is armed.
+ *
+ * Only async-signal-safe and non-allocating functions are used here.
+ */
+static void allocated(const char* function, size_t size)
+{
+  if (false == armed)
+  {
+    __atomic_add_fetch(&stats.allocations, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  unsigned long count = __atomic_add_fetch(&stats.violations, 1, __ATOMIC_RELAXED);
+
+  // the report itself must not end up here again
+  if (reporting || count > ALLOCGUARD_REPORTS)
+    return;
+
+  reporting = true;
+
+  char message[96];
+  int length = snprintf(message, sizeof(message), "allocguard: %s(%lu) in steady state\n", function,
+      (unsigned long) size);
+  if (length > 0)
+    write(STDERR_FILENO, message, length);
+
+  void* frames[32];
+  int depth = backtrace(frames, 32);
+  backtrace_symbols_fd(frames, depth, STDERR_FILENO);
+
+  if (fatal)
+    abort();
+
+  reporting = false;
+}
+
+/**
+ * Arm the guard: from now on every allocation is a violation.
+ */
+void allocGuardArm()
+{
+  // backtrace() loads libgcc on first use, which allocates
+  void* frames[4];
+  backtrace(frames, 4);
+
+  const char* mode = getenv("RFMBRIDGE_ALLOCGUARD");
+  fatal = (0 != mode) && (0 == strcmp(mode, "abort"));
+
+  fprintf(stderr, "allocguard: armed after %lu allocations\r\n", stats.allocations);
+
+  __atomic_store_n(&armed, true, __ATOMIC_RELEASE);
+}
+
+/**
+ * Check if the guard is armed.
+ */
+bool allocGuardArmed()
+{
+  return armed;
+}
+
+/**
+ * Get the allocation counters.
+ */
+AllocGuardStats allocGuardStats()
+{
+  return stats;
+}
+
+extern "C"
+{
+
+void* malloc(size_t size)
+{
+  allocated("malloc", size);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+  allocated("calloc", count * size);
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+  allocated("realloc", size);
+  return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+  allocated("memalign", size);
+  return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+  allocated("aligned_alloc", size);
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+  allocated("posix_memalign", size);
+  *ptr = __libc_memalign(alignment, size);
+  return (0 == *ptr) ? ENOMEM : 0;
+}
+
+void free(void* ptr)
+{
+  if (armed && 0 != ptr)
+    __atomic_add_fetch(&stats.frees, 1, __ATOMIC_RELAXED);
+
+  __libc_free(ptr);
+}
+
+}
+
+/** @}
+ *
+ */
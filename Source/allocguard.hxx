@@ -0,0 +1,42 @@
+/**
+ * @file allocguard.hxx
+ *
+ * @brief Detection of heap allocations in steady state.
+ *
+ * The bridge runs for months on boards with little memory, so after start-up
+ * nothing on the RX, forwarding or downlink path may allocate heap memory. In a
+ * build with ALLOCGUARD defined (make ALLOCGUARD=1) malloc() and friends are
+ * interposed; operator new of libstdc++ is built on malloc() and caught as well.
+ * Once the guard is armed after a warm-up, every allocation is counted and
+ * reported on stderr with a backtrace. With RFMBRIDGE_ALLOCGUARD=abort in the
+ * environment the first one aborts the process instead.
+ */
+
+#ifndef ALLOCGUARD_HXX_
+#define ALLOCGUARD_HXX_
+
+/** @addtogroup AllocGuard
+ * @{
+ */
+#define ALLOCGUARD_WARMUP     100 ///< Frames forwarded before the guard is armed
+#define ALLOCGUARD_REPORTS    10  ///< Allocations reported with a backtrace
+
+/** Allocation counters. */
+typedef struct
+{
+  unsigned long allocations;  //!< Allocations before the guard was armed
+  unsigned long violations;   //!< Allocations after the guard was armed
+  unsigned long frees;        //!< Frees after the guard was armed
+} AllocGuardStats;
+
+void allocGuardArm();
+
+bool allocGuardArmed();
+
+AllocGuardStats allocGuardStats();
+
+/** @}
+ *
+ */
+
+#endif /* ALLOCGUARD_HXX_ */
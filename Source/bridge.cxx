@@ -0,0 +1,270 @@
+/**
+ * @file bridge.cxx
+ *
+ * @brief The bridge application on the main thread.
+ */
+
+/** @addtogroup Forward
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "bridge.hxx"
+#include "trace.hxx"
+#ifdef ALLOCGUARD
+#include "allocguard.hxx"
+#endif
+
+extern uint32_t HAL_GetTick();
+
+/**
+ * Re-initialize a radio after SIGHUP; runs on the radio thread.
+ * The current configuration (carrier, sync word, changes through the control
+ * port) and output power are restored from the shadow copy.
+ */
+static void
+reinitradio(Radio* radio, void* context)
+{
+  radio->reinit();
+}
+
+/**
+ * Print the counters of the frame pool of a thread.
+ */
+static void
+dumpPool(const char* thread, const FramePoolStats& pool)
+{
+  printf("frame pool (%s): %u of %u used, peak %u, %u exhausted, %u copies\r\n", thread, pool.used,
+      FRAME_POOL_SIZE, pool.peak, pool.exhausted, pool.copies);
+}
+
+/**
+ * Bridge constructor; SIGINT, SIGTERM, SIGHUP and SIGUSR1 are handled in the
+ * event loop from now on.
+ *
+ * @param loop The main event loop
+ * @param forwarder Pipeline the received frames are fed into
+ */
+Bridge::Bridge(EventLoop* loop, Forwarder* forwarder)
+{
+  _loop = loop;
+  _forwarder = forwarder;
+  _actor = 0;
+  _control = 0;
+  _capture = 0;
+  _pcap = 0;
+  _link = 0;
+  _linkTimer = -1;
+  _downlinkFd = -1;
+
+  int signals[] = { SIGINT, SIGTERM, SIGHUP, SIGUSR1 };
+  _signalFd = signalCreate(signals, sizeof(signals) / sizeof(signals[0]));
+  _loop->add(_signalFd, EPOLLIN, this);
+}
+
+/**
+ * Enable the reliable link layer.
+ */
+void Bridge::setLink(RFMLink* link)
+{
+  _link = link;
+  _linkTimer = timerCreate();
+  _loop->add(_linkTimer, EPOLLIN, this);
+}
+
+/**
+ * Accept downlink packets on a UDP port.
+ */
+void Bridge::setDownlink(int fd)
+{
+  _downlinkFd = fd;
+  _loop->add(_downlinkFd, EPOLLIN, this);
+}
+
+void Bridge::radioReceive(Radio* radio, Frame* frame)
+{
+#ifdef DEBUG
+  printf("radio %d: %d bytes received.\r\n", radio->getId(), frame->length + 1);
+#endif
+
+#ifdef ALLOCGUARD
+  // all paths have been taken by now: from here on nothing may allocate
+  static unsigned int warmup = 0;
+  if (ALLOCGUARD_WARMUP == ++warmup)
+    allocGuardArm();
+#endif
+
+  if (0 != _capture)
+    _capture->deliver(*frame);
+  if (0 != _pcap)
+    _pcap->deliver(*frame);
+
+  if ((0 != _link) && _link->input(frame->data, frame->length, HAL_GetTick()))
+  {
+    armLinkTimer();
+    return;
+  }
+
+  _forwarder->forward(*frame);
+}
+
+void Bridge::radioConfigured(Radio* radio, int registers, unsigned int downtime)
+{
+  if (0 != _control)
+    _control->configured(radio->getId(), registers, downtime);
+}
+
+void Bridge::linkDeliver(uint8_t source, const uint8_t* data, unsigned int dataLength)
+{
+  RadioSnapshot snapshot;
+  _actor->getSnapshot(0, &snapshot);
+
+  Frame frame;
+  frame.timestamp = frameTimestamp();
+  frame.edge = 0;
+  frame.radio = 0;
+  frame.frequency = snapshot.frequency;
+  frame.rssi = snapshot.rssi;
+  frame.fei = snapshot.fei;
+  frame.length = (dataLength > FRAME_MAX_PAYLOAD) ? FRAME_MAX_PAYLOAD : dataLength;
+  memcpy(frame.data, data, frame.length);
+
+  _forwarder->forward(frame);
+}
+
+void Bridge::linkFailed(uint8_t destination, uint8_t seq)
+{
+  printf("link: frame %d to node %d not acknowledged\r\n", seq, destination);
+}
+
+void Bridge::handleEvent(int fd, uint32_t events)
+{
+  if (fd == _signalFd)
+  {
+    int sig;
+    while ((sig = signalRead(_signalFd)) > 0)
+    {
+      if (SIGHUP == sig)
+      {
+        printf("reload\r\n");
+        for (unsigned int i = 0; i < _actor->getCount(); i++)
+          _actor->call(i, reinitradio, 0);
+      }
+      else if (SIGUSR1 == sig)
+      {
+        dumpStats();
+      }
+      else
+      {
+        printf("shutdown\r\n");
+        _loop->stop();
+      }
+    }
+  }
+  else if (fd == _downlinkFd)
+  {
+    uint8_t buf[RFM69_MAX_PAYLOAD + 1];
+    int n;
+
+    while ((n = recv(_downlinkFd, buf, sizeof(buf), 0)) > 0)
+    {
+      if (0 != _link)
+      {
+        // first byte is the destination node
+        if (n > 1 && _link->send(buf[0], buf + 1, n - 1, HAL_GetTick()) < 0)
+          printf("link: window to node %d full, packet dropped\r\n", buf[0]);
+      }
+      else if (_actor->send(0, buf, n) < 0)
+      {
+        printf("TX queue full, packet dropped\r\n");
+      }
+    }
+
+    armLinkTimer();
+  }
+  else if (fd == _linkTimer)
+  {
+    timerRead(_linkTimer);
+    _link->poll(HAL_GetTick());
+    armLinkTimer();
+  }
+}
+
+/**
+ * Arm the link timer for the next retransmit timeout.
+ */
+void Bridge::armLinkTimer()
+{
+  if (0 == _link)
+    return;
+
+  int timeout = _link->nextTimeout(HAL_GetTick());
+  if (timeout < 0)
+    timerDisarm(_linkTimer);
+  else
+    timerArm(_linkTimer, timeout > 0 ? timeout : 1);
+}
+
+/**
+ * Print the counters of all radios and the forwarding pipeline.
+ */
+void Bridge::dumpStats()
+{
+  for (unsigned int i = 0; i < _actor->getCount(); i++)
+  {
+    RadioSnapshot snapshot;
+    _actor->getSnapshot(i, &snapshot);
+
+    const RadioStats& stats = snapshot.stats;
+    printf("radio %d: rx %u frames %u bytes %u without buffer %u edges lost %u noise restarts, tx %u frames %u failed"
+        " %u dropped\r\n", i, stats.rxFrames, stats.rxBytes, stats.rxNoBuffer, stats.irqLost, stats.noiseRestarts,
+        stats.txFrames, stats.txFailed, stats.txDropped);
+    printf("radio %d: faults %u version %u drift %u stuck %u overrun, recovery %u rx restarts %u reinits %u resets,"
+        " %u recovered, MTTR last %u max %u mean %u ms\r\n", i, stats.faultVersion, stats.faultDrift,
+        stats.faultStuck, stats.faultOverrun, stats.rxRestarts, stats.reinits, stats.resets, stats.recovered,
+        stats.mttrLast, stats.mttrMax, stats.recovered ? stats.mttrTotal / stats.recovered : 0);
+  }
+
+  RadioActorStats actor = _actor->getStats();
+  printf("radio thread: %u commands, %u rejected, %u events, %u events dropped\r\n", actor.commands,
+      actor.rejected, actor.events, actor.eventsDropped);
+
+  _forwarder->dumpStats();
+  traceDump();
+
+  if (0 != _capture)
+  {
+    const CaptureStats& capture = _capture->getStats();
+    printf("capture: %u frames, %llu bytes in %u writes, %u errors\r\n", capture.frames,
+        (unsigned long long) capture.bytes, capture.writes, capture.errors);
+  }
+
+  if (0 != _pcap)
+  {
+    const PcapStats& pcap = _pcap->getStats();
+    printf("pcap: %u frames, %u dropped, %u rotations, %u errors\r\n", pcap.frames, pcap.dropped,
+        pcap.rotations, pcap.errors);
+  }
+
+  // one pool per thread; the snapshots carry the one of the radio thread
+  RadioSnapshot snapshot;
+  if (_actor->getSnapshot(0, &snapshot))
+    dumpPool("radio thread", snapshot.pool);
+  dumpPool("main thread", framePoolStats());
+
+#ifdef ALLOCGUARD
+  AllocGuardStats alloc = allocGuardStats();
+  printf("allocguard: %s, %lu allocations at start-up, %lu in steady state, %lu frees\r\n",
+      allocGuardArmed() ? "armed" : "warming up", alloc.allocations, alloc.violations, alloc.frees);
+#endif
+}
+
+/** @}
+ *
+ */
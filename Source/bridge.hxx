@@ -0,0 +1,133 @@
+/**
+ * @file bridge.hxx
+ *
+ * @brief The bridge application on the main thread.
+ *
+ * Bridge takes the frames of all radios from the RadioActor and feeds them into
+ * the capture, the pcapng export, the optional link layer and the forwarding
+ * pipeline; it sends downlink packets and handles the signals. It does not
+ * depend on the SPI transport, so bridgebench runs it unchanged against the
+ * simulated module.
+ */
+
+#ifndef BRIDGE_HXX_
+#define BRIDGE_HXX_
+
+#include <stdint.h>
+
+#include "frame.hxx"
+#include "radio.hxx"
+#include "radioactor.hxx"
+#include "rfmlink.hxx"
+#include "forward.hxx"
+#include "control.hxx"
+#include "capture.hxx"
+#include "pcap.hxx"
+#include "eventloop.hxx"
+
+/** @addtogroup Forward
+ * @{
+ */
+
+/**
+ * Puts link layer frames on the air through the radio's TX queue.
+ */
+class RadioLinkTransport : public RFMLinkTransport
+{
+public:
+  RadioLinkTransport(RadioActor* actor, uint8_t radio)
+  {
+    _actor = actor;
+    _radio = radio;
+  }
+
+  int transmit(const uint8_t* data, unsigned int dataLength)
+  {
+    return (_actor->send(_radio, data, dataLength) == 0) ? dataLength : -1;
+  }
+
+private:
+  RadioActor* _actor;
+  uint8_t _radio;
+};
+
+/**
+ * The bridge application: feeds received packets of all radios into the forwarding
+ * pipeline, sends downlink packets and handles signals. Everything runs in the main
+ * event loop thread; the radios run on the thread of the RadioActor and are only
+ * reached through its command queue.
+ */
+class Bridge : public RadioListener, public RFMLinkHandler, public EventHandler
+{
+public:
+  Bridge(EventLoop* loop, Forwarder* forwarder);
+
+  /**
+   * Set the actor that runs the radios. The first radio sends downlink and link
+   * layer packets.
+   */
+  void setActor(RadioActor* actor)
+  {
+    _actor = actor;
+  }
+
+  /**
+   * Set the control port that is told about applied configuration changes.
+   */
+  void setControl(ControlSocket* control)
+  {
+    _control = control;
+  }
+
+  /**
+   * Write every received frame to a trace file.
+   */
+  void setCapture(CaptureSink* capture)
+  {
+    _capture = capture;
+  }
+
+  /**
+   * Export every received frame to Wireshark.
+   */
+  void setPcap(PcapSink* pcap)
+  {
+    _pcap = pcap;
+  }
+
+  void setLink(RFMLink* link);
+
+  void setDownlink(int fd);
+
+  void radioReceive(Radio* radio, Frame* frame);
+
+  void radioConfigured(Radio* radio, int registers, unsigned int downtime);
+
+  void linkDeliver(uint8_t source, const uint8_t* data, unsigned int dataLength);
+
+  void linkFailed(uint8_t destination, uint8_t seq);
+
+  void handleEvent(int fd, uint32_t events);
+
+  void dumpStats();
+
+private:
+  void armLinkTimer();
+
+  EventLoop* _loop;
+  Forwarder* _forwarder;
+  RadioActor* _actor;
+  ControlSocket* _control;
+  CaptureSink* _capture;
+  PcapSink* _pcap;
+  RFMLink* _link;
+  int _linkTimer;
+  int _downlinkFd;
+  int _signalFd;
+};
+
+/** @}
+ *
+ */
+
+#endif /* BRIDGE_HXX_ */
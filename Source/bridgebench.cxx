@@ -0,0 +1,560 @@
+/**
+ * @file bridgebench.cxx
+ *
+ * @brief Cost per frame of the receive pipeline against the simulated module.
+ *
+ * Runs the pipeline of rfmbridge unchanged: RFM69 driver, Radio (polling, as
+ * the simulator has no DIO0 line), RadioActor with its radio thread, Bridge,
+ * Forwarder and a sink, on top of RFM69Sim instead of a spidev device. The
+ * sinks of rfmbridge can be added with the same options: UDP uplink (-u) with
+ * spool (-q), shared memory ring (-m), subscriptions (-S, with a subscriber of
+ * the bench's own), dedup (-D), capture (-T) and pcapng export (-p). A
+ * generator on the radio thread puts frames on the air at a fixed rate; every
+ * frame carries a sequence number, so the sink knows when its PayloadReady was
+ * set.
+ *
+ * Reported per forwarded frame: SPI transactions, bytes and ioctls (SPIDev
+ * issues one ioctl per transaction), CPU time of the process and of both
+ * threads. Frames lost on the way are split into missed by the receiver (FIFO
+ * not read in time), collided on the air (rate above what the channel carries)
+ * and dropped between the threads. The latency is PayloadReady until the sink
+ * has the frame, with the stage intervals of trace.hxx. -j prints one JSON
+ * object instead of the table, for tracking results across releases.
+ *
+ * Build with "make bridgebench"; unlike rfmbridge it is built without DEBUG, so
+ * the per-frame debug output of the driver is not part of the measurement.
+ * "make allocbench" builds it with the allocation guard (allocguard.hxx), which
+ * Bridge arms after ALLOCGUARD_WARMUP received frames; it exits with 2 if
+ * anything allocated in steady state or the guard was never armed. "make
+ * check-alloc" runs it with all sinks.
+ *
+ * Usage: bridgebench [-r frames/s] [-l bytes|min-max] [-b bitrate] [-t seconds] [-u addr:port] [-q spool]
+ *            [-m ring] [-S port] [-D ms] [-T capture] [-p pcapng] [-j]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "rfm69.hxx"
+#include "rfm69sim.hxx"
+#include "radio.hxx"
+#include "radioactor.hxx"
+#include "forward.hxx"
+#include "bridge.hxx"
+#include "spool.hxx"
+#include "shmring.hxx"
+#include "subscribe.hxx"
+#include "dedup.hxx"
+#include "trace.hxx"
+#ifdef ALLOCGUARD
+#include "allocguard.hxx"
+#endif
+
+#define BENCH_LOOKAHEAD   20000000  ///< Frames are scheduled this far ahead [ns]
+#define BENCH_DRAIN       500       ///< Time for the last frames to arrive [ms]
+#define BENCH_SEQUENCES   4096      ///< End times kept for the latency (frames in flight)
+#define BENCH_RSSI        -60       ///< RSSI of the generated frames [dBm]
+
+/** Time the last bit of each frame is on the air, by sequence number. */
+static uint64_t frameEnds[BENCH_SEQUENCES];
+
+static uint64_t
+cputime(int who)
+{
+  struct rusage usage;
+  getrusage(who, &usage);
+
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ull
+      + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ull;
+}
+
+/**
+ * Puts frames on the air of the simulator; runs on the radio thread, which
+ * owns the simulator like the driver.
+ */
+class Generator : public EventHandler
+{
+public:
+  Generator(RFM69Sim* sim, double rate, unsigned int minLength, unsigned int maxLength)
+  {
+    _sim = sim;
+    _period = 1e9 / rate;
+    _minLength = minLength;
+    _maxLength = maxLength;
+    _timer = -1;
+    _next = 0;
+    _end = 0;
+    _injected = 0;
+    _rejected = 0;
+  }
+
+  /**
+   * Generate frames from now on for the given time.
+   */
+  void start(EventLoop* loop, double seconds)
+  {
+    _next = RFM69Sim::now() + 1000000;
+    _end = _next + (uint64_t) (seconds * 1e9);
+
+    _timer = timerCreate();
+    loop->add(_timer, EPOLLIN, this);
+    timerArm(_timer, 5, true);
+  }
+
+  void stop(EventLoop* loop)
+  {
+    loop->remove(_timer);
+    close(_timer);
+  }
+
+  void handleEvent(int fd, uint32_t events)
+  {
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) < 0)
+      return;
+
+    uint64_t horizon = RFM69Sim::now() + BENCH_LOOKAHEAD;
+
+    while (_next < _end && _next < horizon && _sim->getPending() < RFM69SIM_QUEUE)
+    {
+      uint8_t payload[RFM69_MAX_PAYLOAD];
+      unsigned int length = _minLength + (_maxLength > _minLength ? lrand48() % (_maxLength - _minLength + 1) : 0);
+      uint32_t seq = _injected + _rejected;
+
+      memset(payload, 0x55, length);
+      memcpy(payload, &seq, sizeof(seq));
+
+      frameEnds[seq % BENCH_SEQUENCES] = _next + (uint64_t) _sim->airtime(length) * 1000;
+      if (_sim->inject(payload, length, BENCH_RSSI, _next))
+        _injected++;
+      else
+        _rejected++;
+
+      _next += _period;
+    }
+  }
+
+  unsigned int getInjected()
+  {
+    return _injected;
+  }
+
+private:
+  RFM69Sim* _sim;
+  uint64_t _period;
+  unsigned int _minLength;
+  unsigned int _maxLength;
+  int _timer;
+  uint64_t _next;
+  uint64_t _end;
+  unsigned int _injected;
+  unsigned int _rejected;
+};
+
+/**
+ * Subscribes to all frames on the subscription port and takes what arrives.
+ */
+class Subscriber : public EventHandler
+{
+public:
+  Subscriber()
+  {
+    _fd = -1;
+    _frames = 0;
+  }
+
+  /**
+   * Send the subscription request from a socket of its own.
+   */
+  bool start(EventLoop* loop, int port)
+  {
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    _fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_fd < 0 || bind(_fd, (struct sockaddr*) &address, sizeof(address)) < 0)
+    {
+      perror("subscriber");
+      return false;
+    }
+
+    address.sin_port = htons(port);
+    const char request[] = "SUB ttl=3600";
+    if (sendto(_fd, request, sizeof(request) - 1, 0, (struct sockaddr*) &address, sizeof(address)) < 0)
+    {
+      perror("subscriber");
+      return false;
+    }
+
+    loop->add(_fd, EPOLLIN, this);
+
+    return true;
+  }
+
+  void handleEvent(int fd, uint32_t events)
+  {
+    uint8_t buf[FRAME_MAX_PAYLOAD + 64];
+
+    // the first datagram is the reply to the request
+    while (recv(fd, buf, sizeof(buf), 0) >= 0)
+      _frames++;
+  }
+
+  unsigned int getFrames()
+  {
+    return _frames > 0 ? _frames - 1 : 0;
+  }
+
+private:
+  int _fd;
+  unsigned int _frames;
+};
+
+/**
+ * Main thread end of the pipeline: Bridge hands the frames from the actor to
+ * the forwarder, which delivers them to this sink (and the optional ones).
+ */
+class Bench : public FrameSink, public EventHandler
+{
+public:
+  Bench(EventLoop* loop)
+  {
+    _loop = loop;
+    _forwarded = 0;
+    _timer = timerCreate();
+    _loop->add(_timer, EPOLLIN, this);
+  }
+
+  /**
+   * Stop the main loop after the given time [ms].
+   */
+  void stopAfter(unsigned int ms)
+  {
+    timerArm(_timer, ms);
+  }
+
+  int deliver(const Frame& frame)
+  {
+    uint32_t seq;
+    memcpy(&seq, frame.data, sizeof(seq));
+
+    uint64_t now = frameClock();
+    uint64_t end = frameEnds[seq % BENCH_SEQUENCES];
+    _latency.record(now > end ? now - end : 0);
+    _forwarded++;
+
+    return 0;
+  }
+
+  void handleEvent(int fd, uint32_t events)
+  {
+    _loop->stop();
+  }
+
+  unsigned int getForwarded()
+  {
+    return _forwarded;
+  }
+
+  const LatencyHistogram& getLatency()
+  {
+    return _latency;
+  }
+
+private:
+  EventLoop* _loop;
+  int _timer;
+  unsigned int _forwarded;
+  LatencyHistogram _latency;
+};
+
+int
+main(int argc, char *argv[])
+{
+  double rate = 10;
+  unsigned int minLength = 20;
+  unsigned int maxLength = 20;
+  unsigned int bitrate = rfm69_base_profile.bitrate;
+  double seconds = 10;
+  const char* uplinkAddress = 0;
+  int uplinkPort = 0;
+  const char* spoolPath = 0;
+  const char* ringPath = 0;
+  int subscribePort = 0;
+  unsigned int dedupWindow = 0;
+  const char* capturePath = 0;
+  const char* pcapPath = 0;
+  bool json = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "r:l:b:t:u:q:m:S:D:T:p:j")) != -1)
+  {
+    switch (opt)
+    {
+    case 'r':
+      rate = atof(optarg);
+      break;
+    case 'l':
+      if (2 != sscanf(optarg, "%u-%u", &minLength, &maxLength))
+        minLength = maxLength = atoi(optarg);
+      break;
+    case 'b':
+      bitrate = atoi(optarg);
+      break;
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'u':
+    {
+      char* port = strchr(optarg, ':');
+      if (0 != port)
+      {
+        *port = '\0';
+        uplinkPort = atoi(port + 1);
+      }
+      uplinkAddress = optarg;
+      break;
+    }
+    case 'q':
+      spoolPath = optarg;
+      break;
+    case 'm':
+      ringPath = optarg;
+      break;
+    case 'S':
+      subscribePort = atoi(optarg);
+      break;
+    case 'D':
+      dedupWindow = atoi(optarg);
+      break;
+    case 'T':
+      capturePath = optarg;
+      break;
+    case 'p':
+      pcapPath = optarg;
+      break;
+    case 'j':
+      json = true;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-r frames/s] [-l bytes|min-max] [-b bitrate] [-t seconds] [-u addr:port]"
+          " [-q spool] [-m ring] [-S port] [-D ms] [-T capture] [-p pcapng] [-j]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  // the sequence number is part of the payload
+  if (rate <= 0 || seconds <= 0 || 0 == bitrate || minLength < sizeof(uint32_t) || maxLength < minLength
+      || maxLength > rfm69_base_profile.payloadLength - 1)
+  {
+    fprintf(stderr, "rate, time and bitrate must be positive, lengths within %u..%u\n",
+        (unsigned int) sizeof(uint32_t), rfm69_base_profile.payloadLength - 1);
+    return 1;
+  }
+
+  srand48(1);
+
+#ifdef ALLOCGUARD
+  // stdout would allocate its buffer on the first printf of the report
+  static char stdoutBuffer[BUFSIZ];
+  setvbuf(stdout, stdoutBuffer, _IOLBF, sizeof(stdoutBuffer));
+#endif
+
+  RFM69Sim sim;
+  RFM69 rfm69(&sim);
+  rfm69.init();
+  rfm69.setBitrate(bitrate);
+  rfm69.sleep();
+
+  EventLoop loop;
+  Forwarder forwarder;
+  Bench bench(&loop);
+  forwarder.addSink(&bench);
+
+  // the sinks as rfmbridge sets them up
+  UdpSink uplink(uplinkAddress ? uplinkAddress : "127.0.0.1", uplinkPort);
+  Spool spool(&uplink);
+  if (0 != uplinkAddress && 0 != spoolPath)
+  {
+    if (false == spool.open(spoolPath))
+      return 1;
+    spool.start(&loop);
+    forwarder.addSink(&spool);
+  }
+  else if (0 != uplinkAddress)
+  {
+    forwarder.addSink(&uplink);
+  }
+
+  ShmRingSink ring;
+  if (0 != ringPath)
+  {
+    if (false == ring.open(ringPath))
+      return 1;
+    forwarder.addSink(&ring);
+  }
+
+  SubscriptionSink subscriptions;
+  Subscriber subscriber;
+  if (subscribePort > 0)
+  {
+    if (false == subscriptions.start(&loop, subscribePort) || false == subscriber.start(&loop, subscribePort))
+      return 1;
+    forwarder.addSink(&subscriptions);
+  }
+
+  Dedup dedup(&forwarder, dedupWindow, 0 != ringPath);
+  if (dedupWindow > 0)
+  {
+    dedup.start(&loop);
+    forwarder.setDedup(&dedup);
+  }
+
+  Bridge bridge(&loop, &forwarder);
+  RadioActor actor(&bridge);
+  bridge.setActor(&actor);
+
+  CaptureSink capture;
+  if (0 != capturePath)
+  {
+    if (false == capture.open(capturePath))
+      return 1;
+    capture.start(&loop);
+    bridge.setCapture(&capture);
+  }
+
+  PcapSink pcap;
+  if (0 != pcapPath)
+  {
+    if (false == pcap.open(pcapPath, 1))
+      return 1;
+    pcap.start(&loop);
+    bridge.setPcap(&pcap);
+  }
+
+  Radio radio(0, &rfm69, 0);
+  radio.tune(rfm69_base_profile.frequency);
+  actor.addRadio(&radio);
+  radio.start(actor.getLoop(), -1);
+
+  Generator generator(&sim, rate, minLength, maxLength);
+  generator.start(actor.getLoop(), seconds);
+
+  // configuration and start-up are not part of the figures
+  RFM69SimStats before = sim.getStats();
+  uint64_t cpuBefore = cputime(RUSAGE_SELF);
+  uint64_t mainBefore = cputime(RUSAGE_THREAD);
+
+  if (false == actor.start(&loop))
+  {
+    fprintf(stderr, "Can't start radio thread\n");
+    return 1;
+  }
+
+  bench.stopAfter(seconds * 1000 + BENCH_DRAIN);
+  loop.run();
+
+  uint64_t cpu = cputime(RUSAGE_SELF) - cpuBefore;
+  uint64_t cpuMain = cputime(RUSAGE_THREAD) - mainBefore;
+
+  // the radio thread is gone: the simulator may be read from here
+  actor.stop();
+  generator.stop(actor.getLoop());
+  radio.stop();
+  dedup.stop();
+  spool.stop();
+  capture.stop();
+  pcap.stop();
+
+#ifdef ALLOCGUARD
+  bool allocArmed = allocGuardArmed();
+  AllocGuardStats alloc = allocGuardStats();
+#endif
+
+  RFM69SimStats after = sim.getStats();
+  RadioActorStats actorStats = actor.getStats();
+  const RadioStats& radioStats = radio.getStats();
+
+  unsigned int injected = generator.getInjected();
+  unsigned int forwarded = bench.getForwarded();
+  unsigned int frames = forwarded ? forwarded : 1;
+  unsigned int transfers = after.transfers - before.transfers;
+  unsigned int bytes = after.bytes - before.bytes;
+  unsigned int missed = after.rxMissed - before.rxMissed;
+  unsigned int collided = after.rxCollided - before.rxCollided;
+  unsigned int dropped = injected > forwarded ? injected - forwarded : 0;
+
+  const LatencyHistogram& latency = bench.getLatency();
+  static const TraceInterval stages[] = { TRACE_FIFO, TRACE_PREPARE, TRACE_QUEUE, TRACE_FORWARD };
+  static const char* stageNames[] = { "fifo", "prepare", "queue", "forward" };
+
+  if (json)
+  {
+    printf("{\"rate\":%.1f,\"minLength\":%u,\"maxLength\":%u,\"bitrate\":%u,\"seconds\":%.1f,", rate, minLength,
+        maxLength, bitrate, seconds);
+    printf("\"injected\":%u,\"forwarded\":%u,\"dropped\":%u,\"missed\":%u,\"collided\":%u,"
+        "\"eventsDropped\":%u,\"noBuffer\":%u,", injected, forwarded, dropped, missed, collided,
+        actorStats.eventsDropped, radioStats.rxNoBuffer);
+    printf("\"spiTransactions\":%u,\"spiBytes\":%u,\"spiTransactionsPerFrame\":%.2f,\"spiBytesPerFrame\":%.2f,"
+        "\"ioctlsPerFrame\":%.2f,", transfers, bytes, (double) transfers / frames, (double) bytes / frames,
+        (double) transfers / frames);
+    printf("\"cpuNsPerFrame\":%.0f,\"cpuMainNsPerFrame\":%.0f,\"cpuRadioNsPerFrame\":%.0f,",
+        (double) cpu / frames, (double) cpuMain / frames, (double) (cpu - cpuMain) / frames);
+    printf("\"latencyUs\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f},\"stagesUs\":{",
+        latency.percentile(500) / 1e3, latency.percentile(990) / 1e3, latency.percentile(999) / 1e3,
+        latency.getMax() / 1e3);
+    for (unsigned int i = 0; i < sizeof(stages) / sizeof(stages[0]); i++)
+    {
+      const LatencyHistogram& histogram = traceHistogram(stages[i]);
+      printf("%s\"%s\":{\"p50\":%.1f,\"p99\":%.1f}", i ? "," : "", stageNames[i],
+          histogram.percentile(500) / 1e3, histogram.percentile(990) / 1e3);
+    }
+    printf("}}\n");
+  }
+  else
+  {
+    printf("%.1f frames/s of %u..%u bytes at %u bit/s (%.1f ms on air), %.1f s\n", rate, minLength, maxLength,
+        bitrate, sim.airtime(maxLength) / 1e3, seconds);
+    if (1e6 / rate < sim.airtime(maxLength))
+      printf("frames overlap on the air above %.0f frames/s and collide\n\n", 1e6 / sim.airtime(maxLength));
+    printf("\nframes         %u injected, %u forwarded, %u dropped (%u missed, %u collided, %u between threads)\n",
+        injected, forwarded, dropped, missed, collided, actorStats.eventsDropped);
+    if (subscribePort > 0)
+      printf("subscriber     %u frames\n", subscriber.getFrames());
+    if (0 != uplinkAddress && 0 != spoolPath)
+      printf("spool          %u frames\n", spool.getBacklog());
+    printf("SPI per frame  %.2f transactions, %.2f bytes, %.2f ioctls\n", (double) transfers / frames,
+        (double) bytes / frames, (double) transfers / frames);
+    printf("CPU per frame  %.0f ns (main thread %.0f ns, radio thread %.0f ns)\n", (double) cpu / frames,
+        (double) cpuMain / frames, (double) (cpu - cpuMain) / frames);
+    printf("\n%-14s %9s %9s %9s %9s\n", "latency", "p50 us", "p99 us", "p99.9 us", "max us");
+    printf("%-14s %9.1f %9.1f %9.1f %9.1f\n", "ready..sink", latency.percentile(500) / 1e3,
+        latency.percentile(990) / 1e3, latency.percentile(999) / 1e3, latency.getMax() / 1e3);
+    for (unsigned int i = 0; i < sizeof(stages) / sizeof(stages[0]); i++)
+    {
+      const LatencyHistogram& histogram = traceHistogram(stages[i]);
+      printf("%-14s %9.1f %9.1f %9.1f %9.1f\n", stageNames[i], histogram.percentile(500) / 1e3,
+          histogram.percentile(990) / 1e3, histogram.percentile(999) / 1e3, histogram.getMax() / 1e3);
+    }
+  }
+
+#ifdef ALLOCGUARD
+  fprintf(stderr, "allocguard: %s, %lu allocations at start-up, %lu in steady state, %lu frees\n",
+      allocArmed ? "armed" : "never armed", alloc.allocations, alloc.violations, alloc.frees);
+  if (false == allocArmed || alloc.violations > 0)
+    return 2;
+#endif
+
+  return 0;
+}
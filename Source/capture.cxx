@@ -0,0 +1,440 @@
+/**
+ * @file capture.cxx
+ *
+ * @brief Capture of received frames to a file and replay into the pipeline.
+ */
+
+/** @addtogroup Forward
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+
+#include "capture.hxx"
+
+/**
+ * Capture constructor.
+ */
+CaptureSink::CaptureSink()
+{
+  _fd = -1;
+  _loop = 0;
+  _timer = -1;
+  _started = false;
+  _last = 0;
+  _used = 0;
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+CaptureSink::~CaptureSink()
+{
+  stop();
+  close();
+}
+
+/**
+ * Create the trace file (truncating an existing one) or open a named pipe;
+ * the latter blocks until a reader has opened it.
+ *
+ * @param path File name
+ * @return true on success
+ */
+bool CaptureSink::open(const char* path)
+{
+  close();
+
+  _fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (_fd < 0)
+  {
+    perror(path);
+    return false;
+  }
+
+  // a reader of the pipe that goes away must not kill the bridge: write() fails with EPIPE
+  signal(SIGPIPE, SIG_IGN);
+
+  _started = false;
+  _used = 0;
+
+  return true;
+}
+
+/**
+ * Write the buffered records and close the file.
+ */
+void CaptureSink::close()
+{
+  if (_fd < 0)
+    return;
+
+  flush();
+  ::close(_fd);
+  _fd = -1;
+}
+
+/**
+ * Write the buffered records periodically.
+ */
+void CaptureSink::start(EventLoop* loop)
+{
+  _loop = loop;
+  _timer = timerCreate();
+  _loop->add(_timer, EPOLLIN, this);
+  timerArm(_timer, CAPTURE_FLUSH_INTERVAL, true);
+}
+
+/**
+ * Unregister from the event loop and write the buffered records.
+ */
+void CaptureSink::stop()
+{
+  if (0 == _loop)
+    return;
+
+  _loop->remove(_timer);
+  ::close(_timer);
+  _timer = -1;
+  _loop = 0;
+
+  flush();
+}
+
+/**
+ * Append a frame to the trace.
+ *
+ * @return 0 on success; -1 if the file could not be written.
+ */
+int CaptureSink::deliver(const Frame& frame)
+{
+  if (_fd < 0)
+    return -1;
+
+  unsigned int errors = _stats.errors;
+
+  if (false == _started)
+  {
+    CaptureHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CAPTURE_MAGIC;
+    header.version = CAPTURE_VERSION;
+    header.headerLength = sizeof(CaptureHeader);
+    header.recordLength = sizeof(CaptureRecord);
+    header.start = frame.timestamp;
+    append(&header, sizeof(header));
+
+    _last = frame.timestamp;
+    _started = true;
+  }
+
+  // a clock step back counts as no time passing
+  uint64_t delta = (frame.timestamp > _last) ? frame.timestamp - _last : 0;
+  _last = frame.timestamp;
+
+  CaptureRecord record;
+  memset(&record, 0, sizeof(record));
+
+  // gaps of more than 71 minutes: records with time only
+  while (delta > UINT32_MAX)
+  {
+    record.delta = UINT32_MAX;
+    append(&record, sizeof(record));
+    delta -= UINT32_MAX;
+  }
+
+  unsigned int length = (frame.length > FRAME_MAX_PAYLOAD) ? FRAME_MAX_PAYLOAD : frame.length;
+
+  record.delta = delta;
+  record.frequency = frame.frequency;
+  record.fei = frame.fei;
+  record.rssi = frame.rssi;
+  record.radio = frame.radio;
+  record.length = length;
+  append(&record, sizeof(record));
+  append(frame.data, length);
+
+  _stats.frames++;
+
+  return (errors == _stats.errors) ? 0 : -1;
+}
+
+/**
+ * Flush timer.
+ */
+void CaptureSink::handleEvent(int fd, uint32_t events)
+{
+  timerRead(fd);
+
+  flush();
+}
+
+/**
+ * Copy into the buffer; a full buffer is written first.
+ */
+void CaptureSink::append(const void* data, unsigned int length)
+{
+  if (_used + length > sizeof(_buffer))
+    flush();
+
+  memcpy(_buffer + _used, data, length);
+  _used += length;
+}
+
+/**
+ * Write the buffer to the file.
+ *
+ * @return false if the write failed; the buffered records are dropped then.
+ */
+bool CaptureSink::flush()
+{
+  unsigned int done = 0;
+
+  while (done < _used && _fd >= 0)
+  {
+    ssize_t n = write(_fd, _buffer + done, _used - done);
+    if (n < 0 && EINTR == errno)
+      continue;
+
+    if (n <= 0)
+    {
+      if (0 == _stats.errors++)
+        perror("capture");
+      break;
+    }
+
+    done += n;
+    _stats.bytes += n;
+    _stats.writes++;
+  }
+
+  bool ok = (done == _used);
+  _used = 0;
+
+  return ok;
+}
+
+/**
+ * Replay constructor.
+ *
+ * @param forwarder Pipeline the frames are fed into
+ */
+CaptureReplay::CaptureReplay(Forwarder* forwarder)
+{
+  _forwarder = forwarder;
+  _loop = 0;
+  _fd = -1;
+  _timer = -1;
+  _speed = 1;
+  _begin = 0;
+  _traceTime = 0;
+  _maxLag = 0;
+  _frames = 0;
+  _recordLength = sizeof(CaptureRecord);
+  _head = 0;
+  _count = 0;
+  memset(&_record, 0, sizeof(_record));
+}
+
+CaptureReplay::~CaptureReplay()
+{
+  stop();
+}
+
+/**
+ * Open a trace and read its header and first record.
+ *
+ * @param path File name; may be a named pipe
+ * @return true if the file is a trace with at least one record
+ */
+bool CaptureReplay::open(const char* path)
+{
+  _fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (_fd < 0)
+  {
+    perror(path);
+    return false;
+  }
+
+  CaptureHeader header;
+  if (false == take(&header, sizeof(header)) || CAPTURE_MAGIC != header.magic || 0 == header.version
+      || header.headerLength < sizeof(CaptureHeader) || header.recordLength < sizeof(CaptureRecord)
+      || false == take(0, header.headerLength - sizeof(CaptureHeader)))
+  {
+    fprintf(stderr, "%s: not a capture file\n", path);
+    return false;
+  }
+
+  _recordLength = header.recordLength;
+  _traceTime = 0;
+
+  return next();
+}
+
+/**
+ * Start feeding frames into the pipeline; the event loop is stopped after the
+ * last one.
+ *
+ * @param loop The main event loop
+ * @param speed Replay speed relative to the capture; 0 for as fast as possible
+ */
+void CaptureReplay::start(EventLoop* loop, double speed)
+{
+  _loop = loop;
+  _speed = speed;
+  _begin = frameClock();
+
+  _timer = timerCreate();
+  _loop->add(_timer, EPOLLIN, this);
+  timerArmUs(_timer, 1);
+}
+
+/**
+ * Unregister from the event loop and close the trace.
+ */
+void CaptureReplay::stop()
+{
+  if (0 != _loop)
+  {
+    _loop->remove(_timer);
+    ::close(_timer);
+    _timer = -1;
+    _loop = 0;
+  }
+
+  if (_fd >= 0)
+  {
+    ::close(_fd);
+    _fd = -1;
+  }
+}
+
+/**
+ * Replay the frames that are due, at most CAPTURE_REPLAY_BATCH per wake-up so
+ * the other handlers of the loop keep running.
+ */
+void CaptureReplay::handleEvent(int fd, uint32_t events)
+{
+  timerRead(fd);
+
+  uint64_t now = frameClock();
+
+  for (unsigned int i = 0; i < CAPTURE_REPLAY_BATCH; i++)
+  {
+    if (_speed > 0)
+    {
+      uint64_t due = _begin + (uint64_t) (_traceTime * 1000 / _speed);
+      if (due > now)
+      {
+        timerArmUs(_timer, (due - now + 999) / 1000);
+        return;
+      }
+
+      if (now - due > _maxLag)
+        _maxLag = now - due;
+    }
+
+    if (_record.length > 0)
+    {
+      Frame frame;
+      memset(&frame, 0, sizeof(frame));
+      frame.timestamp = frameTimestamp();
+      frame.frequency = _record.frequency;
+      frame.radio = _record.radio;
+      frame.length = _record.length;
+      frame.rssi = _record.rssi;
+      frame.fei = _record.fei;
+      memcpy(frame.data, _payload, _record.length);
+
+      _forwarder->forward(frame);
+      _frames++;
+    }
+
+    if (false == next())
+    {
+      finish();
+      return;
+    }
+  }
+
+  timerArmUs(_timer, 1);
+}
+
+/**
+ * Copy bytes out of the read buffer, refilling it from the file.
+ *
+ * @param data Destination; 0 to skip the bytes
+ * @param length Number of bytes
+ * @return false at the end of the file
+ */
+bool CaptureReplay::take(void* data, unsigned int length)
+{
+  while (length > 0)
+  {
+    if (0 == _count)
+    {
+      ssize_t n = read(_fd, _buffer, sizeof(_buffer));
+      if (n < 0 && EINTR == errno)
+        continue;
+      if (n <= 0)
+        return false;
+
+      _head = 0;
+      _count = n;
+    }
+
+    unsigned int chunk = (length < _count) ? length : _count;
+    if (0 != data)
+    {
+      memcpy(data, _buffer + _head, chunk);
+      data = (uint8_t*) data + chunk;
+    }
+
+    _head += chunk;
+    _count -= chunk;
+    length -= chunk;
+  }
+
+  return true;
+}
+
+/**
+ * Read the next record and its payload.
+ *
+ * @return false at the end of the trace (a truncated record ends it, too)
+ */
+bool CaptureReplay::next()
+{
+  if (false == take(&_record, sizeof(_record)) || false == take(0, _recordLength - sizeof(_record))
+      || _record.length > FRAME_MAX_PAYLOAD || false == take(_payload, _record.length))
+    return false;
+
+  _traceTime += _record.delta;
+
+  return true;
+}
+
+/**
+ * Print the throughput and stop the event loop.
+ */
+void CaptureReplay::finish()
+{
+  double seconds = (frameClock() - _begin) / 1e9;
+
+  printf("replay: %u frames in %.3f s, %.0f frames/s", _frames, seconds, seconds > 0 ? _frames / seconds : 0);
+  if (_speed > 0)
+    printf(", at %gx, lagging up to %.1f ms", _speed, _maxLag / 1e6);
+  printf("\r\n");
+
+  timerDisarm(_timer);
+  _loop->stop();
+}
+
+/** @}
+ *
+ */
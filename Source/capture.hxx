@@ -0,0 +1,155 @@
+/**
+ * @file capture.hxx
+ *
+ * @brief Capture of received frames to a file and replay into the pipeline.
+ *
+ * CaptureSink writes every frame the radios receive to a compact binary trace:
+ * a header with the time of the first frame, then one record per frame with the
+ * time since the previous one, the metadata and the raw payload. Records are
+ * collected in a buffer that is written when full and once a second, so the
+ * main thread makes a few large write() calls instead of one per frame; the
+ * file may also be a named pipe.
+ *
+ * CaptureReplay reads such a trace and feeds the frames into the forwarding
+ * pipeline with the original gaps, N times faster or as fast as possible, so
+ * the throughput of dedup and the sinks can be measured without radios. A
+ * replayed frame gets the current time as its timestamp.
+ *
+ * All fields are in host byte order (little endian on the supported boards).
+ */
+
+#ifndef CAPTURE_HXX_
+#define CAPTURE_HXX_
+
+#include <stdint.h>
+
+#include "frame.hxx"
+#include "forward.hxx"
+#include "eventloop.hxx"
+
+/** @addtogroup Forward
+ * @{
+ */
+#define CAPTURE_MAGIC         0x54464D52 ///< "RFMT"
+#define CAPTURE_VERSION       1          ///< Format version
+#define CAPTURE_BUFFER_SIZE   65536      ///< Write and read buffer [bytes]
+#define CAPTURE_FLUSH_INTERVAL 1000      ///< Buffered records are written at least this often [ms]
+#define CAPTURE_REPLAY_BATCH  256        ///< Frames replayed per wake-up at most
+
+/** Trace file header. */
+typedef struct __attribute__((packed))
+{
+  uint32_t magic;         //!< CAPTURE_MAGIC
+  uint8_t version;        //!< CAPTURE_VERSION
+  uint8_t headerLength;   //!< sizeof(CaptureHeader)
+  uint8_t recordLength;   //!< sizeof(CaptureRecord); newer versions may append fields
+  uint8_t reserved;       //!< Always 0
+  uint64_t start;         //!< Reception time of the first frame (CLOCK_REALTIME) [us]
+} CaptureHeader;
+
+/** Record in front of every payload. */
+typedef struct __attribute__((packed))
+{
+  uint32_t delta;         //!< Time since the previous record (the first: since start) [us]
+  uint32_t frequency;     //!< Carrier frequency [Hz]; 0 if unknown
+  int32_t fei;            //!< Frequency error [Hz]; 0 if not measured
+  int8_t rssi;            //!< RSSI [dBm]
+  uint8_t radio;          //!< Tag of the receiving radio
+  uint8_t length;         //!< Payload bytes following; 0 for a record that only carries time
+} CaptureRecord;
+
+/** Capture counters. */
+typedef struct
+{
+  unsigned int frames;      //!< Frames captured
+  uint64_t bytes;           //!< Bytes written
+  unsigned int writes;      //!< write() calls
+  unsigned int errors;      //!< Failed writes; the buffered records are lost
+} CaptureStats;
+
+/** Writes received frames to a trace file. */
+class CaptureSink : public FrameSink, public EventHandler
+{
+public:
+  CaptureSink();
+  virtual ~CaptureSink();
+
+  bool open(const char* path);
+
+  void close();
+
+  void start(EventLoop* loop);
+
+  void stop();
+
+  int deliver(const Frame& frame);
+
+  void handleEvent(int fd, uint32_t events);
+
+  /**
+   * Get the capture counters.
+   */
+  const CaptureStats& getStats()
+  {
+    return _stats;
+  }
+
+private:
+  bool flush();
+
+  void append(const void* data, unsigned int length);
+
+  int _fd;
+  EventLoop* _loop;
+  int _timer;
+  bool _started;
+  uint64_t _last;
+  unsigned int _used;
+  CaptureStats _stats;
+  uint8_t _buffer[CAPTURE_BUFFER_SIZE];
+};
+
+/** Feeds a trace file into the forwarding pipeline. */
+class CaptureReplay : public EventHandler
+{
+public:
+  CaptureReplay(Forwarder* forwarder);
+  virtual ~CaptureReplay();
+
+  bool open(const char* path);
+
+  void start(EventLoop* loop, double speed = 1);
+
+  void stop();
+
+  void handleEvent(int fd, uint32_t events);
+
+private:
+  bool take(void* data, unsigned int length);
+
+  bool next();
+
+  void finish();
+
+  Forwarder* _forwarder;
+  EventLoop* _loop;
+  int _fd;
+  int _timer;
+  double _speed;
+  uint64_t _begin;
+  uint64_t _traceTime;
+  uint64_t _maxLag;
+  unsigned int _frames;
+  unsigned int _recordLength;
+  CaptureRecord _record;
+  uint8_t _payload[FRAME_MAX_PAYLOAD];
+  unsigned int _head;
+  unsigned int _count;
+  uint8_t _buffer[CAPTURE_BUFFER_SIZE];
+};
+
+/** @}
+ *
+ */
+
+#endif /* CAPTURE_HXX_ */
@@ -0,0 +1,363 @@
+/**
+ * @file control.cxx
+ *
+ * @brief Live reconfiguration of the radios through a local control port.
+ */
+
+/** @addtogroup Radio
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "control.hxx"
+
+/**
+ * Control port constructor.
+ *
+ * @param actor Actor that runs the radios
+ */
+ControlSocket::ControlSocket(RadioActor* actor)
+{
+  _actor = actor;
+  _loop = 0;
+  _fd = -1;
+  memset(_radios, 0, sizeof(_radios));
+  memset(&_stats, 0, sizeof(_stats));
+
+  for (unsigned int i = 0; i < RADIOACTOR_MAX_RADIOS; i++)
+  {
+    _radios[i].profile = rfm69_base_profile;
+    _radios[i].powerDBm = 13;
+  }
+}
+
+ControlSocket::~ControlSocket()
+{
+  stop();
+}
+
+/**
+ * Set the settings a radio has been started with.
+ *
+ * @param radio Index of the radio
+ * @param profile Profile of the radio
+ * @param powerDBm Output power [dBm]
+ */
+void ControlSocket::setProfile(uint8_t radio, const RFM69Profile& profile, int8_t powerDBm)
+{
+  if (radio >= RADIOACTOR_MAX_RADIOS)
+    return;
+
+  _radios[radio].profile = profile;
+  _radios[radio].powerDBm = powerDBm;
+}
+
+/**
+ * Open the control port on the loopback interface.
+ *
+ * @param loop Event loop of the main thread
+ * @param port UDP port for requests
+ * @return true on success
+ */
+bool ControlSocket::start(EventLoop* loop, int port)
+{
+  _fd = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+  if (_fd < 0)
+    return false;
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+
+  if (bind(_fd, (struct sockaddr*) &addr, sizeof addr) < 0)
+  {
+    perror("bind control port");
+    close(_fd);
+    _fd = -1;
+    return false;
+  }
+
+  _loop = loop;
+  _loop->add(_fd, EPOLLIN, this);
+
+  return true;
+}
+
+/**
+ * Close the control port.
+ */
+void ControlSocket::stop()
+{
+  if (0 == _loop)
+    return;
+
+  _loop->remove(_fd);
+  close(_fd);
+  _fd = -1;
+  _loop = 0;
+}
+
+/**
+ * Complete a SET request once the radio thread has applied it (main thread).
+ *
+ * @param radio Index of the radio
+ * @param registers Number of registers written; -1 if the output power was rejected
+ * @param downtime Time the receiver was not ready [us]
+ */
+void ControlSocket::configured(uint8_t radio, int registers, unsigned int downtime)
+{
+  if (radio >= RADIOACTOR_MAX_RADIOS || false == _radios[radio].pending)
+    return;
+
+  RadioControl* control = &_radios[radio];
+  control->profile = control->requested;
+  control->pending = false;
+  _stats.applied++;
+
+  if (registers < 0)
+  {
+    reply(&control->client, "ERR power not supported by the module");
+    return;
+  }
+
+  control->powerDBm = control->requestedPower;
+
+  printf("radio %u: reconfigured, %d registers, %u us RX downtime\r\n", radio, registers, downtime);
+
+  char answer[64];
+  snprintf(answer, sizeof(answer), "OK registers=%d downtime=%u", registers, downtime);
+  reply(&control->client, answer);
+}
+
+/**
+ * Handle requests.
+ */
+void ControlSocket::handleEvent(int fd, uint32_t events)
+{
+  char text[256];
+  struct sockaddr_in from;
+  socklen_t fromLength = sizeof(from);
+  int n;
+
+  while ((n = recvfrom(_fd, text, sizeof(text) - 1, 0, (struct sockaddr*) &from, &fromLength)) > 0)
+  {
+    text[n] = '\0';
+    request(text, &from);
+    fromLength = sizeof(from);
+  }
+}
+
+/**
+ * Apply the requested settings (radio thread).
+ */
+void ControlSocket::apply(Radio* radio, void* context)
+{
+  RadioControl* control = (RadioControl*) context;
+
+  radio->reconfigure(control->requested, control->requestedPower);
+}
+
+/**
+ * Process a SET or GET request.
+ */
+void ControlSocket::request(char* text, const struct sockaddr_in* from)
+{
+  // strip trailing line breaks of hand written requests (nc, socat)
+  unsigned int len = strlen(text);
+  while (len > 0 && (text[len - 1] == '\n' || text[len - 1] == '\r'))
+    text[--len] = '\0';
+
+  bool set = (0 == strncmp(text, "SET", 3));
+  if ((false == set && 0 != strncmp(text, "GET", 3)) || (text[3] != '\0' && text[3] != ' '))
+  {
+    _stats.rejected++;
+    reply(from, "ERR unknown request");
+    return;
+  }
+
+  int radio = 0;
+  RFM69Profile profile;
+  int8_t powerDBm;
+
+  // the radio index may come anywhere in the request, so parse it first
+  char copy[256];
+  strcpy(copy, text + 3);
+  RFM69Profile ignored;
+  int8_t ignoredPower;
+  if (false == parse(copy, &radio, &ignored, &ignoredPower) || radio < 0
+      || (unsigned int) radio >= _actor->getCount())
+  {
+    _stats.rejected++;
+    reply(from, "ERR invalid request");
+    return;
+  }
+
+  RadioControl* control = &_radios[radio];
+  profile = control->profile;
+  powerDBm = control->powerDBm;
+
+  if (false == set)
+  {
+    char sync[17] = "off";
+    for (unsigned int i = 0; i < profile.syncLength; i++)
+      sprintf(sync + 2 * i, "%02X", profile.syncWord[i]);
+
+    char answer[192];
+    snprintf(answer, sizeof(answer), "OK radio=%d freq=%u bitrate=%u fdev=%u rxbw=%u sync=%s key=%s power=%d",
+        radio, profile.frequency, profile.bitrate, profile.deviation,
+        rfm69RxBandwidth(rfm69RxBw(profile.rxBandwidth)), sync, profile.aes ? "on" : "off", powerDBm);
+    _stats.requests++;
+    reply(from, answer);
+    return;
+  }
+
+  if (control->pending)
+  {
+    _stats.rejected++;
+    reply(from, "ERR busy");
+    return;
+  }
+
+  parse(text + 3, &radio, &profile, &powerDBm);
+
+  if (false == rfm69ProfileValid(profile) || powerDBm < -18 || powerDBm > 20)
+  {
+    _stats.rejected++;
+    reply(from, "ERR invalid profile");
+    return;
+  }
+
+  control->requested = profile;
+  control->requestedPower = powerDBm;
+  control->client = *from;
+  control->pending = true;
+
+  if (_actor->call(radio, apply, control) < 0)
+  {
+    control->pending = false;
+    _stats.rejected++;
+    reply(from, "ERR queue full");
+    return;
+  }
+
+  _stats.requests++;
+}
+
+/**
+ * Parse a hex string of up to maxLength bytes.
+ *
+ * @return Number of bytes; -1 if invalid.
+ */
+static int parseHex(const char* text, uint8_t* bytes, unsigned int maxLength)
+{
+  unsigned int length = strlen(text);
+  if (0 == length || length % 2 || length / 2 > maxLength)
+    return -1;
+
+  for (unsigned int i = 0; i < length / 2; i++)
+  {
+    char digits[3] = { text[2 * i], text[2 * i + 1], '\0' };
+    char* end;
+    bytes[i] = strtoul(digits, &end, 16);
+    if (*end != '\0')
+      return -1;
+  }
+
+  return length / 2;
+}
+
+/**
+ * Parse the settings of a request into a profile.
+ */
+bool ControlSocket::parse(char* text, int* radio, RFM69Profile* profile, int8_t* powerDBm)
+{
+  char* save;
+  for (char* token = strtok_r(text, " ", &save); token; token = strtok_r(0, " ", &save))
+  {
+    char* value = strchr(token, '=');
+    if (0 == value)
+      return false;
+    *value++ = '\0';
+
+    if (0 == strcmp(token, "radio"))
+    {
+      *radio = atoi(value);
+    }
+    else if (0 == strcmp(token, "freq"))
+    {
+      profile->frequency = strtoul(value, 0, 0);
+    }
+    else if (0 == strcmp(token, "bitrate"))
+    {
+      profile->bitrate = strtoul(value, 0, 0);
+    }
+    else if (0 == strcmp(token, "fdev"))
+    {
+      profile->deviation = strtoul(value, 0, 0);
+    }
+    else if (0 == strcmp(token, "rxbw"))
+    {
+      profile->rxBandwidth = strtoul(value, 0, 0);
+    }
+    else if (0 == strcmp(token, "power"))
+    {
+      *powerDBm = atoi(value);
+    }
+    else if (0 == strcmp(token, "sync"))
+    {
+      if (0 == strcmp(value, "off"))
+      {
+        profile->syncLength = 0;
+      }
+      else
+      {
+        int length = parseHex(value, profile->syncWord, sizeof(profile->syncWord));
+        if (length < 0)
+          return false;
+        profile->syncLength = length;
+      }
+    }
+    else if (0 == strcmp(token, "key"))
+    {
+      if (0 == strcmp(value, "off"))
+      {
+        profile->aes = false;
+      }
+      else
+      {
+        if (parseHex(value, profile->aesKey, sizeof(profile->aesKey)) != sizeof(profile->aesKey))
+          return false;
+        profile->aes = true;
+      }
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Send a reply datagram.
+ */
+void ControlSocket::reply(const struct sockaddr_in* to, const char* text)
+{
+  sendto(_fd, text, strlen(text), 0, (const struct sockaddr*) to, sizeof(*to));
+}
+
+/** @}
+ *
+ */
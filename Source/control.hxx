@@ -0,0 +1,101 @@
+/**
+ * @file control.hxx
+ *
+ * @brief Live reconfiguration of the radios through a local control port.
+ *
+ * Frequency, bitrate, deviation, RX bandwidth, sync word, AES key and output
+ * power of a radio can be changed while the bridge runs. A request is a single
+ * text datagram to the control port on the loopback interface:
+ *
+ *   SET [radio=0] [freq=868300000] [bitrate=9600] [fdev=20000] [rxbw=50000]
+ *       [sync=DEADBEEF|off] [key=<32 hex digits>|off] [power=13]
+ *   GET [radio=0]
+ *
+ * Omitted settings are kept. The changed profile is checked like a compiled one
+ * (see RFM69_PROFILE_CHECK()) and handed to the radio thread, which writes only
+ * the registers that differ from the shadow copy in a gap between two packets;
+ * the receiver stays in RX mode. The reply to SET comes when the change has been
+ * applied: "OK registers=<n> downtime=<us>" with the number of registers written
+ * and the time the receiver was not ready, or "ERR <reason>". GET returns the
+ * current settings.
+ */
+
+#ifndef CONTROL_HXX_
+#define CONTROL_HXX_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "radioactor.hxx"
+#include "rfm69profile.hxx"
+#include "eventloop.hxx"
+
+/** @addtogroup Radio
+ * @{
+ */
+#define CONTROL_PORT        12348 ///< Default control port (loopback only)
+
+/** Control port counters. */
+typedef struct
+{
+  unsigned int requests;    //!< Valid requests
+  unsigned int rejected;    //!< Invalid requests, invalid profiles or busy radios
+  unsigned int applied;     //!< Configuration changes applied
+} ControlStats;
+
+/** Control port of the bridge. */
+class ControlSocket : public EventHandler
+{
+public:
+  ControlSocket(RadioActor* actor);
+  virtual ~ControlSocket();
+
+  void setProfile(uint8_t radio, const RFM69Profile& profile, int8_t powerDBm);
+
+  bool start(EventLoop* loop, int port = CONTROL_PORT);
+
+  void stop();
+
+  void configured(uint8_t radio, int registers, unsigned int downtime);
+
+  void handleEvent(int fd, uint32_t events);
+
+  /**
+   * Get the control port counters.
+   */
+  const ControlStats& getStats()
+  {
+    return _stats;
+  }
+
+private:
+  typedef struct
+  {
+    RFM69Profile profile;         // current settings
+    int8_t powerDBm;
+    RFM69Profile requested;       // settings of a pending SET; read by the radio thread
+    int8_t requestedPower;
+    bool pending;
+    struct sockaddr_in client;    // where the reply to the pending SET goes
+  } RadioControl;
+
+  static void apply(Radio* radio, void* context);
+
+  void request(char* text, const struct sockaddr_in* from);
+
+  bool parse(char* text, int* radio, RFM69Profile* profile, int8_t* powerDBm);
+
+  void reply(const struct sockaddr_in* to, const char* text);
+
+  RadioActor* _actor;
+  EventLoop* _loop;
+  int _fd;
+  RadioControl _radios[RADIOACTOR_MAX_RADIOS];
+  ControlStats _stats;
+};
+
+/** @}
+ *
+ */
+
+#endif /* CONTROL_HXX_ */
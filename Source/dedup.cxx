@@ -0,0 +1,244 @@
+/**
+ * @file dedup.cxx
+ *
+ * @brief Duplicate frame suppression in front of the sinks.
+ */
+
+/** @addtogroup Forward
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "dedup.hxx"
+
+extern uint32_t HAL_GetTick();
+
+/**
+ * Dedup constructor.
+ *
+ * @param output Receives held frames when their window is over
+ * @param window Time window [ms] in which copies are suppressed
+ * @param hold Hold new frames for the window and emit the copy with the best RSSI
+ */
+Dedup::Dedup(FrameSink* output, unsigned int window, bool hold)
+{
+  _output = output;
+  _window = window;
+  _hold = hold;
+  _loop = 0;
+  _timer = -1;
+  _pendingCount = 0;
+  memset(&_stats, 0, sizeof(_stats));
+  memset(_table, 0, sizeof(_table));
+}
+
+Dedup::~Dedup()
+{
+  stop();
+}
+
+/**
+ * Register the flush timer with the event loop (needed in hold mode only).
+ */
+void Dedup::start(EventLoop* loop)
+{
+  if (false == _hold)
+    return;
+
+  _loop = loop;
+  _timer = timerCreate();
+  _loop->add(_timer, EPOLLIN, this);
+}
+
+/**
+ * Emit all held frames and unregister from the event loop.
+ */
+void Dedup::stop()
+{
+  flush(true);
+
+  if (0 == _loop)
+    return;
+
+  _loop->remove(_timer);
+  close(_timer);
+  _timer = -1;
+  _loop = 0;
+}
+
+/**
+ * FNV-1a hash of the payload.
+ */
+uint32_t Dedup::hashPayload(const uint8_t* data, unsigned int length)
+{
+  uint32_t hash = 2166136261UL;
+
+  for (unsigned int i = 0; i < length; i++)
+  {
+    hash ^= data[i];
+    hash *= 16777619UL;
+  }
+
+  return hash;
+}
+
+/**
+ * Check a frame against the frames of the current window.
+ *
+ * @param frame The received frame
+ * @return DEDUP_FORWARD if the caller shall forward it now; DEDUP_HELD if it is
+ *         emitted later to the output; DEDUP_DUPLICATE if it is suppressed.
+ */
+DedupResult Dedup::offer(const Frame& frame)
+{
+  uint32_t now = HAL_GetTick();
+  uint32_t hash = hashPayload(frame.data, frame.length);
+  unsigned int index = hash & (DEDUP_TABLE_SIZE - 1);
+  Entry* slot = 0;
+
+  // linear probing; expired entries are reused but do not end the search
+  for (unsigned int probe = 0; probe < DEDUP_MAX_PROBE; probe++)
+  {
+    Entry* entry = &_table[(index + probe) & (DEDUP_TABLE_SIZE - 1)];
+
+    if (false == entry->used)
+    {
+      if (0 == slot)
+        slot = entry;
+      break;
+    }
+
+    bool expired = (false == entry->pending) && ((int32_t)(now - entry->expires) >= 0);
+
+    if (false == expired && entry->hash == hash && entry->length == frame.length)
+    {
+      _stats.duplicates++;
+
+      // keep the copy with the best reception
+      if (entry->pending && frame.rssi > entry->held->rssi)
+      {
+        Frame* better = frameRef(frame);
+        if (0 != better)
+        {
+          frameUnref(entry->held);
+          entry->held = better;
+          _stats.replaced++;
+        }
+      }
+
+      return DEDUP_DUPLICATE;
+    }
+
+    if (expired && 0 == slot)
+      slot = entry;
+  }
+
+  if (0 == slot)
+  {
+    // table is full of live entries: take over the home slot
+    slot = &_table[index];
+    _stats.evicted++;
+
+    if (slot->pending)
+    {
+      slot->pending = false;
+      _pendingCount--;
+      _output->deliver(*slot->held);
+      frameUnref(slot->held);
+      slot->held = 0;
+    }
+  }
+
+  _stats.unique++;
+
+  slot->used = true;
+  slot->hash = hash;
+  slot->length = frame.length;
+  slot->expires = now + _window;
+  slot->pending = false;
+
+  // without a free buffer the frame is forwarded right away
+  if (_hold && 0 != _loop && 0 != (slot->held = frameRef(frame)))
+  {
+    slot->pending = true;
+    _pendingCount++;
+
+    if (1 == _pendingCount)
+      armTimer();
+
+    return DEDUP_HELD;
+  }
+
+  return DEDUP_FORWARD;
+}
+
+/**
+ * Emit all held frames whose window is over.
+ *
+ * @param all Emit all held frames regardless of their window
+ */
+void Dedup::flush(bool all)
+{
+  if (0 == _pendingCount)
+    return;
+
+  uint32_t now = HAL_GetTick();
+
+  for (unsigned int i = 0; i < DEDUP_TABLE_SIZE && _pendingCount > 0; i++)
+  {
+    Entry* entry = &_table[i];
+
+    if (entry->pending && (all || (int32_t)(now - entry->expires) >= 0))
+    {
+      entry->pending = false;
+      _pendingCount--;
+      _output->deliver(*entry->held);
+      frameUnref(entry->held);
+      entry->held = 0;
+    }
+  }
+}
+
+/**
+ * Arm the flush timer for the oldest held frame.
+ */
+void Dedup::armTimer()
+{
+  if (0 == _pendingCount)
+    return;
+
+  uint32_t now = HAL_GetTick();
+  int32_t next = _window;
+
+  for (unsigned int i = 0; i < DEDUP_TABLE_SIZE; i++)
+  {
+    if (_table[i].pending)
+    {
+      int32_t remaining = _table[i].expires - now;
+      if (remaining < next)
+        next = remaining;
+    }
+  }
+
+  timerArm(_timer, next > 0 ? next : 1);
+}
+
+/**
+ * Flush timer expired.
+ */
+void Dedup::handleEvent(int fd, uint32_t events)
+{
+  timerRead(_timer);
+
+  flush();
+  armTimer();
+}
+
+/** @}
+ *
+ */
@@ -0,0 +1,105 @@
+/**
+ * @file dedup.hxx
+ *
+ * @brief Duplicate frame suppression in front of the sinks.
+ *
+ * Battery sensors send every reading several times and with more than one radio
+ * the same frame arrives on each module. Dedup remembers (payload hash, length)
+ * of every frame for a time window in a fixed size open addressing table and
+ * suppresses copies seen within that window.
+ *
+ * In hold mode (used when metadata is forwarded) the first copy is not passed on
+ * immediately; it is kept for the window, replaced by any copy with a higher RSSI
+ * and emitted when the window is over. A held frame is a reference from
+ * frameRef(): frames of the radio thread arrive in its event ring, so holding
+ * one copies it into the frame pool of the main thread once.
+ */
+
+#ifndef DEDUP_HXX_
+#define DEDUP_HXX_
+
+#include <stdint.h>
+
+#include "frame.hxx"
+#include "forward.hxx"
+#include "eventloop.hxx"
+
+/** @addtogroup Forward
+ * @{
+ */
+#define DEDUP_TABLE_SIZE      256 ///< Number of entries; must be a power of two
+#define DEDUP_MAX_PROBE       16  ///< Maximum probe sequence length
+#define DEDUP_DEFAULT_WINDOW  500 ///< Default time window [ms]
+
+/** Result of Dedup::offer(). */
+typedef enum
+{
+  DEDUP_FORWARD = 0,  //!< New frame, forward it now
+  DEDUP_HELD,         //!< New frame, held until the window is over
+  DEDUP_DUPLICATE     //!< Copy of a frame seen within the window
+} DedupResult;
+
+/** Dedup counters. */
+typedef struct
+{
+  unsigned int unique;      //!< Frames seen the first time
+  unsigned int duplicates;  //!< Suppressed copies
+  unsigned int replaced;    //!< Held copies replaced by one with better RSSI
+  unsigned int evicted;     //!< Entries overwritten before their window was over (table full)
+} DedupStats;
+
+/** Duplicate suppression stage. */
+class Dedup : public EventHandler
+{
+public:
+  Dedup(FrameSink* output, unsigned int window = DEDUP_DEFAULT_WINDOW, bool hold = false);
+  virtual ~Dedup();
+
+  void start(EventLoop* loop);
+
+  void stop();
+
+  DedupResult offer(const Frame& frame);
+
+  void flush(bool all = false);
+
+  void handleEvent(int fd, uint32_t events);
+
+  /**
+   * Get the dedup counters.
+   */
+  const DedupStats& getStats()
+  {
+    return _stats;
+  }
+
+private:
+  typedef struct
+  {
+    uint32_t hash;
+    uint8_t length;
+    bool used;
+    bool pending;
+    uint32_t expires;
+    Frame* held;
+  } Entry;
+
+  static uint32_t hashPayload(const uint8_t* data, unsigned int length);
+
+  void armTimer();
+
+  FrameSink* _output;
+  unsigned int _window;
+  bool _hold;
+  EventLoop* _loop;
+  int _timer;
+  unsigned int _pendingCount;
+  DedupStats _stats;
+  Entry _table[DEDUP_TABLE_SIZE];
+};
+
+/** @}
+ *
+ */
+
+#endif /* DEDUP_HXX_ */
@@ -0,0 +1,47 @@
+/**
+ * @file envelope.hxx
+ *
+ * @brief Versioned binary envelope for frames sent to BA30Server.
+ *
+ * In legacy mode a datagram carries nothing but the payload. With the envelope
+ * enabled, every datagram starts with a fixed header carrying the metadata of
+ * the frame, followed by the unmodified payload. The payload length is the
+ * datagram length minus headerLength.
+ *
+ * All fields are in network byte order.
+ */
+
+#ifndef ENVELOPE_HXX_
+#define ENVELOPE_HXX_
+
+#include <stdint.h>
+
+/** @addtogroup Forward
+ * @{
+ */
+#define ENVELOPE_MAGIC        0x52464D45 ///< "RFME"
+#define ENVELOPE_VERSION      1          ///< Header version
+
+#define ENVELOPE_FLAG_CRC_OK  0x01       ///< Payload CRC was checked by the radio and is valid
+
+/** Envelope header in front of the payload. */
+typedef struct __attribute__((packed))
+{
+  uint32_t magic;         //!< ENVELOPE_MAGIC
+  uint8_t version;        //!< ENVELOPE_VERSION
+  uint8_t headerLength;   //!< sizeof(EnvelopeHeader); newer versions may append fields
+  uint8_t radio;          //!< Tag of the receiving radio
+  uint8_t flags;          //!< ENVELOPE_FLAG_...
+  uint32_t seq;           //!< Datagram sequence number of this sender; gaps indicate losses
+  uint64_t timestamp;     //!< Reception time (CLOCK_REALTIME) [us]
+  int16_t rssi;           //!< RSSI [dBm]
+  uint16_t reserved;      //!< Always 0
+  int32_t fei;            //!< Frequency error [Hz]; 0 if not measured
+  uint32_t frequency;     //!< Carrier frequency [Hz]; 0 if unknown
+} EnvelopeHeader;
+
+/** @}
+ *
+ */
+
+#endif /* ENVELOPE_HXX_ */
@@ -0,0 +1,260 @@
+/**
+ * @file eventloop.cxx
+ *
+ * @brief Single threaded epoll reactor.
+ */
+
+/** @addtogroup EventLoop
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#include "eventloop.hxx"
+
+extern void pabort(const char *s);
+
+/**
+ * Create the epoll instance.
+ */
+EventLoop::EventLoop()
+{
+  _running = false;
+  memset(_handlers, 0, sizeof(_handlers));
+
+  _epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (_epfd < 0)
+    pabort("Can't create epoll instance");
+}
+
+EventLoop::~EventLoop()
+{
+  close(_epfd);
+}
+
+/**
+ * Register a file descriptor.
+ *
+ * @param fd File descriptor to watch
+ * @param events epoll events to wait for (EPOLLIN, EPOLLPRI, ...)
+ * @param handler Handler that is called when the descriptor is ready
+ * @return true on success
+ */
+bool EventLoop::add(int fd, uint32_t events, EventHandler* handler)
+{
+  if (fd < 0 || fd >= EVENTLOOP_MAX_FDS)
+    return false;
+
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.fd = fd;
+
+  if (epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    return false;
+
+  _handlers[fd] = handler;
+
+  return true;
+}
+
+/**
+ * Change the events or the handler of a registered file descriptor.
+ */
+bool EventLoop::modify(int fd, uint32_t events, EventHandler* handler)
+{
+  if (fd < 0 || fd >= EVENTLOOP_MAX_FDS)
+    return false;
+
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.fd = fd;
+
+  if (epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &ev) != 0)
+    return false;
+
+  _handlers[fd] = handler;
+
+  return true;
+}
+
+/**
+ * Unregister a file descriptor. The descriptor itself is not closed.
+ */
+void EventLoop::remove(int fd)
+{
+  epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, 0);
+
+  if (fd >= 0 && fd < EVENTLOOP_MAX_FDS)
+    _handlers[fd] = 0;
+}
+
+/**
+ * Wait for events once and dispatch them.
+ *
+ * @param timeout Maximum time to wait [ms]; -1 waits forever
+ * @return Number of dispatched events; -1 on error.
+ */
+int EventLoop::runOnce(int timeout)
+{
+  struct epoll_event events[EVENTLOOP_MAX_EVENTS];
+
+  int n = epoll_wait(_epfd, events, EVENTLOOP_MAX_EVENTS, timeout);
+  if (n < 0)
+  {
+    if (EINTR == errno)
+      return 0;
+
+    perror("epoll_wait");
+    return -1;
+  }
+
+  for (int i = 0; i < n; i++)
+  {
+    int fd = events[i].data.fd;
+
+    // the handler may have been removed by an earlier event of this batch
+    if (0 != _handlers[fd])
+      _handlers[fd]->handleEvent(fd, events[i].events);
+  }
+
+  return n;
+}
+
+/**
+ * Dispatch events until stop() is called.
+ */
+void EventLoop::run()
+{
+  _running = true;
+
+  while (_running)
+  {
+    if (runOnce(-1) < 0)
+      break;
+  }
+}
+
+/**
+ * Create a non-blocking monotonic timerfd.
+ *
+ * @return The timer file descriptor; the process is aborted on failure.
+ */
+int timerCreate()
+{
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0)
+    pabort("Can't create timerfd");
+
+  return fd;
+}
+
+/**
+ * Arm a timer.
+ *
+ * @param fd Timer file descriptor
+ * @param ms Expiration time [ms]; 0 disarms the timer
+ * @param periodic Rearm automatically with the same interval
+ */
+void timerArm(int fd, unsigned int ms, bool periodic)
+{
+  timerArmUs(fd, ms * 1000, periodic);
+}
+
+/**
+ * Arm a timer with microsecond resolution.
+ *
+ * @param fd Timer file descriptor
+ * @param us Expiration time [us]; 0 disarms the timer
+ * @param periodic Rearm automatically with the same interval
+ */
+void timerArmUs(int fd, unsigned int us, bool periodic)
+{
+  struct itimerspec spec;
+
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = us / 1000000;
+  spec.it_value.tv_nsec = (us % 1000000) * 1000;
+  if (periodic)
+    spec.it_interval = spec.it_value;
+
+  timerfd_settime(fd, 0, &spec, 0);
+}
+
+/**
+ * Stop a timer.
+ */
+void timerDisarm(int fd)
+{
+  timerArmUs(fd, 0);
+}
+
+/**
+ * Acknowledge a timer expiration.
+ *
+ * @return Number of expirations since the last read; 0 if none.
+ */
+uint64_t timerRead(int fd)
+{
+  uint64_t expirations = 0;
+
+  if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    return 0;
+
+  return expirations;
+}
+
+/**
+ * Block the given signals and create a signalfd for them.
+ *
+ * @param signals Array of signal numbers
+ * @param count Number of entries in signals
+ * @return The signal file descriptor; the process is aborted on failure.
+ */
+int signalCreate(const int* signals, unsigned int count)
+{
+  sigset_t mask;
+
+  sigemptyset(&mask);
+  for (unsigned int i = 0; i < count; i++)
+    sigaddset(&mask, signals[i]);
+
+  if (sigprocmask(SIG_BLOCK, &mask, 0) < 0)
+    pabort("Can't block signals");
+
+  int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd < 0)
+    pabort("Can't create signalfd");
+
+  return fd;
+}
+
+/**
+ * Read the next pending signal.
+ *
+ * @return The signal number; 0 if none is pending.
+ */
+int signalRead(int fd)
+{
+  struct signalfd_siginfo info;
+
+  if (read(fd, &info, sizeof(info)) != sizeof(info))
+    return 0;
+
+  return info.ssi_signo;
+}
+
+/** @}
+ *
+ */
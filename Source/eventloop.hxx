@@ -0,0 +1,91 @@
+/**
+ * @file eventloop.hxx
+ *
+ * @brief Single threaded epoll reactor.
+ *
+ * All I/O of the bridge (GPIO edges, UDP sockets, timers and signals) is
+ * multiplexed over one epoll instance. Handlers are called from run() in the
+ * thread that owns the loop; nothing in here spins or polls.
+ */
+
+#ifndef EVENTLOOP_HXX_
+#define EVENTLOOP_HXX_
+
+#include <stdint.h>
+#include <signal.h>
+
+/** @addtogroup EventLoop
+ * @{
+ */
+#define EVENTLOOP_MAX_EVENTS  16  ///< Events fetched per epoll_wait() call
+#define EVENTLOOP_MAX_FDS     256 ///< File descriptors must be below this number
+
+/**
+ * Interface for everything that wants to be notified about file descriptor events.
+ */
+class EventHandler
+{
+public:
+  virtual ~EventHandler()
+  {
+  }
+
+  /**
+   * Called by the event loop when a registered file descriptor is ready.
+   *
+   * @param fd The file descriptor that is ready
+   * @param events The epoll events (EPOLLIN, EPOLLPRI, ...)
+   */
+  virtual void handleEvent(int fd, uint32_t events) = 0;
+};
+
+/** epoll based event loop. */
+class EventLoop
+{
+public:
+  EventLoop();
+  virtual ~EventLoop();
+
+  bool add(int fd, uint32_t events, EventHandler* handler);
+
+  bool modify(int fd, uint32_t events, EventHandler* handler);
+
+  void remove(int fd);
+
+  int runOnce(int timeout);
+
+  void run();
+
+  /**
+   * Make run() return after the current iteration.
+   */
+  void stop()
+  {
+    _running = false;
+  }
+
+private:
+  int _epfd;
+  bool _running;
+  EventHandler* _handlers[EVENTLOOP_MAX_FDS];
+};
+
+int timerCreate();
+
+void timerArm(int fd, unsigned int ms, bool periodic = false);
+
+void timerArmUs(int fd, unsigned int us, bool periodic = false);
+
+void timerDisarm(int fd);
+
+uint64_t timerRead(int fd);
+
+int signalCreate(const int* signals, unsigned int count);
+
+int signalRead(int fd);
+
+/** @}
+ *
+ */
+
+#endif /* EVENTLOOP_HXX_ */
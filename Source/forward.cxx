@@ -0,0 +1,281 @@
+/**
+ * @file forward.cxx
+ *
+ * @brief Forwarding pipeline shared by all radios.
+ */
+
+/** @addtogroup Forward
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "forward.hxx"
+#include "envelope.hxx"
+#include "dedup.hxx"
+#include "metrics.hxx"
+#include "trace.hxx"
+
+Forwarder::Forwarder()
+{
+  _sinkCount = 0;
+  _dedup = 0;
+  memset(_sinks, 0, sizeof(_sinks));
+  memset(_stats, 0, sizeof(_stats));
+}
+
+/**
+ * Register a sink. Frames are delivered to the sinks in the order they were added.
+ *
+ * @return false if no more sinks can be added
+ */
+bool Forwarder::addSink(FrameSink* sink)
+{
+  if (_sinkCount >= FORWARD_MAX_SINKS)
+    return false;
+
+  _sinks[_sinkCount++] = sink;
+
+  return true;
+}
+
+/**
+ * Count a frame, check it for duplicates and deliver it to all sinks.
+ */
+void Forwarder::forward(const Frame& frame)
+{
+  ForwardStats* stats = &_stats[frame.radio % FORWARD_MAX_RADIOS];
+
+  stats->frames++;
+  stats->bytes += frame.length;
+  metricsAdd(METRIC_FORWARDED, frame.radio);
+
+  if (0 != _dedup)
+  {
+    DedupResult result = _dedup->offer(frame);
+
+    if (DEDUP_DUPLICATE == result)
+    {
+      stats->duplicates++;
+      metricsAdd(METRIC_DUPLICATES, frame.radio);
+    }
+
+    // held frames come back through deliver() later
+    if (DEDUP_FORWARD != result)
+      return;
+  }
+
+  deliver(frame);
+}
+
+/**
+ * Deliver a frame to all sinks.
+ *
+ * @return 0 if all sinks accepted the frame; -1 otherwise.
+ */
+int Forwarder::deliver(const Frame& frame)
+{
+  int ret = 0;
+
+  for (unsigned int i = 0; i < _sinkCount; i++)
+  {
+    if (_sinks[i]->deliver(frame) < 0)
+    {
+      _stats[frame.radio % FORWARD_MAX_RADIOS].sinkErrors++;
+      metricsAdd(METRIC_SINK_ERRORS, frame.radio);
+      ret = -1;
+    }
+  }
+
+  traceRecord(frame, frameClock());
+
+  // a clock step can make the reception time lie in the future
+  int64_t latency = frameTimestamp() - frame.timestamp;
+  metricsObserve(METRIC_LATENCY, frame.radio, latency < 0 ? 0 : (latency > INT32_MAX ? INT32_MAX : latency));
+
+  return ret;
+}
+
+/**
+ * Print the counters of all radios that have received something.
+ */
+void Forwarder::dumpStats()
+{
+  for (unsigned int i = 0; i < FORWARD_MAX_RADIOS; i++)
+  {
+    if (0 == _stats[i].frames)
+      continue;
+
+    printf("radio %d: %u frames, %u bytes, %u duplicates, %u sink errors\r\n", i, _stats[i].frames,
+        _stats[i].bytes, _stats[i].duplicates, _stats[i].sinkErrors);
+  }
+}
+
+/**
+ * UDP sink constructor. The socket is opened on the first frame.
+ *
+ * @param address Destination IPv4 address; broadcast addresses are allowed
+ * @param port Destination UDP port
+ */
+UdpSink::UdpSink(const char* address, int port)
+{
+  _fd = -1;
+  _envelope = false;
+  _seq = 0;
+
+  memset(&_address, 0, sizeof _address);
+  _address.sin_family = AF_INET;
+  inet_pton(AF_INET, address, &_address.sin_addr);
+  _address.sin_port = htons(port);
+}
+
+UdpSink::~UdpSink()
+{
+  if (_fd >= 0)
+    close(_fd);
+}
+
+/**
+ * Open the socket, enable broadcasts and connect it to the destination.
+ */
+bool UdpSink::open()
+{
+  int sd = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+  if (sd < 0)
+  {
+    return false;
+  }
+
+  int broadcastEnable = 1;
+  int ret = setsockopt(sd, SOL_SOCKET, SO_BROADCAST, &broadcastEnable, sizeof(broadcastEnable));
+  if (ret)
+  {
+    close(sd);
+    return false;
+  }
+
+  // errors reported by ICMP (e.g. server port closed) are only passed on to
+  // connected sockets; they make the next send fail
+  if (connect(sd, (struct sockaddr*) &_address, sizeof _address) < 0)
+  {
+    close(sd);
+    return false;
+  }
+
+  _fd = sd;
+
+  return true;
+}
+
+int UdpSink::deliver(const Frame& frame)
+{
+  if (_envelope)
+    return sendEnvelope(frame);
+
+  return send(frame.data, frame.length);
+}
+
+/**
+ * Send the frame in the envelope.
+ *
+ * @return 0 on success; -1 on failure (the socket is reopened on the next call).
+ */
+int UdpSink::sendEnvelope(const Frame& frame)
+{
+  if (_fd < 0 && false == open())
+    return -1;
+
+  if (sendFrame(_fd, &_address, frame, true, _seq++) < 0)
+  {
+    close(_fd);
+    _fd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Send one datagram.
+ *
+ * @return 0 on success; -1 on failure (the socket is reopened on the next call).
+ */
+int UdpSink::send(const void* data, unsigned int dataLength)
+{
+  if (_fd < 0 && false == open())
+    return -1;
+
+  int ret = sendto(_fd, data, dataLength, 0, (struct sockaddr*) &_address, sizeof _address);
+  if (ret < 0)
+  {
+    close(_fd);
+    _fd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Send a frame as one datagram.
+ *
+ * With the envelope, header and payload are passed to sendmsg() as two iovecs,
+ * so they are never copied into one buffer.
+ *
+ * @param fd UDP socket
+ * @param address Destination
+ * @param frame The frame
+ * @param envelope Send the EnvelopeHeader in front of the payload
+ * @param seq Sequence number for the envelope
+ * @return Result of sendmsg()
+ */
+int sendFrame(int fd, const struct sockaddr_in* address, const Frame& frame, bool envelope, uint32_t seq)
+{
+  EnvelopeHeader header;
+  struct iovec iov[2];
+  unsigned int count = 0;
+
+  if (envelope)
+  {
+    header.magic = htonl(ENVELOPE_MAGIC);
+    header.version = ENVELOPE_VERSION;
+    header.headerLength = sizeof(header);
+    header.radio = frame.radio;
+    header.flags = ENVELOPE_FLAG_CRC_OK; // the radio drops frames with CRC errors
+    header.seq = htonl(seq);
+    header.timestamp = htobe64(frame.timestamp);
+    header.rssi = htons(frame.rssi);
+    header.reserved = 0;
+    header.fei = htonl(frame.fei);
+    header.frequency = htonl(frame.frequency);
+
+    iov[count].iov_base = &header;
+    iov[count].iov_len = sizeof(header);
+    count++;
+  }
+
+  iov[count].iov_base = (void*) frame.data;
+  iov[count].iov_len = frame.length;
+  count++;
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = (void*) address;
+  msg.msg_namelen = sizeof(*address);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = count;
+
+  return sendmsg(fd, &msg, 0);
+}
+
+/** @}
+ *
+ */
@@ -0,0 +1,138 @@
+/**
+ * @file forward.hxx
+ *
+ * @brief Forwarding pipeline shared by all radios.
+ *
+ * Every radio hands its frames to one Forwarder, which counts them per radio,
+ * optionally drops duplicates and passes them on to all registered sinks (UDP, ...).
+ */
+
+#ifndef FORWARD_HXX_
+#define FORWARD_HXX_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "frame.hxx"
+
+/** @addtogroup Forward
+ * @{
+ */
+#define FORWARD_MAX_RADIOS  4 ///< Number of radios the pipeline keeps counters for
+#define FORWARD_MAX_SINKS   8 ///< Number of sinks a forwarder can feed
+
+/**
+ * Output of the forwarding pipeline.
+ */
+class FrameSink
+{
+public:
+  virtual ~FrameSink()
+  {
+  }
+
+  /**
+   * Deliver a frame.
+   *
+   * @param frame The frame; only valid during the call
+   * @return 0 on success; < 0 if the frame could not be delivered.
+   */
+  virtual int deliver(const Frame& frame) = 0;
+};
+
+/** Per radio counters of the forwarding pipeline. */
+typedef struct
+{
+  unsigned int frames;      //!< Frames received from this radio
+  unsigned int bytes;       //!< Payload bytes received from this radio
+  unsigned int sinkErrors;  //!< Deliveries of frames of this radio that failed
+  unsigned int duplicates;  //!< Frames of this radio suppressed as duplicates
+} ForwardStats;
+
+class Dedup;
+
+/**
+ * Fans frames of all radios out to the sinks.
+ *
+ * The forwarder is a sink itself: deliver() passes a frame to all sinks without
+ * counting or duplicate checks, e.g. for frames held back by the dedup stage.
+ */
+class Forwarder : public FrameSink
+{
+public:
+  Forwarder();
+
+  bool addSink(FrameSink* sink);
+
+  /**
+   * Insert a duplicate suppression stage in front of the sinks.
+   */
+  void setDedup(Dedup* dedup)
+  {
+    _dedup = dedup;
+  }
+
+  void forward(const Frame& frame);
+
+  int deliver(const Frame& frame);
+
+  void dumpStats();
+
+  /**
+   * Get the counters of a radio.
+   */
+  const ForwardStats& getStats(uint8_t radio)
+  {
+    return _stats[radio % FORWARD_MAX_RADIOS];
+  }
+
+private:
+  Dedup* _dedup;
+  FrameSink* _sinks[FORWARD_MAX_SINKS];
+  unsigned int _sinkCount;
+  ForwardStats _stats[FORWARD_MAX_RADIOS];
+};
+
+/**
+ * Sends every frame as one UDP datagram.
+ *
+ * In legacy mode the datagram is the bare payload (BA30Server format). With the
+ * envelope enabled an EnvelopeHeader is sent in front of it; header and payload
+ * are passed to sendmsg() as separate iovecs, so they are never copied together.
+ */
+class UdpSink : public FrameSink
+{
+public:
+  UdpSink(const char* address, int port);
+  virtual ~UdpSink();
+
+  /**
+   * Enable/disable the binary envelope (see envelope.hxx). Default is off.
+   */
+  void setEnvelope(bool enable)
+  {
+    _envelope = enable;
+  }
+
+  int deliver(const Frame& frame);
+
+  int send(const void* data, unsigned int dataLength);
+
+private:
+  bool open();
+
+  int sendEnvelope(const Frame& frame);
+
+  int _fd;
+  bool _envelope;
+  uint32_t _seq;
+  struct sockaddr_in _address;
+};
+
+int sendFrame(int fd, const struct sockaddr_in* address, const Frame& frame, bool envelope, uint32_t seq);
+
+/** @}
+ *
+ */
+
+#endif /* FORWARD_HXX_ */
@@ -0,0 +1,151 @@
+/**
+ * @file frame.cxx
+ *
+ * @brief Frame buffer pool.
+ */
+
+/** @addtogroup Forward
+ * @{
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "frame.hxx"
+
+/** One pool buffer; frames never share a cache line. */
+typedef struct
+{
+  Frame frame;
+} __attribute__((aligned(64))) FrameBuffer;
+
+// every thread has a pool of its own, so no locking is needed
+static __thread FrameBuffer pool[FRAME_POOL_SIZE];
+static __thread uint16_t freeList[FRAME_POOL_SIZE];
+static __thread unsigned int freeCount;
+static __thread bool initialized;
+static __thread FramePoolStats stats;
+
+/**
+ * Check if a frame is a buffer of the pool.
+ */
+static bool pooled(const Frame* frame)
+{
+  return (const void*) frame >= (const void*) &pool[0] && (const void*) frame < (const void*) &pool[FRAME_POOL_SIZE];
+}
+
+/**
+ * Get a frame buffer from the pool.
+ *
+ * Buffers are reused last in, first out, so the next frame lands in a
+ * buffer that is likely still cached.
+ *
+ * @return The frame with one reference; 0 if the pool is exhausted.
+ */
+Frame* frameAlloc()
+{
+  if (false == initialized)
+  {
+    for (unsigned int i = 0; i < FRAME_POOL_SIZE; i++)
+      freeList[i] = FRAME_POOL_SIZE - 1 - i;
+    freeCount = FRAME_POOL_SIZE;
+    initialized = true;
+  }
+
+  if (0 == freeCount)
+  {
+    stats.exhausted++;
+    return 0;
+  }
+
+  Frame* frame = &pool[freeList[--freeCount]].frame;
+  frame->refs = 1;
+
+  stats.used++;
+  if (stats.used > stats.peak)
+    stats.peak = stats.used;
+
+  return frame;
+}
+
+/**
+ * Take a reference to a frame, e.g. to keep it after deliver() returned.
+ *
+ * A frame that is not from the pool of this thread (on the stack, or from another
+ * thread) is copied into a pool buffer.
+ *
+ * @param frame The frame
+ * @return Pointer to release with frameUnref(); 0 if the pool is exhausted.
+ */
+Frame* frameRef(const Frame& frame)
+{
+  if (pooled(&frame))
+  {
+    Frame* ref = (Frame*) &frame;
+    ref->refs++;
+    return ref;
+  }
+
+  Frame* copy = frameAlloc();
+  if (0 == copy)
+    return 0;
+
+  stats.copies++;
+  memcpy(copy, &frame, sizeof(Frame) - FRAME_MAX_PAYLOAD + frame.length);
+  copy->refs = 1;
+
+  return copy;
+}
+
+/**
+ * Release a reference; the buffer returns to the pool with the last one.
+ */
+void frameUnref(Frame* frame)
+{
+  if (0 == frame || false == pooled(frame) || 0 == frame->refs)
+    return;
+
+  if (--frame->refs > 0)
+    return;
+
+  freeList[freeCount++] = (FrameBuffer*) frame - pool;
+  stats.used--;
+}
+
+/**
+ * Get the pool counters of this thread.
+ */
+const FramePoolStats& framePoolStats()
+{
+  return stats;
+}
+
+/**
+ * Get the current time as frame timestamp.
+ *
+ * @return CLOCK_REALTIME [us]
+ */
+uint64_t frameTimestamp()
+{
+  struct timespec spec;
+  clock_gettime(CLOCK_REALTIME, &spec);
+  return (uint64_t)spec.tv_sec * 1000000 + spec.tv_nsec / 1000;
+}
+
+/**
+ * Get the time base of frame traces: CLOCK_MONOTONIC, like the timestamps of
+ * GPIO edges.
+ *
+ * @return Time [ns]
+ */
+uint64_t frameClock()
+{
+  struct timespec spec;
+  clock_gettime(CLOCK_MONOTONIC, &spec);
+  return (uint64_t)spec.tv_sec * 1000000000 + spec.tv_nsec;
+}
+
+/** @}
+ *
+ */
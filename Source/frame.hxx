@@ -0,0 +1,93 @@
+/**
+ * @file frame.hxx
+ *
+ * @brief A received radio frame on its way through the forwarding pipeline.
+ *
+ * Frames are taken from a preallocated pool of cache line aligned buffers. The
+ * radio reads the FIFO straight into a pooled frame; stages that keep a frame
+ * beyond a deliver() call take a reference with frameRef() instead of a copy and
+ * release it with frameUnref(). No heap memory is used.
+ *
+ * Every thread has a pool of its own; frames are not passed between threads by
+ * reference (a reference to a frame of another thread is a copy).
+ */
+
+#ifndef FRAME_HXX_
+#define FRAME_HXX_
+
+#include <stdint.h>
+
+/** @addtogroup Forward
+ * @{
+ */
+#define FRAME_MAX_PAYLOAD   64  ///< Maximum payload of a frame (RFM69_MAX_PAYLOAD)
+#define FRAME_POOL_SIZE     512 ///< Number of frame buffers
+
+/** Stages of a received frame, see trace.hxx. */
+typedef enum
+{
+  FRAME_STAGE_DRAIN_START = 0,  //!< FIFO drain started
+  FRAME_STAGE_DRAIN_END,        //!< FIFO drain finished
+  FRAME_STAGE_ENQUEUE,          //!< Pushed into the event ring of the radio thread
+  FRAME_STAGE_DEQUEUE,          //!< Dispatched on the main thread
+  FRAME_STAGES
+} FrameStage;
+
+/** Received frame with the metadata collected by the radio. */
+typedef struct
+{
+  uint64_t timestamp;               //!< Reception time (CLOCK_REALTIME) [us]
+  uint32_t frequency;               //!< Carrier frequency [Hz]; 0 if unknown
+  uint8_t radio;                    //!< Tag of the radio that received the frame
+  uint8_t length;                   //!< Payload length in bytes
+  int16_t rssi;                     //!< RSSI [dBm]
+  int32_t fei;                      //!< Frequency error [Hz]; 0 if not measured
+  uint16_t refs;                    //!< References to a pooled frame
+  uint16_t reserved;                //!< Unused
+  uint64_t edge;                    //!< DIO0 edge (CLOCK_MONOTONIC) [ns]; 0 if the frame is not traced
+  uint32_t stages[FRAME_STAGES];    //!< Time of each stage after the edge [ns]
+  uint8_t data[FRAME_MAX_PAYLOAD];  //!< Payload without the RFM69 length byte
+} Frame;
+
+/** Frame pool counters. */
+typedef struct
+{
+  unsigned int used;        //!< Buffers currently referenced
+  unsigned int peak;        //!< Maximum of used
+  unsigned int exhausted;   //!< Allocations that failed
+  unsigned int copies;      //!< References that needed a copy (frame not from the pool)
+} FramePoolStats;
+
+uint64_t frameTimestamp();
+
+uint64_t frameClock();
+
+/**
+ * Record the time of a stage of a traced frame.
+ *
+ * @param frame The frame
+ * @param stage The stage
+ * @param time frameClock() at the stage
+ */
+static inline void frameStage(Frame* frame, FrameStage stage, uint64_t time)
+{
+  if (0 == frame->edge)
+    return;
+
+  uint64_t offset = time - frame->edge;
+  frame->stages[stage] = (offset > UINT32_MAX) ? UINT32_MAX : offset;
+}
+
+Frame* frameAlloc();
+
+Frame* frameRef(const Frame& frame);
+
+void frameUnref(Frame* frame);
+
+const FramePoolStats& framePoolStats();
+
+/** @}
+ *
+ */
+
+#endif /* FRAME_HXX_ */
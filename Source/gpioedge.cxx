@@ -0,0 +1,225 @@
+/**
+ * @file gpioedge.cxx
+ *
+ * @brief GPIO edge events as pollable file descriptors (GPIO character device or sysfs).
+ */
+
+/** @addtogroup GPIOEdge
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "gpioedge.hxx"
+
+/**
+ * Write a string to a sysfs attribute.
+ *
+ * @return true on success
+ */
+static bool sysfsWrite(const char* path, const char* value)
+{
+  int fd = ::open(path, O_WRONLY);
+  if (fd < 0)
+    return false;
+
+  int len = strlen(value);
+  bool ok = (write(fd, value, len) == len);
+  ::close(fd);
+
+  return ok;
+}
+
+GPIOEdge::GPIOEdge()
+{
+  _fd = -1;
+  _gpio = -1;
+  _chardev = false;
+  _timestamp = 0;
+  _lineSeqno = 0;
+  _lost = 0;
+}
+
+GPIOEdge::~GPIOEdge()
+{
+  close();
+}
+
+/**
+ * Request rising edge events of a GPIO.
+ *
+ * The GPIO character device is used if available; otherwise the GPIO is
+ * configured through sysfs.
+ *
+ * @param gpio Line offset on the chip (BCM numbering on the Raspberry Pi, use
+ *        wpiPinToGpio() for wiringPi pins)
+ * @param chip GPIO chip device, e.g. /dev/gpiochip0 (or a gpio-sim chip); 0 forces sysfs
+ * @return true on success
+ */
+bool GPIOEdge::open(int gpio, const char* chip)
+{
+  close();
+
+  if (0 != chip && openChardev(gpio, chip))
+    return true;
+
+  return openSysfs(gpio);
+}
+
+/**
+ * Request the line from the GPIO character device.
+ */
+bool GPIOEdge::openChardev(int gpio, const char* chip)
+{
+  int chipFd = ::open(chip, O_RDWR | O_CLOEXEC);
+  if (chipFd < 0)
+    return false;
+
+  struct gpio_v2_line_request request;
+  memset(&request, 0, sizeof(request));
+  request.offsets[0] = gpio;
+  request.num_lines = 1;
+  request.event_buffer_size = GPIOEDGE_EVENT_BUFFER;
+  request.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING;
+  strncpy(request.consumer, "rfmbridge", sizeof(request.consumer) - 1);
+
+  int ret = ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &request);
+  ::close(chipFd);
+
+  if (ret < 0)
+  {
+    perror(chip);
+    return false;
+  }
+
+  _fd = request.fd;
+  fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+  _gpio = gpio;
+  _chardev = true;
+
+  return true;
+}
+
+/**
+ * Export a GPIO, configure it for rising edges and open its value file.
+ */
+bool GPIOEdge::openSysfs(int gpio)
+{
+  char path[64];
+  char value[16];
+
+  // export may fail if the GPIO is already exported; that's fine
+  snprintf(value, sizeof(value), "%d", gpio);
+  sysfsWrite("/sys/class/gpio/export", value);
+
+  snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/direction", gpio);
+  if (false == sysfsWrite(path, "in"))
+  {
+    perror(path);
+    return false;
+  }
+
+  snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/edge", gpio);
+  if (false == sysfsWrite(path, "rising"))
+  {
+    perror(path);
+    return false;
+  }
+
+  snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/value", gpio);
+  _fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (_fd < 0)
+  {
+    perror(path);
+    return false;
+  }
+
+  _gpio = gpio;
+
+  // clear a pending edge
+  acknowledge();
+
+  return true;
+}
+
+/**
+ * Close the value file. The GPIO stays exported.
+ */
+void GPIOEdge::close()
+{
+  if (_fd >= 0)
+    ::close(_fd);
+
+  _fd = -1;
+  _gpio = -1;
+  _chardev = false;
+  _timestamp = 0;
+  // a new line request numbers its edges from 1 again; _lost keeps counting
+  _lineSeqno = 0;
+}
+
+/**
+ * Acknowledge edges; needs to be called after every event of getEvents().
+ *
+ * With the character device all queued edges are consumed; the timestamp of
+ * the oldest one is kept, as it belongs to the event the caller handles now.
+ *
+ * @return Number of edges consumed (1 for sysfs, which can't tell).
+ */
+unsigned int GPIOEdge::acknowledge()
+{
+  if (_fd < 0)
+    return 0;
+
+  if (false == _chardev)
+  {
+    char buf[4];
+
+    lseek(_fd, 0, SEEK_SET);
+    if (read(_fd, buf, sizeof(buf)) < 0)
+      perror("gpio value");
+
+    return 1;
+  }
+
+  struct gpio_v2_line_event events[8];
+  unsigned int count = 0;
+  int n;
+
+  while ((n = read(_fd, events, sizeof(events))) > 0)
+  {
+    for (unsigned int i = 0; i < n / sizeof(events[0]); i++)
+    {
+      if (0 == count)
+        _timestamp = events[i].timestamp_ns;
+
+      // line sequence numbers start at 1 and have no gaps unless the kernel dropped edges
+      if (0 != _lineSeqno && events[i].line_seqno != _lineSeqno + 1)
+        _lost += events[i].line_seqno - _lineSeqno - 1;
+      _lineSeqno = events[i].line_seqno;
+
+      count++;
+    }
+  }
+
+  return count;
+}
+
+/**
+ * sysfs signals edges as exceptional condition, the character device as readable data.
+ */
+uint32_t GPIOEdge::getEvents()
+{
+  return _chardev ? EPOLLIN : EPOLLPRI | EPOLLERR;
+}
+
+/** @}
+ *
+ */
@@ -0,0 +1,92 @@
+/**
+ * @file gpioedge.hxx
+ *
+ * @brief GPIO edge events as pollable file descriptors.
+ *
+ * The RFM69 signals PayloadReady/CrcOk (RX) and PacketSent (TX) on DIO0.
+ * Instead of reading the IRQ flags over SPI every few milliseconds, the bridge
+ * waits for an edge on the DIO0 line in its event loop.
+ *
+ * Two backends are available. The GPIO character device (line event ioctls,
+ * uAPI v2) queues every edge in the kernel together with a timestamp taken in
+ * the interrupt handler, so no edge is lost if the thread is late and the time
+ * of the edge is known exactly; a gap in the line sequence numbers reveals a
+ * queue overflow. The deprecated sysfs interface only reports that an edge
+ * happened and is used if the character device is not available.
+ */
+
+#ifndef GPIOEDGE_HXX_
+#define GPIOEDGE_HXX_
+
+#include <stdint.h>
+
+/** @addtogroup GPIOEdge
+ * @{
+ */
+#define GPIOEDGE_DEFAULT_CHIP   "/dev/gpiochip0" ///< GPIO chip of the Raspberry Pi header
+#define GPIOEDGE_EVENT_BUFFER   64               ///< Edges the kernel queues per line
+
+/** Edge event source for a single GPIO line. */
+class GPIOEdge
+{
+public:
+  GPIOEdge();
+  virtual ~GPIOEdge();
+
+  bool open(int gpio, const char* chip = GPIOEDGE_DEFAULT_CHIP);
+
+  void close();
+
+  unsigned int acknowledge();
+
+  /**
+   * Get the file descriptor to be watched for getEvents().
+   *
+   * @return The file descriptor; -1 if not open.
+   */
+  int getFd()
+  {
+    return _fd;
+  }
+
+  /**
+   * Get the events the file descriptor signals edges with.
+   */
+  uint32_t getEvents();
+
+  /**
+   * Get the kernel timestamp of the last acknowledged edge.
+   *
+   * @return CLOCK_MONOTONIC [ns]; 0 if unknown (sysfs).
+   */
+  uint64_t getTimestamp()
+  {
+    return _timestamp;
+  }
+
+  /**
+   * Get the number of edges the kernel dropped because its queue was full.
+   */
+  unsigned int getLost()
+  {
+    return _lost;
+  }
+
+private:
+  bool openChardev(int gpio, const char* chip);
+
+  bool openSysfs(int gpio);
+
+  int _fd;
+  int _gpio;
+  bool _chardev;
+  uint64_t _timestamp;
+  uint32_t _lineSeqno;
+  unsigned int _lost;
+};
+
+/** @}
+ *
+ */
+
+#endif /* GPIOEDGE_HXX_ */
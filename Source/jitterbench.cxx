@@ -0,0 +1,201 @@
+/**
+ * @file jitterbench.cxx
+ *
+ * @brief Wake-up latency of a timer driven thread, with and without real-time scheduling.
+ *
+ * The radio thread sleeps in epoll until an edge or a timer arrives. This tool
+ * measures how late such a thread wakes up: a periodic timerfd with absolute
+ * expiry times is waited for in epoll and the delay between expiry and wake-up is
+ * recorded. It runs once with normal scheduling and once with the settings of
+ * rfmbridge -P (SCHED_FIFO, CPU affinity, mlockall, prefaulted stack) and prints
+ * percentiles of both. Load the system (e.g. stress-ng) while it runs to see the
+ * difference. Build with "make jitterbench".
+ *
+ * Usage: jitterbench [-p priority] [-c cpu] [-i interval us] [-n samples]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "realtime.hxx"
+
+#define JITTER_MAX_SAMPLES  100000 ///< Upper limit of -n
+
+/** Settings and results of one run. */
+typedef struct
+{
+  int priority;
+  int cpu;
+  unsigned int interval;
+  unsigned int samples;
+  unsigned int missed;
+  uint32_t* latency;
+} JitterRun;
+
+static uint32_t latencies[2][JITTER_MAX_SAMPLES];
+
+static uint64_t
+nanoseconds(const struct timespec* spec)
+{
+  return (uint64_t) spec->tv_sec * 1000000000 + spec->tv_nsec;
+}
+
+static int
+compare(const void* a, const void* b)
+{
+  uint32_t x = *(const uint32_t*) a;
+  uint32_t y = *(const uint32_t*) b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Measuring thread.
+ */
+static void*
+measure(void* context)
+{
+  JitterRun* run = (JitterRun*) context;
+
+  if (run->priority > 0 || run->cpu >= 0)
+  {
+    realtimeSetThread(run->priority, run->cpu);
+    realtimePrefaultStack();
+  }
+
+  int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, timer, &ev);
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  uint64_t interval = (uint64_t) run->interval * 1000;
+  uint64_t start = nanoseconds(&now) + 10 * interval;
+
+  struct itimerspec spec;
+  spec.it_value.tv_sec = start / 1000000000;
+  spec.it_value.tv_nsec = start % 1000000000;
+  spec.it_interval.tv_sec = interval / 1000000000;
+  spec.it_interval.tv_nsec = interval % 1000000000;
+  timerfd_settime(timer, TFD_TIMER_ABSTIME, &spec, 0);
+
+  uint64_t expected = start;
+  unsigned int count = 0;
+
+  while (count < run->samples)
+  {
+    struct epoll_event event;
+    if (epoll_wait(epfd, &event, 1, -1) <= 0)
+      continue;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint64_t expirations;
+    if (read(timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+      continue;
+
+    // latency of the oldest expiry; expiries in between were missed entirely
+    run->latency[count++] = (nanoseconds(&now) - expected) / 1000;
+    run->missed += expirations - 1;
+    expected += expirations * interval;
+  }
+
+  close(epfd);
+  close(timer);
+
+  return 0;
+}
+
+/**
+ * Sort the samples and print the percentiles of a run.
+ */
+static void
+report(const char* name, JitterRun* run)
+{
+  uint32_t* l = run->latency;
+  unsigned int n = run->samples;
+
+  qsort(l, n, sizeof(l[0]), compare);
+
+  printf("%-10s p50 %6u  p90 %6u  p99 %6u  p99.9 %6u  max %6u us, %u expiries missed\n", name, l[n / 2],
+      l[n * 90 / 100], l[n * 99 / 100], l[n * 999 / 1000], l[n - 1], run->missed);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int priority = 50;
+  int cpu = -1;
+  unsigned int interval = 1000;
+  unsigned int samples = 10000;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "p:c:i:n:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'p':
+      priority = atoi(optarg);
+      break;
+    case 'c':
+      cpu = atoi(optarg);
+      break;
+    case 'i':
+      interval = atoi(optarg);
+      break;
+    case 'n':
+      samples = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-p priority] [-c cpu] [-i interval us] [-n samples]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (0 == samples || samples > JITTER_MAX_SAMPLES || 0 == interval)
+  {
+    fprintf(stderr, "1..%d samples and an interval > 0 are required\n", JITTER_MAX_SAMPLES);
+    return 1;
+  }
+
+  printf("%u wake-ups every %u us\n", samples, interval);
+
+  JitterRun runs[2];
+  const char* names[2] = { "normal", "realtime" };
+
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    memset(&runs[i], 0, sizeof(runs[i]));
+    runs[i].priority = i ? priority : 0;
+    runs[i].cpu = i ? cpu : -1;
+    runs[i].interval = interval;
+    runs[i].samples = samples;
+    runs[i].latency = latencies[i];
+
+    if (i)
+      realtimeLockMemory();
+
+    pthread_t thread;
+    if (0 != pthread_create(&thread, 0, measure, &runs[i]))
+    {
+      perror("pthread_create");
+      return 1;
+    }
+    pthread_join(thread, 0);
+
+    report(names[i], &runs[i]);
+  }
+
+  return 0;
+}
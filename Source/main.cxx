@@ -16,77 +16,568 @@ extern "C" {
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <linux/types.h>
+#include <sys/epoll.h>
+#include <signal.h>
 
 #include <wiringPi.h>
 }
 
 #include "rfm69.hxx"
+#include "spidev.hxx"
+#include "rfmlink.hxx"
+#include "radio.hxx"
+#include "radioactor.hxx"
+#include "realtime.hxx"
+#include "eventloop.hxx"
+#include "forward.hxx"
+#include "scanner.hxx"
+#include "shmring.hxx"
+#include "dedup.hxx"
+#include "subscribe.hxx"
+#include "spool.hxx"
+#include "control.hxx"
+#include "metrics.hxx"
+#include "trace.hxx"
+#include "capture.hxx"
+#include "pcap.hxx"
+#include "bridge.hxx"
 
 extern void pabort(const char *s);
 
-void
-sendudp(unsigned char *buf, int size)
+#define UPLINK_ADDRESS    "10.1.0.255" ///< BA30Server broadcast address
+#define UPLINK_PORT       12345        ///< BA30Server UDP port
+#define DOWNLINK_PORT     12346        ///< Default UDP port for packets to be sent over the air
+#define MAX_RADIOS        FORWARD_MAX_RADIOS ///< Number of RFM69 modules per process
+
+/** Settings of one RFM69 module. */
+typedef struct
+{
+  const char* device;       //!< SPI device
+  uint32_t spiSpeed;        //!< SPI clock [Hz]
+  uint8_t spiMode;          //!< SPI mode
+  int dio0Pin;              //!< wiringPi pin wired to DIO0; -1 polls
+  int dio1Pin;              //!< wiringPi pin wired to DIO1; -1 if not wired
+  bool highPower;           //!< RFM69HW module
+  int resetPin;             //!< wiringPi pin wired to RESET; -1 if not wired
+  bool afc;                 //!< Measure the frequency error of every packet
+  unsigned int frequency;   //!< Carrier frequency [Hz]
+  uint8_t syncWord[8];      //!< Sync word
+  unsigned int syncLength;  //!< Sync word length; 0 keeps the base configuration
+} RadioConfig;
+
+/**
+ * Open the UDP socket that receives packets to be sent over the air.
+ *
+ * @param port UDP port
+ * @return Socket; -1 on failure.
+ */
+static int
+opendownlink(int port)
 {
-  int sd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
-  if (sd <= 0)
+  int sd = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+  if (sd < 0)
   {
-    return;
+    return -1;
   }
 
-  int broadcastEnable = 1;
-  int ret = setsockopt(sd, SOL_SOCKET, SO_BROADCAST, &broadcastEnable, sizeof(broadcastEnable));
-  if (ret)
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+
+  if (bind(sd, (struct sockaddr*) &addr, sizeof addr) < 0)
   {
+    perror("bind downlink");
     close(sd);
-    return;
+    return -1;
   }
-  struct sockaddr_in broadcastAddr; // Make an endpoint
-  memset(&broadcastAddr, 0, sizeof broadcastAddr);
-  broadcastAddr.sin_family = AF_INET;
-  inet_pton(AF_INET, "10.1.0.255", &broadcastAddr.sin_addr); // Set the broadcast IP address
-  broadcastAddr.sin_port = htons(12345); // Set port 1900
 
-  ret = sendto(sd, buf, size, 0, (struct sockaddr*) &broadcastAddr, sizeof broadcastAddr);
-  if (ret < 0)
+  return sd;
+}
+
+/**
+ * Parse the sub-options of -r into a radio configuration.
+ *
+ * Example: -r dev=/dev/spidev0.1,dio0=6,reset=5,freq=868950000,sync=2DD4
+ *
+ * @return true on success
+ */
+static bool
+parseradio(char* options, RadioConfig* config)
+{
+  enum { OPT_DEV = 0, OPT_SPEED, OPT_MODE, OPT_DIO0, OPT_DIO1, OPT_HP, OPT_FREQ, OPT_SYNC, OPT_AFC, OPT_RESET };
+  char* const tokens[] = { (char*) "dev", (char*) "speed", (char*) "mode", (char*) "dio0", (char*) "dio1",
+      (char*) "hp", (char*) "freq", (char*) "sync", (char*) "afc", (char*) "reset", 0 };
+  char* value;
+
+  while (*options != '\0')
   {
-    close(sd);
-    return;
+    int token = getsubopt(&options, tokens, &value);
+    if (token != OPT_HP && token != OPT_AFC && 0 == value)
+      return false;
+
+    switch (token)
+    {
+    case OPT_DEV:
+      config->device = value;
+      break;
+    case OPT_SPEED:
+      config->spiSpeed = strtoul(value, 0, 0);
+      break;
+    case OPT_MODE:
+      config->spiMode = strtoul(value, 0, 0);
+      break;
+    case OPT_DIO0:
+      config->dio0Pin = atoi(value);
+      break;
+    case OPT_DIO1:
+      config->dio1Pin = atoi(value);
+      break;
+    case OPT_RESET:
+      config->resetPin = atoi(value);
+      break;
+    case OPT_HP:
+      config->highPower = true;
+      break;
+    case OPT_AFC:
+      config->afc = true;
+      break;
+    case OPT_FREQ:
+      config->frequency = strtoul(value, 0, 0);
+      break;
+    case OPT_SYNC:
+      config->syncLength = 0;
+      while (value[0] && value[1] && config->syncLength < sizeof(config->syncWord))
+      {
+        char byte[3] = { value[0], value[1], 0 };
+        config->syncWord[config->syncLength++] = strtoul(byte, 0, 16);
+        value += 2;
+      }
+      break;
+    default:
+      return false;
+    }
   }
-  close(sd);
+
+  return true;
 }
 
 int
 main(int argc, char *argv[])
 {
-  if (wiringPiSetup() == -1)
+  int linkAddress = -1;
+  int linkWindow = 8;
+  int downlinkPort = DOWNLINK_PORT;
+  const char* scanList = 0;
+  const char* ringPath = 0;
+  const char* uplinkAddress = UPLINK_ADDRESS;
+  int uplinkPort = UPLINK_PORT;
+  bool envelope = false;
+  int dedupWindow = 0;
+  int subscribePort = 0;
+  int nodeOffset = SUBSCRIBE_NODE_OFFSET;
+  const char* spoolPath = 0;
+  unsigned int spoolSize = SPOOL_DEFAULT_SIZE;
+  unsigned int spoolRate = SPOOL_DEFAULT_RATE;
+  int rtPriority = 0;
+  int rtCpu = -1;
+  const char* gpioChip = GPIOEDGE_DEFAULT_CHIP;
+  bool coldStart = false;
+  unsigned int watchdogInterval = 2000;
+  int controlPort = 0;
+  int metricsPort = 0;
+  const char* capturePath = 0;
+  const char* replayPath = 0;
+  double replaySpeed = 1;
+  const char* pcapPath = 0;
+  unsigned int pcapSize = 0;
+  unsigned int pcapFiles = PCAP_DEFAULT_FILES;
+  RadioConfig configs[MAX_RADIOS];
+  unsigned int radioCount = 0;
+
+  memset(configs, 0, sizeof(configs));
+  for (unsigned int i = 0; i < MAX_RADIOS; i++)
+  {
+    configs[i].device = "/dev/spidev0.0";
+    configs[i].spiSpeed = 500000;
+    configs[i].dio0Pin = 7;
+    configs[i].dio1Pin = -1;
+    configs[i].resetPin = -1;
+    configs[i].frequency = 868300000;
+  }
+
+  int opt;
+  while ((opt = getopt(argc, argv, "l:w:i:I:d:r:s:m:u:eD:S:N:q:P:G:Cc:W:M:T:R:p:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'l':
+      linkAddress = atoi(optarg);
+      break;
+    case 'w':
+      linkWindow = atoi(optarg);
+      break;
+    case 'i':
+      configs[0].dio0Pin = atoi(optarg);
+      break;
+    case 'I':
+      configs[0].dio1Pin = atoi(optarg);
+      break;
+    case 'd':
+      downlinkPort = atoi(optarg);
+      break;
+    case 's':
+      scanList = optarg;
+      break;
+    case 'm':
+      ringPath = optarg;
+      break;
+    case 'e':
+      envelope = true;
+      break;
+    case 'D':
+      dedupWindow = atoi(optarg);
+      break;
+    case 'S':
+      subscribePort = atoi(optarg);
+      break;
+    case 'N':
+      nodeOffset = atoi(optarg);
+      break;
+    case 'q':
+      {
+        char* size = strchr(optarg, ':');
+        if (0 != size)
+        {
+          *size++ = '\0';
+          char* rate = strchr(size, ':');
+          if (0 != rate)
+            spoolRate = atoi(rate + 1);
+          spoolSize = atoi(size);
+        }
+        spoolPath = optarg;
+      }
+      break;
+    case 'C':
+      coldStart = true;
+      break;
+    case 'c':
+      controlPort = atoi(optarg);
+      break;
+    case 'W':
+      watchdogInterval = atoi(optarg);
+      break;
+    case 'M':
+      metricsPort = atoi(optarg);
+      break;
+    case 'T':
+      capturePath = optarg;
+      break;
+    case 'R':
+      {
+        char* speed = strchr(optarg, '@');
+        if (0 != speed)
+        {
+          *speed++ = '\0';
+          replaySpeed = (0 == strcmp(speed, "max")) ? 0 : atof(speed);
+        }
+        replayPath = optarg;
+      }
+      break;
+    case 'p':
+      {
+        char* size = strchr(optarg, ':');
+        if (0 != size)
+        {
+          *size++ = '\0';
+          char* files = strchr(size, ':');
+          if (0 != files)
+            pcapFiles = atoi(files + 1);
+          pcapSize = atoi(size);
+        }
+        pcapPath = optarg;
+      }
+      break;
+    case 'G':
+      gpioChip = (0 == strcmp(optarg, "sysfs")) ? 0 : optarg;
+      break;
+    case 'P':
+      {
+        char* cpu = strchr(optarg, '@');
+        if (0 != cpu)
+          rtCpu = atoi(cpu + 1);
+        rtPriority = atoi(optarg);
+      }
+      break;
+    case 'u':
+      if (0 == strcmp(optarg, "off"))
+      {
+        uplinkAddress = 0;
+      }
+      else
+      {
+        char* port = strchr(optarg, ':');
+        if (0 != port)
+        {
+          *port = '\0';
+          uplinkPort = atoi(port + 1);
+        }
+        uplinkAddress = optarg;
+      }
+      break;
+    case 'r':
+      if (radioCount >= MAX_RADIOS || false == parseradio(optarg, &configs[radioCount]))
+      {
+        fprintf(stderr, "invalid radio: %s\n", optarg);
+        return 1;
+      }
+      radioCount++;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-l link address] [-w link window] [-i DIO0 pin] [-I DIO1 pin]"
+          " [-d downlink port] [-r dev=...,speed=...,mode=...,dio0=...,dio1=...,reset=...,hp,afc,freq=...,sync=...]"
+          " [-s freq[/sync][@dwell],...] [-m ring file] [-u address[:port]|off] [-e] [-D dedup window ms]"
+          " [-S subscription port] [-N node ID offset] [-q spool file[:size kB[:rate]]]"
+          " [-P priority[@cpu]] [-G gpio chip|sysfs] [-C] [-c control port] [-W watchdog interval ms]"
+          " [-M metrics port] [-T capture file] [-R capture file[@speed|max]]"
+          " [-p pcapng file|pipe[:size MB[:files]]]\n",
+          argv[0]);
+      return 1;
+    }
+  }
+
+  // without -r, one radio on /dev/spidev0.0 (with -i/-I applied)
+  if (0 == radioCount)
+    radioCount = 1;
+
+  if (0 == replayPath && wiringPiSetup() == -1)
   {
     pabort("Failed to setup wiringPi");
   }
 
-  pinMode(7, INPUT);
-  pullUpDnControl(7, PUD_UP);
+  EventLoop loop;
+  Forwarder forwarder;
+  UdpSink uplink(uplinkAddress ? uplinkAddress : UPLINK_ADDRESS, uplinkPort);
+  uplink.setEnvelope(envelope);
+
+  // keep frames on disk while the uplink fails
+  Spool spool(&uplink);
+  if (0 != uplinkAddress && 0 != spoolPath)
+  {
+    if (false == spool.open(spoolPath, spoolSize))
+      pabort("Can't open spool");
+    spool.start(&loop, spoolRate);
+    if (spool.getBacklog() > 0)
+      printf("%u frames in spool\r\n", spool.getBacklog());
+    forwarder.addSink(&spool);
+  }
+  else if (0 != uplinkAddress)
+  {
+    forwarder.addSink(&uplink);
+  }
+
+  // local consumers read frames from shared memory instead of the network
+  ShmRingSink ring;
+  if (0 != ringPath)
+  {
+    if (false == ring.open(ringPath))
+      pabort("Can't create ring");
+    forwarder.addSink(&ring);
+  }
+
+  // filtered unicast delivery to subscribed consumers
+  SubscriptionSink subscriptions(nodeOffset);
+  if (subscribePort > 0)
+  {
+    if (false == subscriptions.start(&loop, subscribePort))
+      pabort("Can't open subscription port");
+    forwarder.addSink(&subscriptions);
+  }
+
+  // with metadata forwarded, keep the copy with the best RSSI instead of the first one
+  Dedup dedup(&forwarder, dedupWindow, envelope || 0 != ringPath);
+  if (dedupWindow > 0)
+  {
+    dedup.start(&loop);
+    forwarder.setDedup(&dedup);
+  }
+
+  Bridge bridge(&loop, &forwarder);
+
+  // all SPI access happens on the radio thread
+  RadioActor actor(&bridge);
+  bridge.setActor(&actor);
+
+  // live reconfiguration of the radios
+  ControlSocket control(&actor);
+  if (controlPort > 0)
+  {
+    if (false == control.start(&loop, controlPort))
+      pabort("Can't open control port");
+    bridge.setControl(&control);
+  }
+
+  // counters and histograms for Prometheus
+  MetricsServer metrics;
+  if (metricsPort > 0 && false == metrics.start(&loop, radioCount, metricsPort))
+    pabort("Can't open metrics port");
+
+  // replay a capture into the pipeline instead of receiving: no radios, no radio thread
+  if (0 != replayPath)
+  {
+    CaptureReplay replay(&forwarder);
+    if (false == replay.open(replayPath))
+      pabort("Can't open capture");
+
+    replay.start(&loop, replaySpeed);
+    loop.run();
+
+    replay.stop();
+    dedup.stop();
+    spool.stop();
+    control.stop();
+    metrics.stop();
+    forwarder.dumpStats();
+
+    return 0;
+  }
+
+  CaptureSink capture;
+  if (0 != capturePath)
+  {
+    if (false == capture.open(capturePath))
+      pabort("Can't open capture file");
+    capture.start(&loop);
+    bridge.setCapture(&capture);
+  }
+
+  // Wireshark: pcapng file or named pipe, written on this thread
+  PcapSink pcap;
+  if (0 != pcapPath)
+  {
+    if (false == pcap.open(pcapPath, radioCount, pcapSize * 1024 * 1024, pcapFiles))
+      pabort("Can't open pcapng file");
+    pcap.start(&loop);
+    bridge.setPcap(&pcap);
+  }
+
+  RFM69* rfm69[MAX_RADIOS];
+  Radio* radios[MAX_RADIOS];
+  for (unsigned int i = 0; i < radioCount; i++)
+  {
+    RadioConfig* config = &configs[i];
+
+    if (config->dio0Pin >= 0)
+    {
+      pinMode(config->dio0Pin, INPUT);
+      pullUpDnControl(config->dio0Pin, PUD_UP);
+    }
+
+    // desired configuration: base profile on the carrier and sync word of this radio
+    RFM69Profile profile = rfm69_base_profile;
+    profile.frequency = config->frequency;
+    if (config->syncLength > 0)
+    {
+      profile.syncLength = config->syncLength;
+      memcpy(profile.syncWord, config->syncWord, config->syncLength);
+    }
+    if (false == rfm69ProfileValid(profile))
+    {
+      fprintf(stderr, "radio %u: invalid frequency %u Hz\n", i, config->frequency);
+      return 1;
+    }
+
+    rfm69[i] = new RFM69(new SPIDev(config->device, config->spiSpeed, config->spiMode, config->resetPin),
+        config->highPower);
 
+    // after a restart of the bridge the module usually still has its configuration
+    uint64_t startTime = frameTimestamp();
+    int rewritten = coldStart ? -1 : rfm69[i]->warmInit(rfm69Image(profile));
+    if (rewritten >= 0)
+    {
+      printf("radio %u: warm start, %d registers rewritten in %u us\n", i, rewritten,
+          (uint32_t) (frameTimestamp() - startTime));
+    }
+    else
+    {
+      rfm69[i]->init();
+//      rfm69[i]->dumpRegisters();
+      rfm69[i]->sleep();
+    }
+    rfm69[i]->setPowerDBm(13);
+    control.setProfile(i, profile, 13);
+    if (config->afc)
+      rfm69[i]->setAutoReadFEI(true);
+
+    radios[i] = new Radio(i, rfm69[i], 0);
+    radios[i]->tune(config->frequency, config->syncLength ? config->syncWord : 0, config->syncLength);
+    radios[i]->setWatchdog(watchdogInterval);
+    actor.addRadio(radios[i]);
+  }
 
-  RFM69 rfm69(false); // false = RFM69W, true = RFM69HW
-  rfm69.init();
-//  rfm69.dumpRegisters();
-  rfm69.sleep();
-  rfm69.setPowerDBm(13);
+  // optional reliable link layer over the first radio
+  RadioLinkTransport linkTransport(&actor, 0);
+  if (linkAddress >= 0)
+  {
+    bridge.setLink(new RFMLink(&linkTransport, &bridge, linkAddress, linkWindow));
+  }
+
+  if (downlinkPort > 0)
+  {
+    int fd = opendownlink(downlinkPort);
+    if (fd >= 0)
+      bridge.setDownlink(fd);
+  }
 
-  unsigned char rx[64];
-  while (1)
+  for (unsigned int i = 0; i < radioCount; i++)
   {
-    delay(10);
+    int dio0 = configs[i].dio0Pin;
+    int dio1 = configs[i].dio1Pin;
+    radios[i]->start(actor.getLoop(), dio0 >= 0 ? wpiPinToGpio(dio0) : -1, dio1 >= 0 ? wpiPinToGpio(dio1) : -1,
+        gpioChip);
+  }
 
-    int bytesReceived = rfm69.receive(rx, sizeof(rx));
-    if (bytesReceived > 0)
+  // optional channel scanner on the first radio
+  Scanner scanner(radios[0]);
+  if (0 != scanList)
+  {
+    if (false == scanner.parse(scanList))
     {
-      printf("%d bytes received.\r\n", bytesReceived);
-      sendudp(rx + 1, bytesReceived - 1);
+      fprintf(stderr, "invalid scan list: %s\n", scanList);
+      return 1;
     }
+    scanner.start(actor.getLoop());
+  }
 
-//    char testdata[] = {'0', '0', '0', '6', 'L', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd'};
-//    int res = rfm69.send(testdata, sizeof(testdata));
+  // real-time radio thread: no page faults once running
+  if (rtPriority > 0 || rtCpu >= 0)
+  {
+    realtimeLockMemory();
+    realtimePrefaultStack();
+    actor.setRealtime(rtPriority, rtCpu);
   }
+
+  if (false == actor.start(&loop))
+    pabort("Can't start radio thread");
+
+  loop.run();
+
+  // the radios belong to this thread again
+  actor.stop();
+  scanner.stop();
+  dedup.stop();
+  spool.stop();
+  control.stop();
+  metrics.stop();
+  capture.stop();
+  pcap.stop();
+
+  for (unsigned int i = 0; i < radioCount; i++)
+  {
+    radios[i]->stop();
+    rfm69[i]->sleep();
+  }
+
   return 0;
 }
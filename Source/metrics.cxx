@@ -0,0 +1,386 @@
+/**
+ * @file metrics.cxx
+ *
+ * @brief Counters and histograms of the bridge, exported over HTTP.
+ */
+
+/** @addtogroup Metrics
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.hxx"
+#include "trace.hxx"
+
+#define NONE INT32_MAX
+
+__thread MetricsShard* metrics_shard;
+
+static MetricsShard shards[METRICS_MAX_THREADS];
+static unsigned int shardCount;
+
+/** Upper bounds of the buckets; the last bucket (+Inf) is implicit. */
+const int32_t metrics_bounds[METRIC_HISTOGRAMS][METRICS_BUCKETS] =
+{
+  { -110, -100, -95, -90, -85, -80, -75, -70, -60, -50, -40, NONE },             // RSSI [dBm]
+  { 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, NONE }, // latency [us]
+  { 0, 1, 2, 3, 4, 5, 6, 7, NONE, NONE, NONE, NONE },                          // TX queue (RADIO_TX_QUEUE)
+  { 0, 1, 2, 4, 8, 16, 32, 48, 63, NONE, NONE, NONE },                         // event ring (RADIOACTOR_EVENTS)
+  { 0, 1, 2, 4, 8, 16, 32, 48, 63, NONE, NONE, NONE }                          // command queue (RADIOACTOR_COMMANDS)
+};
+
+/** Name, type and help text of a metric. */
+typedef struct
+{
+  const char* name;
+  const char* help;
+  bool labelled;
+} MetricInfo;
+
+static const MetricInfo counterInfo[METRIC_COUNTERS] =
+{
+  { "rfmbridge_rx_frames_total", "Packets read from the FIFO", true },
+  { "rfmbridge_rx_bytes_total", "Payload bytes read from the FIFO", true },
+  { "rfmbridge_rx_no_buffer_total", "Packets dropped because the frame pool was exhausted", true },
+  { "rfmbridge_tx_frames_total", "Packets sent", true },
+  { "rfmbridge_tx_bytes_total", "Payload bytes sent", true },
+  { "rfmbridge_tx_failed_total", "Packets without PacketSent", true },
+  { "rfmbridge_tx_dropped_total", "Packets rejected because the TX queue was full", true },
+  { "rfmbridge_events_dropped_total", "Events lost because the ring to the main thread was full", true },
+  { "rfmbridge_forwarded_total", "Frames that entered the forwarding pipeline", true },
+  { "rfmbridge_duplicates_total", "Frames suppressed as duplicates", true },
+  { "rfmbridge_sink_errors_total", "Deliveries to a sink that failed", true },
+  { "rfmbridge_spi_transfers_total", "SPI messages (ioctls)", false },
+  { "rfmbridge_spi_bytes_total", "Bytes clocked over SPI", false },
+  { "rfmbridge_commands_rejected_total", "Commands rejected because the queue to the radio thread was full", false }
+};
+
+static const MetricInfo histogramInfo[METRIC_HISTOGRAMS] =
+{
+  { "rfmbridge_rssi_dbm", "RSSI of received packets", true },
+  { "rfmbridge_latency_microseconds", "Reception until handed to all sinks", true },
+  { "rfmbridge_tx_queue_depth", "Depth of the TX queue when a packet is queued", true },
+  { "rfmbridge_event_queue_depth", "Depth of the ring to the main thread when an event is pushed", false },
+  { "rfmbridge_command_queue_depth", "Depth of the command queue when the radio thread drains it", false }
+};
+
+/**
+ * Get the shard of the calling thread on its first metric.
+ * Threads beyond METRICS_MAX_THREADS share the last shard; the atomic adds keep
+ * that correct, only slower.
+ */
+MetricsShard* metricsClaimShard()
+{
+  unsigned int index = __atomic_fetch_add(&shardCount, 1, __ATOMIC_RELAXED);
+  if (index >= METRICS_MAX_THREADS)
+    index = METRICS_MAX_THREADS - 1;
+
+  metrics_shard = &shards[index];
+
+  return metrics_shard;
+}
+
+/**
+ * Get the sum of a counter over all threads.
+ *
+ * @param counter The counter
+ * @param radio Index of the radio; 0 for counters without label
+ */
+uint64_t metricsCounter(MetricCounter counter, uint8_t radio)
+{
+  uint64_t sum = 0;
+
+  for (unsigned int i = 0; i < METRICS_MAX_THREADS; i++)
+    sum += __atomic_load_n(&shards[i].counters[counter][radio % METRICS_MAX_RADIOS], __ATOMIC_RELAXED);
+
+  return sum;
+}
+
+/** Output buffer of the exposition. */
+typedef struct
+{
+  char* text;
+  unsigned int size;
+  unsigned int length;
+} Page;
+
+/**
+ * Append to the page; output that does not fit is cut off.
+ */
+static void append(Page* page, const char* format, ...)
+{
+  if (page->length >= page->size)
+    return;
+
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(page->text + page->length, page->size - page->length, format, args);
+  va_end(args);
+
+  if (n > 0)
+    page->length += n;
+  if (page->length >= page->size)
+    page->length = page->size - 1;
+}
+
+/**
+ * Append a label set: the radio, if the metric is labelled, and the bucket bound.
+ */
+static void appendLabels(Page* page, const MetricInfo* info, unsigned int radio, const char* le)
+{
+  if (info->labelled && le)
+    append(page, "{radio=\"%u\",le=\"%s\"}", radio, le);
+  else if (info->labelled)
+    append(page, "{radio=\"%u\"}", radio);
+  else if (le)
+    append(page, "{le=\"%s\"}", le);
+}
+
+/**
+ * Render all metrics in the Prometheus text format (version 0.0.4).
+ *
+ * @param text Output buffer
+ * @param size Size of the buffer
+ * @param radios Number of radios to render labelled metrics for
+ * @return Length of the text
+ */
+unsigned int metricsRender(char* text, unsigned int size, unsigned int radios)
+{
+  Page page = { text, size, 0 };
+
+  if (radios > METRICS_MAX_RADIOS)
+    radios = METRICS_MAX_RADIOS;
+
+  for (unsigned int c = 0; c < METRIC_COUNTERS; c++)
+  {
+    const MetricInfo* info = &counterInfo[c];
+    append(&page, "# HELP %s %s\n# TYPE %s counter\n", info->name, info->help, info->name);
+
+    for (unsigned int radio = 0; radio < (info->labelled ? radios : 1); radio++)
+    {
+      append(&page, "%s", info->name);
+      appendLabels(&page, info, radio, 0);
+      append(&page, " %llu\n", (unsigned long long) metricsCounter((MetricCounter) c, radio));
+    }
+  }
+
+  for (unsigned int h = 0; h < METRIC_HISTOGRAMS; h++)
+  {
+    const MetricInfo* info = &histogramInfo[h];
+    append(&page, "# HELP %s %s\n# TYPE %s histogram\n", info->name, info->help, info->name);
+
+    for (unsigned int radio = 0; radio < (info->labelled ? radios : 1); radio++)
+    {
+      uint64_t count = 0;
+      int64_t sum = 0;
+
+      for (unsigned int bucket = 0; bucket <= METRICS_BUCKETS; bucket++)
+      {
+        for (unsigned int i = 0; i < METRICS_MAX_THREADS; i++)
+          count += __atomic_load_n(&shards[i].buckets[h][radio][bucket], __ATOMIC_RELAXED);
+
+        if (bucket < METRICS_BUCKETS && NONE == metrics_bounds[h][bucket])
+          continue;
+
+        char le[16] = "+Inf";
+        if (bucket < METRICS_BUCKETS)
+          snprintf(le, sizeof(le), "%d", metrics_bounds[h][bucket]);
+
+        append(&page, "%s_bucket", info->name);
+        appendLabels(&page, info, radio, le);
+        append(&page, " %llu\n", (unsigned long long) count);
+      }
+
+      for (unsigned int i = 0; i < METRICS_MAX_THREADS; i++)
+        sum += __atomic_load_n(&shards[i].sums[h][radio], __ATOMIC_RELAXED);
+
+      append(&page, "%s_sum", info->name);
+      appendLabels(&page, info, radio, 0);
+      append(&page, " %lld\n%s_count", (long long) sum, info->name);
+      appendLabels(&page, info, radio, 0);
+      append(&page, " %llu\n", (unsigned long long) count);
+    }
+  }
+
+  if (page.length < page.size)
+    page.length += traceRender(page.text + page.length, page.size - page.length);
+
+  return page.length;
+}
+
+/**
+ * Metrics HTTP server constructor.
+ */
+MetricsServer::MetricsServer()
+{
+  _loop = 0;
+  _fd = -1;
+  _radios = 1;
+  _scrapes = 0;
+  for (unsigned int i = 0; i < METRICS_MAX_CLIENTS; i++)
+    _clients[i] = -1;
+}
+
+MetricsServer::~MetricsServer()
+{
+  stop();
+}
+
+/**
+ * Listen for HTTP requests on the loopback interface.
+ *
+ * @param loop Event loop of the main thread
+ * @param radios Number of radios
+ * @param port TCP port
+ * @return true on success
+ */
+bool MetricsServer::start(EventLoop* loop, unsigned int radios, int port)
+{
+  _fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+  if (_fd < 0)
+    return false;
+
+  int reuse = 1;
+  setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+
+  if (bind(_fd, (struct sockaddr*) &addr, sizeof addr) < 0 || listen(_fd, METRICS_MAX_CLIENTS) < 0)
+  {
+    perror("bind metrics port");
+    close(_fd);
+    _fd = -1;
+    return false;
+  }
+
+  _loop = loop;
+  _radios = radios;
+  _loop->add(_fd, EPOLLIN, this);
+
+  return true;
+}
+
+/**
+ * Close the listening socket and all connections.
+ */
+void MetricsServer::stop()
+{
+  if (0 == _loop)
+    return;
+
+  for (unsigned int i = 0; i < METRICS_MAX_CLIENTS; i++)
+    closeClient(i);
+
+  _loop->remove(_fd);
+  close(_fd);
+  _fd = -1;
+  _loop = 0;
+}
+
+/**
+ * Accept connections and answer requests.
+ */
+void MetricsServer::handleEvent(int fd, uint32_t events)
+{
+  if (fd == _fd)
+  {
+    int client;
+    while ((client = accept4(_fd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+      unsigned int i = 0;
+      while (i < METRICS_MAX_CLIENTS && _clients[i] >= 0)
+        i++;
+
+      if (i == METRICS_MAX_CLIENTS)
+      {
+        close(client);
+        continue;
+      }
+
+      _clients[i] = client;
+      _loop->add(client, EPOLLIN, this);
+    }
+    return;
+  }
+
+  for (unsigned int i = 0; i < METRICS_MAX_CLIENTS; i++)
+  {
+    if (_clients[i] == fd)
+    {
+      serve(fd);
+      closeClient(i);
+      break;
+    }
+  }
+}
+
+/**
+ * Answer the request of a connection; one request per connection.
+ */
+void MetricsServer::serve(int client)
+{
+  char request[512];
+  int n = recv(client, request, sizeof(request) - 1, 0);
+  if (n <= 0)
+    return;
+  request[n] = '\0';
+
+  char header[128];
+  struct iovec iov[2];
+  unsigned int count = 1;
+
+  if (0 == strncmp(request, "GET /metrics ", 13) || 0 == strncmp(request, "GET / ", 6))
+  {
+    unsigned int length = metricsRender(_page, sizeof(_page), _radios);
+    iov[0].iov_len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\nContent-Length: %u\r\nConnection: close\r\n\r\n", length);
+    iov[1].iov_base = _page;
+    iov[1].iov_len = length;
+    count = 2;
+    _scrapes++;
+  }
+  else
+  {
+    iov[0].iov_len = snprintf(header, sizeof(header), "HTTP/1.0 404 Not Found\r\n"
+        "Content-Length: 0\r\nConnection: close\r\n\r\n");
+  }
+  iov[0].iov_base = header;
+
+  // the socket buffer of a loopback connection holds the whole page
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = count;
+  sendmsg(client, &msg, MSG_NOSIGNAL);
+}
+
+/**
+ * Close a connection.
+ */
+void MetricsServer::closeClient(unsigned int index)
+{
+  if (_clients[index] < 0)
+    return;
+
+  _loop->remove(_clients[index]);
+  close(_clients[index]);
+  _clients[index] = -1;
+}
+
+/** @}
+ *
+ */
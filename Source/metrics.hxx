@@ -0,0 +1,160 @@
+/**
+ * @file metrics.hxx
+ *
+ * @brief Counters and histograms of the bridge, exported in the Prometheus text
+ * format over HTTP on the loopback interface.
+ *
+ * Every thread that records a metric gets a shard of its own: a cache line
+ * aligned block with all counters and histogram buckets. Recording is a relaxed
+ * atomic add to the shard of the calling thread, so the radio and the main
+ * thread never write to the same cache line and the hot path takes no lock and
+ * no fence. The exporter sums the shards with relaxed loads when it is scraped:
+ *
+ *   curl http://127.0.0.1:12349/metrics
+ *
+ * Histograms have fixed bucket bounds (see metrics.cxx); the buckets of the
+ * exposition are cumulative, as Prometheus expects. The stage latencies of
+ * trace.hxx follow as a summary with p50, p99 and p99.9.
+ */
+
+#ifndef METRICS_HXX_
+#define METRICS_HXX_
+
+#include <stdint.h>
+
+#include "eventloop.hxx"
+
+/** @addtogroup Metrics
+ * @{
+ */
+#define METRICS_PORT          12349 ///< Default HTTP port (loopback only)
+#define METRICS_MAX_RADIOS    4     ///< Radios counters are kept for (FORWARD_MAX_RADIOS)
+#define METRICS_MAX_THREADS   4     ///< Threads with a shard of their own; others share the last one
+#define METRICS_BUCKETS       12    ///< Maximum number of finite buckets of a histogram
+#define METRICS_MAX_CLIENTS   4     ///< Concurrent HTTP connections
+#define METRICS_PAGE_SIZE     32768 ///< Size of the rendered exposition [bytes]
+
+/** Counters; labelled with the radio unless noted otherwise. */
+typedef enum
+{
+  METRIC_RX_FRAMES = 0,     //!< Packets read from the FIFO
+  METRIC_RX_BYTES,          //!< Payload bytes read from the FIFO
+  METRIC_RX_NO_BUFFER,      //!< Packets dropped because the frame pool was exhausted
+  METRIC_TX_FRAMES,         //!< Packets sent
+  METRIC_TX_BYTES,          //!< Payload bytes sent
+  METRIC_TX_FAILED,         //!< Packets without PacketSent
+  METRIC_TX_DROPPED,        //!< Packets rejected because the TX queue was full
+  METRIC_EVENTS_DROPPED,    //!< Events lost because the ring to the main thread was full
+  METRIC_FORWARDED,         //!< Frames that entered the forwarding pipeline
+  METRIC_DUPLICATES,        //!< Frames suppressed as duplicates
+  METRIC_SINK_ERRORS,       //!< Deliveries to a sink that failed
+  METRIC_SPI_TRANSFERS,     //!< SPI messages (ioctls); not labelled
+  METRIC_SPI_BYTES,         //!< Bytes clocked over SPI; not labelled
+  METRIC_COMMANDS_REJECTED, //!< Commands rejected because the queue to the radio thread was full; not labelled
+  METRIC_COUNTERS
+} MetricCounter;
+
+/** Histograms; labelled with the radio unless noted otherwise. */
+typedef enum
+{
+  METRIC_RSSI = 0,          //!< RSSI of received packets [dBm]
+  METRIC_LATENCY,           //!< Reception until handed to all sinks [us]
+  METRIC_TX_QUEUE,          //!< Depth of the TX queue when a packet is queued
+  METRIC_EVENT_QUEUE,       //!< Depth of the ring to the main thread when an event is pushed; not labelled
+  METRIC_COMMAND_QUEUE,     //!< Depth of the command queue when the radio thread drains it; not labelled
+  METRIC_HISTOGRAMS
+} MetricHistogram;
+
+/** Metrics of one thread; shards never share a cache line. */
+typedef struct
+{
+  uint64_t counters[METRIC_COUNTERS][METRICS_MAX_RADIOS];
+  uint64_t buckets[METRIC_HISTOGRAMS][METRICS_MAX_RADIOS][METRICS_BUCKETS + 1];
+  int64_t sums[METRIC_HISTOGRAMS][METRICS_MAX_RADIOS];
+} __attribute__((aligned(64))) MetricsShard;
+
+extern __thread MetricsShard* metrics_shard;
+
+extern const int32_t metrics_bounds[METRIC_HISTOGRAMS][METRICS_BUCKETS];
+
+MetricsShard* metricsClaimShard();
+
+/**
+ * Add to a counter.
+ *
+ * @param counter The counter
+ * @param radio Index of the radio; 0 for counters without label
+ * @param value Increment
+ */
+static inline void metricsAdd(MetricCounter counter, uint8_t radio, uint64_t value = 1)
+{
+  MetricsShard* shard = metrics_shard ? metrics_shard : metricsClaimShard();
+
+  __atomic_fetch_add(&shard->counters[counter][radio % METRICS_MAX_RADIOS], value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Record a value in a histogram.
+ *
+ * @param histogram The histogram
+ * @param radio Index of the radio; 0 for histograms without label
+ * @param value The value
+ */
+static inline void metricsObserve(MetricHistogram histogram, uint8_t radio, int32_t value)
+{
+  MetricsShard* shard = metrics_shard ? metrics_shard : metricsClaimShard();
+  const int32_t* bounds = metrics_bounds[histogram];
+
+  // bounds are ascending; unused ones are INT32_MAX
+  unsigned int bucket = 0;
+  while (bucket < METRICS_BUCKETS && value > bounds[bucket])
+    bucket++;
+
+  radio %= METRICS_MAX_RADIOS;
+  __atomic_fetch_add(&shard->buckets[histogram][radio][bucket], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&shard->sums[histogram][radio], value, __ATOMIC_RELAXED);
+}
+
+uint64_t metricsCounter(MetricCounter counter, uint8_t radio);
+
+unsigned int metricsRender(char* text, unsigned int size, unsigned int radios);
+
+/** HTTP endpoint of the metrics. */
+class MetricsServer : public EventHandler
+{
+public:
+  MetricsServer();
+  virtual ~MetricsServer();
+
+  bool start(EventLoop* loop, unsigned int radios, int port = METRICS_PORT);
+
+  void stop();
+
+  void handleEvent(int fd, uint32_t events);
+
+  /**
+   * Get the number of scrapes served.
+   */
+  unsigned int getScrapes()
+  {
+    return _scrapes;
+  }
+
+private:
+  void serve(int client);
+
+  void closeClient(unsigned int index);
+
+  EventLoop* _loop;
+  int _fd;
+  unsigned int _radios;
+  int _clients[METRICS_MAX_CLIENTS];
+  unsigned int _scrapes;
+  char _page[METRICS_PAGE_SIZE];
+};
+
+/** @}
+ *
+ */
+
+#endif /* METRICS_HXX_ */
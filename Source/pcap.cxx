@@ -0,0 +1,392 @@
+/**
+ * @file pcap.cxx
+ *
+ * @brief pcapng export of received frames for Wireshark.
+ */
+
+/** @addtogroup Forward
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+
+#include "pcap.hxx"
+
+#define BLOCK_SHB     0x0A0D0D0A  ///< Section Header Block
+#define BLOCK_IDB     0x00000001  ///< Interface Description Block
+#define BLOCK_EPB     0x00000006  ///< Enhanced Packet Block
+#define BYTE_ORDER_MAGIC 0x1A2B3C4D
+
+#define OPT_ENDOFOPT  0
+#define OPT_USERAPPL  4           ///< shb_userappl
+#define OPT_IF_NAME   2           ///< if_name
+#define OPT_IF_TSRESOL 9          ///< if_tsresol
+
+/** Round up to the 32 bit alignment of blocks and options. */
+static inline unsigned int pad4(unsigned int length)
+{
+  return (length + 3) & ~3u;
+}
+
+/**
+ * Append an option (code, length, value, padding) to a block being built.
+ */
+static void putOption(uint8_t* block, unsigned int* position, uint16_t code, const void* value, uint16_t length)
+{
+  memcpy(block + *position, &code, sizeof(code));
+  memcpy(block + *position + 2, &length, sizeof(length));
+  memset(block + *position + 4, 0, pad4(length));
+  if (length > 0)
+    memcpy(block + *position + 4, value, length);
+
+  *position += 4 + pad4(length);
+}
+
+/**
+ * Write the block type and the total length at both ends of a block.
+ */
+static void putFrame(uint8_t* block, uint32_t type, uint32_t length)
+{
+  memcpy(block, &type, sizeof(type));
+  memcpy(block + 4, &length, sizeof(length));
+  memcpy(block + length - 4, &length, sizeof(length));
+}
+
+/**
+ * pcapng sink constructor.
+ */
+PcapSink::PcapSink()
+{
+  _path[0] = '\0';
+  _pipe = false;
+  _fd = -1;
+  _loop = 0;
+  _timer = -1;
+  _radios = 1;
+  _maxSize = 0;
+  _files = PCAP_DEFAULT_FILES;
+  _fileSize = 0;
+  _used = 0;
+  _frames = 0;
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+PcapSink::~PcapSink()
+{
+  stop();
+  close();
+}
+
+/**
+ * Open the output: a regular file is created (an existing one truncated), a
+ * named pipe is opened once a reader is there.
+ *
+ * @param path File name or named pipe
+ * @param radios Number of radios; one interface each
+ * @param maxSize Rotate a regular file at this size [bytes]; 0 never
+ * @param files Rotated files to keep (file.1 ... file.N)
+ * @return true on success
+ */
+bool PcapSink::open(const char* path, unsigned int radios, unsigned int maxSize, unsigned int files)
+{
+  close();
+
+  if (strlen(path) >= PCAP_MAX_PATH - 4)
+  {
+    fprintf(stderr, "%s: name too long\n", path);
+    return false;
+  }
+
+  strcpy(_path, path);
+  _radios = radios ? radios : 1;
+  _maxSize = maxSize;
+  _files = files;
+
+  struct stat st;
+  _pipe = (0 == stat(path, &st) && S_ISFIFO(st.st_mode));
+
+  // a reader of the pipe that goes away must not kill the bridge: write() fails with EPIPE
+  signal(SIGPIPE, SIG_IGN);
+
+  return reopen() || _pipe;
+}
+
+/**
+ * Write the buffered blocks and close the output.
+ */
+void PcapSink::close()
+{
+  if (_fd < 0)
+    return;
+
+  flush();
+  ::close(_fd);
+  _fd = -1;
+}
+
+/**
+ * Write the buffered blocks periodically; retry a pipe without reader.
+ */
+void PcapSink::start(EventLoop* loop)
+{
+  _loop = loop;
+  _timer = timerCreate();
+  _loop->add(_timer, EPOLLIN, this);
+  timerArm(_timer, PCAP_FLUSH_INTERVAL, true);
+}
+
+/**
+ * Unregister from the event loop and write the buffered blocks.
+ */
+void PcapSink::stop()
+{
+  if (0 == _loop)
+    return;
+
+  _loop->remove(_timer);
+  ::close(_timer);
+  _timer = -1;
+  _loop = 0;
+
+  flush();
+}
+
+/**
+ * Append a frame as an Enhanced Packet Block.
+ *
+ * @return 0 on success; -1 if the frame was dropped.
+ */
+int PcapSink::deliver(const Frame& frame)
+{
+  unsigned int length = (frame.length > FRAME_MAX_PAYLOAD) ? FRAME_MAX_PAYLOAD : frame.length;
+  unsigned int captured = sizeof(PcapRadioHeader) + length;
+  unsigned int blockLength = 32 + pad4(captured);
+
+  // whole blocks only: a pipe reader must never see a partial one
+  if (_fd >= 0 && _used + blockLength > sizeof(_buffer))
+    flush();
+
+  if (_fd < 0 || _used + blockLength > sizeof(_buffer))
+  {
+    _stats.dropped++;
+    return -1;
+  }
+
+  PcapRadioHeader header;
+  memset(&header, 0, sizeof(header));
+  header.version = PCAP_RADIO_VERSION;
+  header.headerLength = sizeof(PcapRadioHeader);
+  header.radio = frame.radio;
+  header.flags = PCAP_FLAG_CRC_OK; // the radio drops frames with CRC errors
+  header.frequency = htonl(frame.frequency);
+  header.rssi = htons(frame.rssi);
+  header.fei = htonl(frame.fei);
+  header.timestamp = htobe64(frame.timestamp);
+
+  uint8_t* block = _buffer + _used;
+  uint32_t fields[5] = { frame.radio < _radios ? frame.radio : 0u, (uint32_t) (frame.timestamp >> 32),
+      (uint32_t) frame.timestamp, captured, captured };
+
+  memcpy(block + 8, fields, sizeof(fields));
+  memcpy(block + 28, &header, sizeof(header));
+  memcpy(block + 28 + sizeof(header), frame.data, length);
+  memset(block + 28 + captured, 0, pad4(captured) - captured);
+  putFrame(block, BLOCK_EPB, blockLength);
+
+  _used += blockLength;
+  _frames++;
+  _stats.frames++;
+
+  if (false == _pipe && _maxSize > 0 && _fileSize + _used >= _maxSize)
+  {
+    flush();
+    rotate();
+  }
+
+  return 0;
+}
+
+/**
+ * Flush timer.
+ */
+void PcapSink::handleEvent(int fd, uint32_t events)
+{
+  timerRead(fd);
+
+  if (_pipe && _fd < 0)
+    reopen();
+
+  flush();
+}
+
+/**
+ * (Re)open the output and start a new section.
+ *
+ * @return false if it could not be opened; for a pipe also without a reader.
+ */
+bool PcapSink::reopen()
+{
+  if (_pipe)
+    _fd = ::open(_path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  else
+    _fd = ::open(_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+  if (_fd < 0)
+  {
+    // ENXIO: nobody reads the pipe yet
+    if (false == _pipe || ENXIO != errno)
+      perror(_path);
+    return false;
+  }
+
+  // frames buffered while there was no reader are gone
+  _stats.dropped += _frames;
+  _used = 0;
+  _frames = 0;
+  _fileSize = 0;
+
+  writeHeaders();
+
+  return true;
+}
+
+/**
+ * Start the next file: file.N-1 becomes file.N and so on, file becomes file.1.
+ */
+void PcapSink::rotate()
+{
+  ::close(_fd);
+  _fd = -1;
+
+  char from[PCAP_MAX_PATH + 12];
+  char to[PCAP_MAX_PATH + 12];
+
+  for (unsigned int i = _files; i > 1; i--)
+  {
+    snprintf(from, sizeof(from), "%s.%u", _path, i - 1);
+    snprintf(to, sizeof(to), "%s.%u", _path, i);
+    rename(from, to);
+  }
+
+  if (_files > 0)
+  {
+    snprintf(to, sizeof(to), "%s.1", _path);
+    rename(_path, to);
+  }
+
+  _stats.rotations++;
+
+  reopen();
+}
+
+/**
+ * Put the Section Header Block and one Interface Description Block per radio
+ * into the empty buffer.
+ */
+void PcapSink::writeHeaders()
+{
+  uint8_t* block = _buffer;
+  unsigned int position = 8;
+
+  uint32_t magic = BYTE_ORDER_MAGIC;
+  uint16_t version[2] = { 1, 0 };
+  int64_t sectionLength = -1;
+  memcpy(block + position, &magic, sizeof(magic));
+  memcpy(block + position + 4, version, sizeof(version));
+  memcpy(block + position + 8, &sectionLength, sizeof(sectionLength));
+  position += 16;
+  putOption(block, &position, OPT_USERAPPL, "rfmbridge", 9);
+  putOption(block, &position, OPT_ENDOFOPT, 0, 0);
+  putFrame(block, BLOCK_SHB, position + 4);
+  _used = position + 4;
+
+  for (unsigned int i = 0; i < _radios; i++)
+  {
+    block = _buffer + _used;
+    position = 8;
+
+    uint16_t linkType[2] = { PCAP_LINKTYPE_USER0, 0 };
+    uint32_t snapLength = sizeof(PcapRadioHeader) + FRAME_MAX_PAYLOAD;
+    memcpy(block + position, linkType, sizeof(linkType));
+    memcpy(block + position + 4, &snapLength, sizeof(snapLength));
+    position += 8;
+
+    char name[16];
+    snprintf(name, sizeof(name), "rfm69-%u", i);
+    uint8_t resolution = 6; // microseconds
+    putOption(block, &position, OPT_IF_NAME, name, strlen(name));
+    putOption(block, &position, OPT_IF_TSRESOL, &resolution, 1);
+    putOption(block, &position, OPT_ENDOFOPT, 0, 0);
+    putFrame(block, BLOCK_IDB, position + 4);
+    _used += position + 4;
+  }
+}
+
+/**
+ * Write the buffer. A pipe that is full keeps the rest for the next flush; if
+ * the reader has gone, the buffer is dropped and the pipe reopened later.
+ *
+ * @return true if the buffer is empty now
+ */
+bool PcapSink::flush()
+{
+  unsigned int done = 0;
+
+  while (done < _used && _fd >= 0)
+  {
+    ssize_t n = write(_fd, _buffer + done, _used - done);
+    if (n < 0 && EINTR == errno)
+      continue;
+    if (n < 0 && _pipe && EAGAIN == errno)
+      break;
+
+    if (n <= 0)
+    {
+      if (false == _pipe && 0 == _stats.errors)
+        perror(_path);
+      if (false == _pipe)
+        _stats.errors++;
+
+      // reader gone or write error: the buffered frames are lost
+      _stats.dropped += _frames;
+      _frames = 0;
+      _used = 0;
+      done = 0;
+
+      if (_pipe)
+      {
+        ::close(_fd);
+        _fd = -1;
+      }
+      break;
+    }
+
+    done += n;
+    _fileSize += n;
+  }
+
+  if (done > 0)
+  {
+    memmove(_buffer, _buffer + done, _used - done);
+    _used -= done;
+  }
+
+  if (0 == _used)
+    _frames = 0;
+
+  return 0 == _used;
+}
+
+/** @}
+ *
+ */
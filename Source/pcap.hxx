@@ -0,0 +1,120 @@
+/**
+ * @file pcap.hxx
+ *
+ * @brief pcapng export of received frames for Wireshark.
+ *
+ * PcapSink writes every frame the radios receive as an Enhanced Packet Block
+ * of a pcapng file, with microsecond timestamps and one interface per radio
+ * ("rfm69-0", ...). The link type is LINKTYPE_USER0 (147, DLT_USER0): each
+ * packet starts with a PcapRadioHeader in network byte order, followed by the
+ * payload without the RFM69 length byte. In Wireshark, map DLT_USER0 to a
+ * dissector for the payload with a header size of sizeof(PcapRadioHeader)
+ * (Preferences, Protocols, DLT_USER), or decode the header with a Lua script.
+ *
+ * Blocks are collected in a buffer on the main thread and written when it is
+ * full and every PCAP_FLUSH_INTERVAL ms. A regular file can be rotated by size:
+ * file becomes file.1, file.1 becomes file.2 and so on, and every file starts
+ * with its own section header. A named pipe is written without blocking, for a
+ * live capture with "wireshark -k -i <pipe>": it is (re)opened when a reader
+ * is there, and blocks that do not fit into the pipe are dropped.
+ */
+
+#ifndef PCAP_HXX_
+#define PCAP_HXX_
+
+#include <stdint.h>
+
+#include "frame.hxx"
+#include "forward.hxx"
+#include "eventloop.hxx"
+
+/** @addtogroup Forward
+ * @{
+ */
+#define PCAP_LINKTYPE_USER0   147        ///< LINKTYPE_USER0 / DLT_USER0
+#define PCAP_RADIO_VERSION    1          ///< PcapRadioHeader version
+#define PCAP_FLAG_CRC_OK      0x01       ///< Payload CRC was checked by the radio and is valid
+#define PCAP_BUFFER_SIZE      65536      ///< Write buffer [bytes]
+#define PCAP_FLUSH_INTERVAL   250        ///< Buffered blocks are written at least this often [ms]
+#define PCAP_MAX_PATH         256        ///< Longest file name
+#define PCAP_DEFAULT_FILES    4          ///< Rotated files kept besides the current one
+
+/** Radio pseudo-header in front of every payload; network byte order. */
+typedef struct __attribute__((packed))
+{
+  uint8_t version;        //!< PCAP_RADIO_VERSION
+  uint8_t headerLength;   //!< sizeof(PcapRadioHeader); newer versions may append fields
+  uint8_t radio;          //!< Tag of the receiving radio
+  uint8_t flags;          //!< PCAP_FLAG_...
+  uint32_t frequency;     //!< Carrier frequency [Hz]; 0 if unknown
+  int16_t rssi;           //!< RSSI [dBm]
+  uint16_t reserved;      //!< Always 0
+  int32_t fei;            //!< Frequency error [Hz]; 0 if not measured
+  uint64_t timestamp;     //!< Reception time (CLOCK_REALTIME) [us]
+} PcapRadioHeader;
+
+/** pcapng export counters. */
+typedef struct
+{
+  unsigned int frames;      //!< Frames written or buffered
+  unsigned int dropped;     //!< Frames lost: no reader on the pipe, pipe full or write error
+  unsigned int rotations;   //!< Files rotated
+  unsigned int errors;      //!< Failed writes
+} PcapStats;
+
+/** Writes received frames to a pcapng file or named pipe. */
+class PcapSink : public FrameSink, public EventHandler
+{
+public:
+  PcapSink();
+  virtual ~PcapSink();
+
+  bool open(const char* path, unsigned int radios, unsigned int maxSize = 0, unsigned int files = PCAP_DEFAULT_FILES);
+
+  void close();
+
+  void start(EventLoop* loop);
+
+  void stop();
+
+  int deliver(const Frame& frame);
+
+  void handleEvent(int fd, uint32_t events);
+
+  /**
+   * Get the export counters.
+   */
+  const PcapStats& getStats()
+  {
+    return _stats;
+  }
+
+private:
+  bool reopen();
+
+  void rotate();
+
+  void writeHeaders();
+
+  bool flush();
+
+  char _path[PCAP_MAX_PATH];
+  bool _pipe;
+  int _fd;
+  EventLoop* _loop;
+  int _timer;
+  unsigned int _radios;
+  unsigned int _maxSize;
+  unsigned int _files;
+  uint64_t _fileSize;
+  unsigned int _used;
+  unsigned int _frames;
+  PcapStats _stats;
+  uint8_t _buffer[PCAP_BUFFER_SIZE];
+};
+
+/** @}
+ *
+ */
+
+#endif /* PCAP_HXX_ */
@@ -0,0 +1,69 @@
+/**
+ * @file pollbackoff.hxx
+ *
+ * @brief Polling interval policy for radios without a wired DIO0 line.
+ *
+ * Every poll costs one SPI burst of RegIrqFlags1/2. While the flags show activity
+ * (RSSI above threshold or a sync word match, i.e. a packet is on the air) the
+ * radio is polled at the shortest interval, so PayloadReady is seen quickly
+ * (Radio::poll() stops taking Rssi alone for activity when it is noise).
+ * While idle the interval doubles up to a maximum, so an idle gateway costs
+ * almost no CPU. A packet takes longer on the air than the maximum interval,
+ * so the preamble is always seen in time to switch to fast polling.
+ */
+
+#ifndef POLLBACKOFF_HXX_
+#define POLLBACKOFF_HXX_
+
+/** @addtogroup Radio
+ * @{
+ */
+#define POLLBACKOFF_MIN   250   ///< Polling interval while a packet is on the air [us]
+#define POLLBACKOFF_MAX   8000  ///< Polling interval when idle [us]
+
+/** Exponential backoff of the polling interval. */
+class PollBackoff
+{
+public:
+  PollBackoff(unsigned int minInterval = POLLBACKOFF_MIN, unsigned int maxInterval = POLLBACKOFF_MAX)
+  {
+    _min = minInterval;
+    _max = maxInterval;
+    _interval = minInterval;
+  }
+
+  /**
+   * Get the interval until the next poll.
+   *
+   * @param active The last poll saw activity
+   * @return Interval [us]
+   */
+  unsigned int next(bool active)
+  {
+    if (active)
+      _interval = _min;
+    else if (_interval < _max)
+      _interval = (_interval * 2 < _max) ? _interval * 2 : _max;
+
+    return _interval;
+  }
+
+  /**
+   * Start over with the shortest interval.
+   */
+  void reset()
+  {
+    _interval = _min;
+  }
+
+private:
+  unsigned int _min;
+  unsigned int _max;
+  unsigned int _interval;
+};
+
+/** @}
+ *
+ */
+
+#endif /* POLLBACKOFF_HXX_ */
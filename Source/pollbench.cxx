@@ -0,0 +1,236 @@
+/**
+ * @file pollbench.cxx
+ *
+ * @brief Latency/CPU trade-off of polling the RFM69 without a DIO0 line.
+ *
+ * Simulates a receiver polled by the old fixed 10 ms loop (three register reads
+ * per poll), a fixed 1 ms loop and the adaptive PollBackoff of the radio (one
+ * IRQ flags burst per poll) against the same random packet arrivals. For every
+ * policy it prints polls and SPI transfers per second, the CPU share and the
+ * delay between PayloadReady and the poll that sees it.
+ *
+ * The CPU cost of a wake-up (timerfd + epoll) is measured on this machine; the
+ * cost of an SPI transfer is a parameter (-s), as it depends on the board.
+ * Build with "make pollbench".
+ *
+ * Usage: pollbench [-r packets/s] [-b bitrate] [-l payload bytes] [-t seconds] [-s SPI transfer us]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+
+#include "pollbackoff.hxx"
+
+#define POLLBENCH_MAX_PACKETS   100000 ///< Latency samples per policy
+
+/** A polling policy under test. */
+typedef struct
+{
+  const char* name;
+  unsigned int fixed;       //!< Fixed interval [us]; 0 for PollBackoff
+  unsigned int transfers;   //!< SPI transfers per poll
+} Policy;
+
+static uint32_t latencies[POLLBENCH_MAX_PACKETS];
+
+static int
+compare(const void* a, const void* b)
+{
+  uint32_t x = *(const uint32_t*) a;
+  uint32_t y = *(const uint32_t*) b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Measure the CPU time of one timer wake-up in an epoll loop [us].
+ */
+static double
+wakeupcost()
+{
+  const unsigned int count = 5000;
+
+  int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, timer, &ev);
+
+  struct rusage before, after;
+  getrusage(RUSAGE_SELF, &before);
+
+  for (unsigned int i = 0; i < count; i++)
+  {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_nsec = 100000;
+    timerfd_settime(timer, 0, &spec, 0);
+
+    struct epoll_event event;
+    uint64_t expirations;
+    epoll_wait(epfd, &event, 1, -1);
+    read(timer, &expirations, sizeof(expirations));
+  }
+
+  getrusage(RUSAGE_SELF, &after);
+  close(epfd);
+  close(timer);
+
+  double used = (after.ru_utime.tv_sec - before.ru_utime.tv_sec + after.ru_stime.tv_sec - before.ru_stime.tv_sec) * 1e6
+      + (after.ru_utime.tv_usec - before.ru_utime.tv_usec + after.ru_stime.tv_usec - before.ru_stime.tv_usec);
+
+  return used / count;
+}
+
+/**
+ * Draw the start of the next packet: exponential gap after the last one.
+ */
+static double
+nextstart(double after, double rate)
+{
+  return after - log1p(-drand48()) / rate * 1e6;
+}
+
+/**
+ * Run one policy over the simulated time and print its line.
+ *
+ * A packet sets Rssi/SyncAddressMatch from its start and PayloadReady at its end
+ * until it is read; a packet that completes while the previous one is still
+ * unread is lost.
+ */
+static void
+simulate(const Policy* policy, double rate, double airtime, double seconds, double wakeup, double spi)
+{
+  PollBackoff backoff;
+  double duration = seconds * 1e6;
+  double t = 0;
+  uint64_t polls = 0;
+  unsigned int samples = 0;
+  unsigned int lost = 0;
+
+  // same arrivals for every policy
+  srand48(1);
+
+  double start = nextstart(0, rate);
+  double ready = start + airtime * 1e6;
+  bool pending = false;
+  double pendingReady = 0;
+
+  while (t < duration)
+  {
+    polls++;
+
+    while (ready <= t)
+    {
+      if (pending)
+      {
+        lost++;
+      }
+      else
+      {
+        pending = true;
+        pendingReady = ready;
+      }
+
+      start = nextstart(ready, rate);
+      ready = start + airtime * 1e6;
+    }
+
+    bool active;
+
+    if (pending)
+    {
+      if (samples < POLLBENCH_MAX_PACKETS)
+        latencies[samples++] = t - pendingReady;
+      pending = false;
+      active = true;
+    }
+    else
+    {
+      // preamble/sync seen: Rssi or SyncAddressMatch
+      active = (t >= start);
+    }
+
+    t += policy->fixed ? policy->fixed : backoff.next(active);
+  }
+
+  double pollRate = polls / seconds;
+  double cpu = pollRate * (wakeup + policy->transfers * spi) / 1e4;
+
+  qsort(latencies, samples, sizeof(latencies[0]), compare);
+
+  printf("%-14s %8.0f %9.0f %6.2f%% %8u %8u %8u %6u\n", policy->name, pollRate, pollRate * policy->transfers, cpu,
+      samples ? latencies[samples / 2] : 0, samples ? latencies[samples * 99 / 100] : 0,
+      samples ? latencies[samples - 1] : 0, lost);
+}
+
+int
+main(int argc, char *argv[])
+{
+  double rate = 1;
+  unsigned int bitrate = 4800;
+  unsigned int length = 20;
+  double seconds = 3600;
+  double spi = 30;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "r:b:l:t:s:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'r':
+      rate = atof(optarg);
+      break;
+    case 'b':
+      bitrate = atoi(optarg);
+      break;
+    case 'l':
+      length = atoi(optarg);
+      break;
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 's':
+      spi = atof(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-r packets/s] [-b bitrate] [-l payload bytes] [-t seconds] [-s SPI transfer us]\n",
+          argv[0]);
+      return 1;
+    }
+  }
+
+  if (rate <= 0 || 0 == bitrate || seconds <= 0)
+  {
+    fprintf(stderr, "rate, bitrate and time must be positive\n");
+    return 1;
+  }
+
+  // preamble, sync word, length byte, payload, CRC
+  double airtime = (4.0 + 4 + 1 + length + 2) * 8 / bitrate;
+  double wakeup = wakeupcost();
+
+  printf("%.1f packets/s, %.1f ms on air, wake-up %.1f us (measured), SPI transfer %.1f us\n\n", rate,
+      airtime * 1000, wakeup, spi);
+  printf("%-14s %8s %9s %7s %8s %8s %8s %6s\n", "policy", "polls/s", "SPI/s", "CPU", "p50 us", "p99 us", "max us",
+      "lost");
+
+  const Policy policies[] = {
+      { "fixed 10 ms", 10000, 3 },
+      { "fixed 1 ms", 1000, 1 },
+      { "adaptive", 0, 1 } };
+
+  for (unsigned int i = 0; i < sizeof(policies) / sizeof(policies[0]); i++)
+    simulate(&policies[i], rate, airtime, seconds, wakeup, spi);
+
+  return 0;
+}
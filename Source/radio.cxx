@@ -0,0 +1,716 @@
+/**
+ * @file radio.cxx
+ *
+ * @brief Event driven operation of one RFM69 module.
+ */
+
+/** @addtogroup Radio
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+
+#include "radio.hxx"
+#include "metrics.hxx"
+
+extern uint32_t HAL_GetTick();
+
+/**
+ * Radio constructor. The module has to be initialized with RFM69::init() before start().
+ *
+ * @param id Tag of this radio, passed on with every frame
+ * @param rfm69 Driver instance
+ * @param listener Receives packets and TX completion
+ */
+Radio::Radio(uint8_t id, RFM69* rfm69, RadioListener* listener)
+{
+  _id = id;
+  _frequency = 0;
+  memset(&_stats, 0, sizeof(_stats));
+  _rfm69 = rfm69;
+  _listener = listener;
+  _loop = 0;
+  _pollTimer = -1;
+  _backoffTimer = -1;
+  _txTimer = -1;
+  _configTimer = -1;
+  _watchdogTimer = -1;
+  _watchdogInterval = 0;
+  _recoveryLevel = 0;
+  _faultStart = 0;
+  _syncChecks = 0;
+  _readyChecks = 0;
+  _watchFrames = 0;
+  _lastFrame = 0;
+  _busyChecks = 0;
+  _silentChecks = 0;
+  _rxEdge = 0;
+  _rssiStart = 0;
+  _rssiNoise = false;
+  _csmaEnabled = true;
+  _txState = RADIO_TX_IDLE;
+  _csmaStart = 0;
+  _csmaRunning = false;
+  _txHead = 0;
+  _txCount = 0;
+  _configPower = 0;
+  _configPending = false;
+  _configStart = 0;
+}
+
+Radio::~Radio()
+{
+  stop();
+}
+
+/**
+ * Register with the event loop and switch the module to RX mode.
+ *
+ * @param loop Event loop
+ * @param dio0Gpio GPIO (BCM) wired to DIO0; -1 to poll the IRQ flags (see PollBackoff)
+ * @param dio1Gpio GPIO (BCM) wired to DIO1; -1 if not wired
+ * @param gpioChip GPIO character device of the DIO lines; 0 uses sysfs
+ * @return true on success
+ */
+bool Radio::start(EventLoop* loop, int dio0Gpio, int dio1Gpio, const char* gpioChip)
+{
+  _loop = loop;
+
+  _backoffTimer = timerCreate();
+  _txTimer = timerCreate();
+  _configTimer = timerCreate();
+  _loop->add(_backoffTimer, EPOLLIN, this);
+  _loop->add(_txTimer, EPOLLIN, this);
+  _loop->add(_configTimer, EPOLLIN, this);
+
+  if (dio0Gpio >= 0 && _dio0.open(dio0Gpio, gpioChip))
+  {
+    _loop->add(_dio0.getFd(), _dio0.getEvents(), this);
+  }
+  else
+  {
+    if (dio0Gpio >= 0)
+      printf("DIO0 on GPIO %d not available, polling instead\r\n", dio0Gpio);
+
+    _pollTimer = timerCreate();
+    _loop->add(_pollTimer, EPOLLIN, this);
+    timerArmUs(_pollTimer, POLLBACKOFF_MIN);
+  }
+
+  if (dio1Gpio >= 0 && _dio1.open(dio1Gpio, gpioChip))
+  {
+    _loop->add(_dio1.getFd(), _dio1.getEvents(), this);
+  }
+
+  if (_watchdogInterval > 0)
+  {
+    _watchdogTimer = timerCreate();
+    _loop->add(_watchdogTimer, EPOLLIN, this);
+    timerArm(_watchdogTimer, _watchdogInterval, true);
+    _lastFrame = HAL_GetTick();
+  }
+
+  restart();
+
+  return true;
+}
+
+/**
+ * Unregister from the event loop.
+ */
+void Radio::stop()
+{
+  if (0 == _loop)
+    return;
+
+  int fds[] = { _pollTimer, _backoffTimer, _txTimer, _configTimer, _watchdogTimer, _dio0.getFd(), _dio1.getFd() };
+  for (unsigned int i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+  {
+    if (fds[i] >= 0)
+      _loop->remove(fds[i]);
+  }
+
+  if (_pollTimer >= 0)
+    close(_pollTimer);
+  if (_watchdogTimer >= 0)
+    close(_watchdogTimer);
+  close(_backoffTimer);
+  close(_txTimer);
+  close(_configTimer);
+  _dio0.close();
+  _dio1.close();
+
+  _pollTimer = _backoffTimer = _txTimer = _configTimer = _watchdogTimer = -1;
+  _loop = 0;
+}
+
+/**
+ * Go (back) to RX mode, e.g. after the module has been re-initialized.
+ * A pending transmission is aborted.
+ */
+void Radio::restart()
+{
+  if (RADIO_TX_IDLE != _txState)
+  {
+    timerDisarm(_backoffTimer);
+    timerDisarm(_txTimer);
+    _txState = RADIO_TX_IDLE;
+  }
+
+  service();
+  kickTx();
+}
+
+/**
+ * Queue a downlink packet.
+ *
+ * @param data Pointer to the payload
+ * @param dataLength Length of the payload; at most RFM69_MAX_PAYLOAD bytes
+ * @return 0 on success; -1 if the queue is full or the packet is invalid.
+ */
+int Radio::queue(const void* data, unsigned int dataLength)
+{
+  if (0 == dataLength || dataLength > RFM69_MAX_PAYLOAD)
+    return -1;
+
+  if (_txCount >= RADIO_TX_QUEUE)
+  {
+    _stats.txDropped++;
+    metricsAdd(METRIC_TX_DROPPED, _id);
+    return -1;
+  }
+
+  unsigned int index = (_txHead + _txCount) % RADIO_TX_QUEUE;
+  memcpy(_txQueue[index], data, dataLength);
+  _txLength[index] = dataLength;
+  _txCount++;
+  metricsObserve(METRIC_TX_QUEUE, _id, _txCount);
+
+  kickTx();
+
+  return 0;
+}
+
+/**
+ * Switch the radio to another channel; see RFM69::retune().
+ *
+ * @param frequency Carrier frequency in Hz
+ * @param syncWord Pointer to the sync word bytes; 0 keeps the current sync word
+ * @param syncLength Number of sync word bytes
+ */
+void Radio::tune(unsigned int frequency, const uint8_t* syncWord, unsigned int syncLength)
+{
+  _rfm69->retune(frequency, syncWord, syncLength);
+  _frequency = frequency;
+}
+
+/**
+ * Change the configuration without re-initialization; see RFM69::applyImage().
+ *
+ * The registers are written in a quiet gap: while a packet is on the air (RSSI
+ * or sync word detected) or being sent, the change waits up to RADIO_CONFIG_WAIT.
+ * The listener is told with radioConfigured() when it has been applied.
+ *
+ * @param profile Desired configuration
+ * @param powerDBm Output power [dBm]
+ */
+void Radio::reconfigure(const RFM69Profile& profile, int8_t powerDBm)
+{
+  _config = profile;
+  _configPower = powerDBm;
+  _configPending = true;
+  _configStart = HAL_GetTick();
+
+  applyConfig();
+}
+
+/**
+ * Dispatch events of the DIO lines and timers.
+ */
+void Radio::handleEvent(int fd, uint32_t events)
+{
+  if (fd == _dio0.getFd())
+  {
+    if (_dio0.acknowledge() > 0)
+      _rxEdge = _dio0.getTimestamp();
+
+    if (RADIO_TX_ACTIVE == _txState)
+    {
+      if (_rfm69->packetSent())
+        finishTx(true);
+    }
+    else
+    {
+      service();
+    }
+  }
+  else if (fd == _dio1.getFd())
+  {
+    _dio1.acknowledge();
+
+    if (RADIO_TX_ACTIVE != _txState)
+      service();
+  }
+  else if (fd == _pollTimer)
+  {
+    timerRead(_pollTimer);
+    poll();
+  }
+  else if (fd == _backoffTimer)
+  {
+    timerRead(_backoffTimer);
+
+    if (RADIO_TX_BACKOFF == _txState)
+    {
+      _txState = RADIO_TX_IDLE;
+      kickTx();
+    }
+  }
+  else if (fd == _txTimer)
+  {
+    timerRead(_txTimer);
+
+    if (RADIO_TX_ACTIVE == _txState)
+      finishTx(_rfm69->packetSent());
+  }
+  else if (fd == _configTimer)
+  {
+    timerRead(_configTimer);
+    applyConfig();
+  }
+  else if (fd == _watchdogTimer)
+  {
+    timerRead(_watchdogTimer);
+    check();
+  }
+}
+
+/**
+ * Read all packets the module has and hand them to the listener.
+ * The module resides in RX mode afterwards.
+ *
+ * Every packet is read from the FIFO straight into a pooled frame.
+ */
+void Radio::service()
+{
+  while (true)
+  {
+    Frame* frame = frameAlloc();
+
+    // without a buffer the FIFO is still emptied, the packet is lost
+    uint64_t drainStart = frameClock();
+    int bytesReceived = _rfm69->receivePayload(frame ? frame->data : _discard, FRAME_MAX_PAYLOAD);
+    if (bytesReceived <= 0)
+    {
+      frameUnref(frame);
+      break;
+    }
+
+    _stats.rxFrames++;
+    _stats.rxBytes += bytesReceived;
+    metricsAdd(METRIC_RX_FRAMES, _id);
+    metricsAdd(METRIC_RX_BYTES, _id, bytesReceived);
+
+    if (0 == frame)
+    {
+      _stats.rxNoBuffer++;
+      metricsAdd(METRIC_RX_NO_BUFFER, _id);
+      continue;
+    }
+
+    uint64_t drainEnd = frameClock();
+    frame->timestamp = frameTimestamp();
+
+    // PayloadReady edge time of the kernel: independent of how late this thread runs;
+    // without it the trace starts with the drain
+    frame->edge = drainStart;
+    if (0 != _rxEdge)
+    {
+      uint64_t delay = drainEnd - _rxEdge;
+      if (delay < 1000000000)
+      {
+        frame->timestamp -= delay / 1000;
+        frame->edge = _rxEdge;
+      }
+
+      _rxEdge = 0;
+    }
+    frameStage(frame, FRAME_STAGE_DRAIN_START, drainStart);
+    frameStage(frame, FRAME_STAGE_DRAIN_END, drainEnd);
+    frame->frequency = _frequency;
+    frame->radio = _id;
+    frame->length = bytesReceived;
+    frame->rssi = _rfm69->getRSSI();
+    frame->fei = _rfm69->getFEI();
+    metricsObserve(METRIC_RSSI, _id, frame->rssi);
+
+    if (0 != _listener)
+      _listener->radioReceive(this, frame);
+
+    frameUnref(frame);
+  }
+}
+
+/**
+ * Poll the IRQ flags if DIO0 is not wired and schedule the next poll.
+ *
+ * Rssi stays set until the receiver restarts, also for noise or a packet of
+ * another network. If it is not followed by SyncAddressMatch within
+ * RADIO_POLL_RSSI, the receiver is restarted and Rssi alone does not count as
+ * activity for RADIO_POLL_NOISE, so the poller backs off; a sync word match is
+ * still seen within the longest interval. Afterwards Rssi is sampled again.
+ */
+void Radio::poll()
+{
+  bool active = true;
+
+  if (RADIO_TX_ACTIVE == _txState)
+  {
+    if (_rfm69->packetSent())
+      finishTx(true);
+  }
+  else
+  {
+    // RegIrqFlags1/2 in one burst
+    uint16_t flags = _rfm69->readIrqFlags();
+
+    // PayloadReady
+    if (flags & 0x0004)
+      service();
+
+    bool rssi = flags & 0x0800;
+    bool sync = flags & 0x0100;
+    uint32_t now = HAL_GetTick();
+
+    // after RADIO_POLL_NOISE, Rssi is taken for a packet again
+    if (_rssiNoise && now - _rssiStart >= RADIO_POLL_NOISE)
+    {
+      _rssiStart = 0;
+      _rssiNoise = false;
+    }
+
+    if (false == rssi || sync || (flags & 0x0004))
+    {
+      if (false == _rssiNoise)
+        _rssiStart = 0;
+    }
+    else if (0 == _rssiStart)
+    {
+      _rssiStart = now;
+    }
+    else if (false == _rssiNoise && now - _rssiStart >= RADIO_POLL_RSSI)
+    {
+      _rfm69->restartRx();
+      _stats.noiseRestarts++;
+      _rssiStart = now;
+      _rssiNoise = true;
+    }
+
+    // Rssi or SyncAddressMatch: a packet is on the air
+    active = sync || (rssi && false == _rssiNoise) || (flags & 0x0004);
+  }
+
+  timerArmUs(_pollTimer, _poll.next(active));
+}
+
+/**
+ * Apply a pending configuration change if the channel is quiet, otherwise try
+ * again in a millisecond.
+ */
+void Radio::applyConfig()
+{
+  if (false == _configPending)
+    return;
+
+  bool waited = (HAL_GetTick() - _configStart) >= RADIO_CONFIG_WAIT;
+
+  if (RADIO_TX_IDLE != _txState && false == waited)
+  {
+    timerArm(_configTimer, 1);
+    return;
+  }
+
+  // RegIrqFlags1/2: fetch a completed packet first, do not cut into one on the air
+  uint16_t flags = _rfm69->readIrqFlags();
+  if (flags & 0x0004)
+    service();
+  else if ((flags & 0x0900) && false == waited)
+  {
+    timerArm(_configTimer, 1);
+    return;
+  }
+
+  RFM69Image image = rfm69Image(_config);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  int registers = _rfm69->applyImage(image);
+  if (_configPower != _rfm69->getPowerDBm() && _rfm69->setPowerDBm(_configPower) < 0)
+    registers = -1;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  _configPending = false;
+
+  _frequency = _config.frequency;
+
+  unsigned int downtime = 0;
+  if (registers != 0)
+    downtime = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+
+  if (0 != _listener)
+    _listener->radioConfigured(this, registers, downtime);
+}
+
+/**
+ * Re-initialize the module, keeping its current configuration (shadow copy)
+ * and output power, and go back to RX mode.
+ *
+ * @param reset Pulse the RESET line first, if one is wired
+ * @return true if the module has been reset
+ */
+bool Radio::reinit(bool reset)
+{
+  RFM69Image image = _rfm69->getShadow();
+  int8_t powerDBm = _rfm69->getPowerDBm();
+
+  bool done = reset && _rfm69->reset();
+
+  _rfm69->init();
+  _rfm69->applyImage(image);
+  _rfm69->setPowerDBm(powerDBm);
+  restart();
+
+  return done;
+}
+
+/**
+ * Watchdog: check the health of the module.
+ *
+ * All registers are read in one burst. A fault is a version register other
+ * than 0x24 (module not answering), configuration registers that differ from
+ * the shadow copy, a receiver that stays not ready in RX mode, keeps a sync word
+ * match without a packet or has not received anything for RADIO_WATCHDOG_SILENCE
+ * while the channel was busy, and a FIFO overrun. Faults are recovered with the
+ * least invasive step first, escalating while they persist; the time until the
+ * module is healthy again is recorded.
+ */
+void Radio::check()
+{
+  // not in the middle of a transmission or reconfiguration
+  if (RADIO_TX_IDLE != _txState || _configPending)
+    return;
+
+  uint8_t regs[RFM69_IMAGE_SIZE];
+  _rfm69->readBurst(0x01, regs + 1, RFM69_IMAGE_SIZE - 1);
+
+  uint32_t now = HAL_GetTick();
+
+  // a packet whose DIO0 edge got lost
+  if (regs[0x28] & 0x04)
+  {
+    service();
+    return;
+  }
+
+  bool version = (0x24 != regs[0x10]);
+  bool drift = false;
+  bool stuck = false;
+  bool overrun = (0 != (regs[0x28] & 0x10));
+
+  // trigger and status bits, and the AES key, are no configuration that can drift
+  const RFM69Image& shadow = _rfm69->getShadow();
+  for (unsigned int reg = 1; reg < RFM69_IMAGE_SIZE && false == version; reg++)
+  {
+    uint8_t bits = rfm69CompareBits(reg);
+    if (rfm69ImageHas(shadow, reg) && (regs[reg] & bits) != (shadow.values[reg] & bits))
+      drift = true;
+  }
+
+  if (false == version)
+  {
+    // RX mode with ModeReady and RxReady; both are clear for a moment after each packet (RX restart)
+    bool ready = ((regs[0x01] >> 2) & 0x07) == 4 && (regs[0x27] & 0xC0) == 0xC0;
+    _readyChecks = ready ? 0 : _readyChecks + 1;
+    if (_readyChecks >= RADIO_WATCHDOG_READY)
+      stuck = true;
+
+    // SyncAddressMatch is cleared when the packet is complete
+    _syncChecks = (regs[0x27] & 0x01) ? _syncChecks + 1 : 0;
+    if (_syncChecks >= RADIO_WATCHDOG_SYNC)
+      stuck = true;
+
+    // silence while the channel is busy: Rssi flag or more than -90 dBm
+    if (_stats.rxFrames != _watchFrames)
+    {
+      _watchFrames = _stats.rxFrames;
+      _lastFrame = now;
+      _busyChecks = _silentChecks = 0;
+    }
+    else
+    {
+      _silentChecks++;
+      if ((regs[0x27] & 0x08) || regs[0x24] < 180)
+        _busyChecks++;
+
+      if ((now - _lastFrame) >= RADIO_WATCHDOG_SILENCE && 2 * _busyChecks >= _silentChecks)
+      {
+        stuck = true;
+        _lastFrame = now;
+        _busyChecks = _silentChecks = 0;
+      }
+    }
+  }
+
+  if (false == (version || drift || stuck || overrun))
+  {
+    if (0 != _faultStart)
+    {
+      unsigned int mttr = now - _faultStart;
+      _stats.recovered++;
+      _stats.mttrLast = mttr;
+      _stats.mttrTotal += mttr;
+      if (mttr > _stats.mttrMax)
+        _stats.mttrMax = mttr;
+
+      printf("radio %u: recovered after %u ms\r\n", _id, mttr);
+
+      _faultStart = 0;
+      _recoveryLevel = 0;
+    }
+    return;
+  }
+
+  _stats.faultVersion += version;
+  _stats.faultDrift += drift;
+  _stats.faultStuck += stuck;
+  _stats.faultOverrun += overrun;
+
+  if (0 == _faultStart)
+    _faultStart = now;
+
+  printf("radio %u:%s%s%s%s (0x01: %x 0x27: %x 0x28: %x)\r\n", _id, version ? " version" : "", drift ? " drift" : "",
+      stuck ? " stuck" : "", overrun ? " overrun" : "", regs[0x01], regs[0x27], regs[0x28]);
+
+  recover(drift, version);
+}
+
+/**
+ * Take the next step of the recovery ladder: restart the receiver (rewriting
+ * drifted registers), re-initialize, reset through the RESET line.
+ *
+ * @param drift Configuration registers differ from the shadow copy
+ * @param version The module does not answer; restarting the receiver does not help
+ */
+void Radio::recover(bool drift, bool version)
+{
+  unsigned int level = _recoveryLevel;
+  if (version && level < 1)
+    level = 1;
+
+  switch (level)
+  {
+  case 0:
+    {
+      _rfm69->setMode(RFM69_MODE_STANDBY);
+      if (drift)
+      {
+        RFM69Image image = _rfm69->getShadow();
+        _rfm69->warmInit(image);
+      }
+      _rfm69->clearFIFO();
+      service();
+      _stats.rxRestarts++;
+    }
+    break;
+  case 1:
+    reinit(false);
+    _stats.reinits++;
+    break;
+  default:
+    if (reinit(true))
+      _stats.resets++;
+    else
+      _stats.reinits++;
+    break;
+  }
+
+  printf("radio %u: recovery step %u\r\n", _id, level + 1);
+
+  if (level < 2)
+    _recoveryLevel = level + 1;
+}
+
+/**
+ * Start sending the next queued packet, doing CSMA/CA with a timerfd backoff.
+ */
+void Radio::kickTx()
+{
+  if (RADIO_TX_IDLE != _txState || 0 == _txCount)
+    return;
+
+  if (_csmaEnabled)
+  {
+    if (false == _csmaRunning)
+    {
+      _csmaRunning = true;
+      _csmaStart = HAL_GetTick();
+    }
+
+    // the module is in RX mode here, so a RSSI sample is available
+    if ((false == _rfm69->channelFree()) && ((HAL_GetTick() - _csmaStart) < RADIO_CSMA_TIMEOUT))
+    {
+      // wait for a random time before checking again
+      _txState = RADIO_TX_BACKOFF;
+      timerArm(_backoffTimer, 1 + rand() % 10);
+      return;
+    }
+  }
+
+  _csmaRunning = false;
+  _rfm69->startSend(_txQueue[_txHead], _txLength[_txHead]);
+  _txState = RADIO_TX_ACTIVE;
+  timerArm(_txTimer, RADIO_TX_TIMEOUT);
+}
+
+/**
+ * Complete the current transmission and go back to RX mode.
+ */
+void Radio::finishTx(bool success)
+{
+  timerDisarm(_txTimer);
+
+  if (success)
+  {
+    _stats.txFrames++;
+    metricsAdd(METRIC_TX_FRAMES, _id);
+    metricsAdd(METRIC_TX_BYTES, _id, _txLength[_txHead]);
+  }
+  else
+  {
+    _stats.txFailed++;
+    metricsAdd(METRIC_TX_FAILED, _id);
+  }
+
+  _txHead = (_txHead + 1) % RADIO_TX_QUEUE;
+  _txCount--;
+  _txState = RADIO_TX_IDLE;
+
+  if (0 != _listener)
+    _listener->radioSent(this, success);
+
+  // back to RX
+  service();
+  kickTx();
+}
+
+/** @}
+ *
+ */
@@ -0,0 +1,258 @@
+/**
+ * @file radio.hxx
+ *
+ * @brief Event driven operation of one RFM69 module.
+ *
+ * Radio binds an RFM69 driver instance to the event loop: packets are read when
+ * DIO0 signals PayloadReady, downlink packets are sent with CSMA backoff and
+ * PacketSent completion handled by timerfds and DIO0 as well. An optional
+ * watchdog checks the health of the module and recovers it.
+ */
+
+#ifndef RADIO_HXX_
+#define RADIO_HXX_
+
+#include <stdint.h>
+
+#include "rfm69.hxx"
+#include "frame.hxx"
+#include "eventloop.hxx"
+#include "gpioedge.hxx"
+#include "pollbackoff.hxx"
+
+/** @addtogroup Radio
+ * @{
+ */
+#define RADIO_TX_QUEUE        8   ///< Downlink packets that can be queued
+#define RADIO_TX_TIMEOUT      100 ///< Maximum time until PacketSent [ms]
+#define RADIO_CSMA_TIMEOUT    500 ///< Maximum time to wait for a free channel [ms]
+#define RADIO_CONFIG_WAIT     200 ///< Maximum time to wait for a quiet gap to reconfigure [ms]
+#define RADIO_WATCHDOG_SYNC   2   ///< Checks in a row with SyncAddressMatch but no packet: RX stuck
+#define RADIO_WATCHDOG_READY  2   ///< Checks in a row not ready in RX mode (not just restarting): RX stuck
+#define RADIO_POLL_RSSI       50  ///< Rssi without SyncAddressMatch for this long while polling: noise [ms]
+#define RADIO_POLL_NOISE      1000 ///< Rssi alone is ignored this long while polling in noise [ms]
+#define RADIO_WATCHDOG_SILENCE 900000 ///< No packet for this long while the channel is busy: RX stuck [ms]
+
+class Radio;
+
+/** Per radio counters. */
+typedef struct
+{
+  unsigned int rxFrames;    //!< Packets received
+  unsigned int rxBytes;     //!< Payload bytes received
+  unsigned int txFrames;    //!< Packets sent
+  unsigned int txFailed;    //!< Packets that did not leave within RADIO_TX_TIMEOUT
+  unsigned int txDropped;   //!< Packets rejected because the TX queue was full
+  unsigned int rxNoBuffer;  //!< Packets dropped because the frame pool was exhausted
+  unsigned int irqLost;     //!< DIO0 edges the kernel dropped (GPIO character device only)
+  unsigned int noiseRestarts; //!< RX restarts of the poller because of Rssi without a sync word
+  unsigned int faultVersion; //!< Watchdog checks: version register did not read 0x24
+  unsigned int faultDrift;  //!< Watchdog checks: configuration differed from the shadow copy
+  unsigned int faultStuck;  //!< Watchdog checks: receiver stuck (not ready, sync match or silence)
+  unsigned int faultOverrun; //!< Watchdog checks: FIFO overrun
+  unsigned int rxRestarts;  //!< Recovery: RX restarts with drifted registers rewritten
+  unsigned int reinits;     //!< Recovery: re-initializations
+  unsigned int resets;      //!< Recovery: resets through the RESET line
+  unsigned int recovered;   //!< Faults recovered
+  unsigned int mttrLast;    //!< Time to recover of the last fault [ms]
+  unsigned int mttrMax;     //!< Longest time to recover [ms]
+  unsigned int mttrTotal;   //!< Sum of the times to recover [ms]
+} RadioStats;
+
+/**
+ * Callbacks of Radio towards the application.
+ */
+class RadioListener
+{
+public:
+  virtual ~RadioListener()
+  {
+  }
+
+  /**
+   * Called for every received packet.
+   *
+   * @param radio The radio that received the packet
+   * @param frame Pooled frame with payload and metadata; take a reference with
+   *        frameRef() to keep it beyond the call
+   */
+  virtual void radioReceive(Radio* radio, Frame* frame) = 0;
+
+  /**
+   * Called when a downlink packet has left the air or timed out.
+   */
+  virtual void radioSent(Radio* radio, bool success)
+  {
+  }
+
+  /**
+   * Called when a configuration change of reconfigure() has been applied.
+   *
+   * @param radio The radio
+   * @param registers Number of registers that changed; -1 if the output power is not
+   *        supported by the module (the other settings have been applied)
+   * @param downtime Time the receiver was not ready [us]
+   */
+  virtual void radioConfigured(Radio* radio, int registers, unsigned int downtime)
+  {
+  }
+};
+
+/** Event driven wrapper of an RFM69 module. */
+class Radio : public EventHandler
+{
+public:
+  Radio(uint8_t id, RFM69* rfm69, RadioListener* listener);
+  virtual ~Radio();
+
+  bool start(EventLoop* loop, int dio0Gpio, int dio1Gpio = -1, const char* gpioChip = GPIOEDGE_DEFAULT_CHIP);
+
+  void stop();
+
+  void restart();
+
+  int queue(const void* data, unsigned int dataLength);
+
+  void tune(unsigned int frequency, const uint8_t* syncWord = 0, unsigned int syncLength = 0);
+
+  void reconfigure(const RFM69Profile& profile, int8_t powerDBm);
+
+  bool reinit(bool reset = false);
+
+  /**
+   * Check if a downlink packet is being sent (including CSMA backoff).
+   */
+  bool isTransmitting()
+  {
+    return RADIO_TX_IDLE != _txState;
+  }
+
+  /**
+   * Get the carrier frequency set with tune() [Hz]; 0 if unknown.
+   */
+  unsigned int getFrequency()
+  {
+    return _frequency;
+  }
+
+  void handleEvent(int fd, uint32_t events);
+
+  /**
+   * Enable/disable the CSMA/CA (carrier sense) algorithm before sending a packet.
+   */
+  void setCSMA(bool enable)
+  {
+    _csmaEnabled = enable;
+  }
+
+  /**
+   * Check the health of the module periodically; see check(). Call before start().
+   *
+   * @param interval Check interval [ms]; 0 disables the watchdog
+   */
+  void setWatchdog(unsigned int interval)
+  {
+    _watchdogInterval = interval;
+  }
+
+  /**
+   * Set the listener for received packets and TX completion.
+   */
+  void setListener(RadioListener* listener)
+  {
+    _listener = listener;
+  }
+
+  /**
+   * Get the tag of this radio; frames of this radio carry it.
+   */
+  uint8_t getId()
+  {
+    return _id;
+  }
+
+  /**
+   * Get the counters of this radio.
+   */
+  const RadioStats& getStats()
+  {
+    _stats.irqLost = _dio0.getLost();
+    return _stats;
+  }
+
+  /**
+   * Get the driver instance.
+   */
+  RFM69* getRFM69()
+  {
+    return _rfm69;
+  }
+
+private:
+  typedef enum
+  {
+    RADIO_TX_IDLE = 0,
+    RADIO_TX_BACKOFF,
+    RADIO_TX_ACTIVE
+  } TxState;
+
+  void service();
+
+  void poll();
+
+  void applyConfig();
+
+  void check();
+
+  void recover(bool drift, bool version);
+
+  void kickTx();
+
+  void finishTx(bool success);
+
+  uint8_t _id;
+  RadioStats _stats;
+  unsigned int _frequency;
+  RFM69* _rfm69;
+  RadioListener* _listener;
+  EventLoop* _loop;
+  GPIOEdge _dio0;
+  GPIOEdge _dio1;
+  int _pollTimer;
+  int _backoffTimer;
+  int _txTimer;
+  int _configTimer;
+  int _watchdogTimer;
+  unsigned int _watchdogInterval;
+  unsigned int _recoveryLevel;
+  uint32_t _faultStart;
+  unsigned int _syncChecks;
+  unsigned int _readyChecks;
+  unsigned int _watchFrames;
+  uint32_t _lastFrame;
+  unsigned int _busyChecks;
+  unsigned int _silentChecks;
+  uint64_t _rxEdge;
+  PollBackoff _poll;
+  uint32_t _rssiStart;
+  bool _rssiNoise;
+  bool _csmaEnabled;
+  TxState _txState;
+  uint32_t _csmaStart;
+  bool _csmaRunning;
+  uint8_t _txQueue[RADIO_TX_QUEUE][RFM69_MAX_PAYLOAD];
+  uint8_t _txLength[RADIO_TX_QUEUE];
+  unsigned int _txHead;
+  unsigned int _txCount;
+  uint8_t _discard[RFM69_MAX_PAYLOAD];
+  RFM69Profile _config;
+  int8_t _configPower;
+  bool _configPending;
+  uint32_t _configStart;
+};
+
+/** @}
+ *
+ */
+
+#endif /* RADIO_HXX_ */
@@ -0,0 +1,562 @@
+/**
+ * @file radioactor.cxx
+ *
+ * @brief Dedicated radio thread that owns all RFM69 modules.
+ */
+
+/** @addtogroup Radio
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "radioactor.hxx"
+#include "realtime.hxx"
+#include "metrics.hxx"
+
+/**
+ * Radio actor constructor.
+ *
+ * @param listener Receives frames and TX completions in the thread of the main event loop
+ */
+RadioActor::RadioActor(RadioListener* listener)
+{
+  _listener = listener;
+  _mainLoop = 0;
+  _running = false;
+  _priority = 0;
+  _cpu = -1;
+  _commandFd = -1;
+  _eventFd = -1;
+  _radioCount = 0;
+  memset(&_stats, 0, sizeof(_stats));
+  memset(_snapshots, 0, sizeof(_snapshots));
+
+  for (uint32_t i = 0; i < RADIOACTOR_COMMANDS; i++)
+    _commands[i].sequence = i;
+  _enqueue = 0;
+  _dequeue = 0;
+
+  _eventHead = 0;
+  _eventTail = 0;
+}
+
+RadioActor::~RadioActor()
+{
+  stop();
+}
+
+/**
+ * Add a radio. Its index is the one used for commands.
+ *
+ * @return true on success; false if there are too many radios.
+ */
+bool RadioActor::addRadio(Radio* radio)
+{
+  if (_radioCount >= RADIOACTOR_MAX_RADIOS)
+    return false;
+
+  radio->setListener(this);
+  _radios[_radioCount] = radio;
+  publish(_radioCount);
+  _radioCount++;
+
+  return true;
+}
+
+/**
+ * Start the radio thread. From now on the radios must not be used directly.
+ *
+ * @param loop Main event loop; the listener is called in its thread
+ * @return true on success
+ */
+bool RadioActor::start(EventLoop* loop)
+{
+  _commandFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  _eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (_commandFd < 0 || _eventFd < 0)
+  {
+    perror("eventfd");
+    return false;
+  }
+
+  _mainLoop = loop;
+  _mainLoop->add(_eventFd, EPOLLIN, this);
+  _loop.add(_commandFd, EPOLLIN, this);
+
+  if (0 != pthread_create(&_thread, 0, thread, this))
+  {
+    perror("pthread_create");
+    return false;
+  }
+
+  pthread_setname_np(_thread, "rfm-radio");
+  _running = true;
+
+  return true;
+}
+
+/**
+ * Stop the radio thread and wait for it. Afterwards the radios may be used
+ * directly again, e.g. to put them to sleep.
+ */
+void RadioActor::stop()
+{
+  if (_running)
+  {
+    uint32_t position;
+    CommandCell* cell;
+
+    // the queue may be full for a moment
+    while (0 == (cell = claim(&position)))
+      usleep(1000);
+
+    cell->command.type = RADIOACTOR_STOP;
+    post(cell, position);
+
+    pthread_join(_thread, 0);
+    _running = false;
+  }
+
+  if (0 != _mainLoop)
+  {
+    dispatchEvents();
+    _mainLoop->remove(_eventFd);
+    _loop.remove(_commandFd);
+    _mainLoop = 0;
+  }
+
+  if (_commandFd >= 0)
+    close(_commandFd);
+  if (_eventFd >= 0)
+    close(_eventFd);
+  _commandFd = _eventFd = -1;
+}
+
+/**
+ * Queue a packet for transmission on a radio.
+ *
+ * @return 0 on success; -1 if the command queue is full or the packet is invalid.
+ */
+int RadioActor::send(uint8_t radio, const void* data, unsigned int dataLength)
+{
+  if (radio >= _radioCount || 0 == dataLength || dataLength > RFM69_MAX_PAYLOAD)
+    return -1;
+
+  uint32_t position;
+  CommandCell* cell = claim(&position);
+  if (0 == cell)
+    return -1;
+
+  cell->command.type = RADIOACTOR_SEND;
+  cell->command.radio = radio;
+  cell->command.length = dataLength;
+  memcpy(cell->command.data, data, dataLength);
+  post(cell, position);
+
+  return 0;
+}
+
+/**
+ * Switch a radio to another channel; see Radio::tune().
+ *
+ * @return 0 on success; -1 if the command queue is full.
+ */
+int RadioActor::tune(uint8_t radio, unsigned int frequency, const uint8_t* syncWord, unsigned int syncLength)
+{
+  if (radio >= _radioCount || syncLength > 8)
+    return -1;
+
+  uint32_t position;
+  CommandCell* cell = claim(&position);
+  if (0 == cell)
+    return -1;
+
+  cell->command.type = RADIOACTOR_TUNE;
+  cell->command.radio = radio;
+  cell->command.frequency = frequency;
+  cell->command.syncLength = syncWord ? syncLength : 0;
+  if (0 != syncWord)
+    memcpy(cell->command.sync, syncWord, syncLength);
+  post(cell, position);
+
+  return 0;
+}
+
+/**
+ * Execute a function with a radio on the radio thread, e.g. to reconfigure it.
+ *
+ * @param radio Index of the radio
+ * @param function Called in the radio thread
+ * @param context Passed to the function; must stay valid until it ran
+ * @return 0 on success; -1 if the command queue is full.
+ */
+int RadioActor::call(uint8_t radio, RadioFunction function, void* context)
+{
+  if (radio >= _radioCount)
+    return -1;
+
+  uint32_t position;
+  CommandCell* cell = claim(&position);
+  if (0 == cell)
+    return -1;
+
+  cell->command.type = RADIOACTOR_CALL;
+  cell->command.radio = radio;
+  cell->command.function = function;
+  cell->command.context = context;
+  post(cell, position);
+
+  return 0;
+}
+
+/**
+ * Get the state of a radio as last published by the radio thread.
+ *
+ * @return true on success; false if there is no such radio.
+ */
+bool RadioActor::getSnapshot(uint8_t radio, RadioSnapshot* snapshot)
+{
+  if (radio >= _radioCount)
+    return false;
+
+  PublishedSnapshot* published = &_snapshots[radio];
+  uint32_t seq;
+
+  do
+  {
+    seq = __atomic_load_n(&published->seq, __ATOMIC_ACQUIRE);
+    *snapshot = published->snapshot;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) || seq != __atomic_load_n(&published->seq, __ATOMIC_RELAXED));
+
+  return true;
+}
+
+/**
+ * Get the actor counters.
+ */
+RadioActorStats RadioActor::getStats()
+{
+  RadioActorStats stats;
+
+  stats.commands = __atomic_load_n(&_stats.commands, __ATOMIC_RELAXED);
+  stats.rejected = __atomic_load_n(&_stats.rejected, __ATOMIC_RELAXED);
+  stats.events = __atomic_load_n(&_stats.events, __ATOMIC_RELAXED);
+  stats.eventsDropped = __atomic_load_n(&_stats.eventsDropped, __ATOMIC_RELAXED);
+
+  return stats;
+}
+
+/**
+ * Command queue (radio thread) and event ring (main thread) notifications.
+ */
+void RadioActor::handleEvent(int fd, uint32_t events)
+{
+  uint64_t value;
+
+  if (fd == _eventFd)
+  {
+    read(_eventFd, &value, sizeof(value));
+    dispatchEvents();
+    return;
+  }
+
+  read(_commandFd, &value, sizeof(value));
+
+  // single consumer: only this thread moves _dequeue
+  metricsObserve(METRIC_COMMAND_QUEUE, 0, __atomic_load_n(&_enqueue, __ATOMIC_RELAXED) - _dequeue);
+
+  while (true)
+  {
+    CommandCell* cell = &_commands[_dequeue & (RADIOACTOR_COMMANDS - 1)];
+    uint32_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+
+    if ((int32_t)(sequence - (_dequeue + 1)) < 0)
+      break;
+
+    Command command = cell->command;
+    __atomic_store_n(&cell->sequence, _dequeue + RADIOACTOR_COMMANDS, __ATOMIC_RELEASE);
+    _dequeue++;
+
+    execute(command);
+  }
+
+  for (unsigned int i = 0; i < _radioCount; i++)
+    publish(i);
+}
+
+/**
+ * Pass a received frame to the main thread (radio thread).
+ */
+void RadioActor::radioReceive(Radio* radio, Frame* frame)
+{
+  unsigned int index = indexOf(radio);
+  Event* event = claimEvent(index);
+  if (0 == event)
+    return;
+
+  event->type = RADIOACTOR_RECEIVED;
+  event->radio = index;
+  event->success = true;
+
+  // the pools are per thread: this is the one copy on the way to the main thread
+  memcpy(&event->frame, frame, sizeof(Frame) - FRAME_MAX_PAYLOAD + frame->length);
+  frameStage(&event->frame, FRAME_STAGE_ENQUEUE, frameClock());
+
+  pushEvent(index);
+}
+
+/**
+ * Pass a TX completion to the main thread (radio thread).
+ */
+void RadioActor::radioSent(Radio* radio, bool success)
+{
+  unsigned int index = indexOf(radio);
+  Event* event = claimEvent(index);
+  if (0 == event)
+    return;
+
+  event->type = RADIOACTOR_SENT;
+  event->radio = index;
+  event->success = success;
+  event->frame.length = 0;
+
+  pushEvent(index);
+}
+
+/**
+ * Pass the completion of a configuration change to the main thread (radio thread).
+ */
+void RadioActor::radioConfigured(Radio* radio, int registers, unsigned int downtime)
+{
+  unsigned int index = indexOf(radio);
+  Event* event = claimEvent(index);
+  if (0 == event)
+    return;
+
+  event->type = RADIOACTOR_CONFIGURED;
+  event->radio = index;
+  event->success = true;
+  event->registers = registers;
+  event->downtime = downtime;
+  event->frame.length = 0;
+
+  pushEvent(index);
+}
+
+/**
+ * Thread function: run the radio event loop until a stop command arrives.
+ */
+void* RadioActor::thread(void* context)
+{
+  RadioActor* actor = (RadioActor*) context;
+
+  if (actor->_priority > 0 || actor->_cpu >= 0)
+  {
+    realtimeSetThread(actor->_priority, actor->_cpu);
+    realtimePrefaultStack();
+  }
+
+  actor->_loop.run();
+
+  return 0;
+}
+
+/**
+ * Reserve a cell of the command queue (any thread).
+ *
+ * Bounded multi producer queue: every cell carries a sequence number that tells
+ * producers and the consumer whose turn it is, so producers only contend on the
+ * enqueue position and never wait for each other.
+ *
+ * @param position Position of the claimed cell, to be passed to post()
+ * @return The cell; 0 if the queue is full.
+ */
+RadioActor::CommandCell* RadioActor::claim(uint32_t* position)
+{
+  uint32_t pos = __atomic_load_n(&_enqueue, __ATOMIC_RELAXED);
+
+  while (true)
+  {
+    CommandCell* cell = &_commands[pos & (RADIOACTOR_COMMANDS - 1)];
+    uint32_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    int32_t diff = (int32_t)(sequence - pos);
+
+    if (0 == diff)
+    {
+      if (__atomic_compare_exchange_n(&_enqueue, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      {
+        *position = pos;
+        return cell;
+      }
+      // pos was updated by the failed exchange
+    }
+    else if (diff < 0)
+    {
+      __atomic_add_fetch(&_stats.rejected, 1, __ATOMIC_RELAXED);
+      metricsAdd(METRIC_COMMANDS_REJECTED, 0);
+      return 0;
+    }
+    else
+    {
+      pos = __atomic_load_n(&_enqueue, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/**
+ * Hand a filled cell to the radio thread and wake it up.
+ */
+void RadioActor::post(CommandCell* cell, uint32_t position)
+{
+  __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+
+  uint64_t one = 1;
+  write(_commandFd, &one, sizeof(one));
+}
+
+/**
+ * Execute a command (radio thread).
+ */
+void RadioActor::execute(const Command& command)
+{
+  __atomic_add_fetch(&_stats.commands, 1, __ATOMIC_RELAXED);
+
+  if (RADIOACTOR_STOP == command.type)
+  {
+    _loop.stop();
+    return;
+  }
+
+  Radio* radio = _radios[command.radio];
+
+  switch (command.type)
+  {
+  case RADIOACTOR_SEND:
+    radio->queue(command.data, command.length);
+    break;
+  case RADIOACTOR_TUNE:
+    radio->tune(command.frequency, command.syncLength ? command.sync : 0, command.syncLength);
+    break;
+  case RADIOACTOR_CALL:
+    command.function(radio, command.context);
+    break;
+  }
+}
+
+/**
+ * Publish the state of a radio under its sequence lock (radio thread).
+ */
+void RadioActor::publish(unsigned int index)
+{
+  PublishedSnapshot* published = &_snapshots[index];
+  Radio* radio = _radios[index];
+
+  uint32_t seq = published->seq;
+  __atomic_store_n(&published->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  published->snapshot.stats = radio->getStats();
+  published->snapshot.frequency = radio->getFrequency();
+  published->snapshot.rssi = radio->getRFM69()->getRSSI();
+  published->snapshot.fei = radio->getRFM69()->getFEI();
+  published->snapshot.pool = framePoolStats();
+
+  __atomic_store_n(&published->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Get the index of a radio.
+ */
+unsigned int RadioActor::indexOf(Radio* radio)
+{
+  for (unsigned int i = 0; i < _radioCount; i++)
+  {
+    if (_radios[i] == radio)
+      return i;
+  }
+
+  return 0;
+}
+
+/**
+ * Reserve the next slot of the ring to the main thread (radio thread, single
+ * producer). The event is filled in place and handed over with pushEvent().
+ *
+ * @param radio Index of the radio
+ * @return The slot; 0 if the ring is full and the event is lost.
+ */
+RadioActor::Event* RadioActor::claimEvent(unsigned int radio)
+{
+  uint32_t head = _eventHead;
+  uint32_t depth = head - __atomic_load_n(&_eventTail, __ATOMIC_ACQUIRE);
+
+  metricsObserve(METRIC_EVENT_QUEUE, 0, depth);
+
+  if (depth >= RADIOACTOR_EVENTS)
+  {
+    __atomic_add_fetch(&_stats.eventsDropped, 1, __ATOMIC_RELAXED);
+    metricsAdd(METRIC_EVENTS_DROPPED, radio);
+    return 0;
+  }
+
+  return &_events[head & (RADIOACTOR_EVENTS - 1)];
+}
+
+/**
+ * Hand the slot reserved with claimEvent() to the main thread (radio thread).
+ *
+ * @param radio Index of the radio
+ */
+void RadioActor::pushEvent(unsigned int radio)
+{
+  __atomic_store_n(&_eventHead, _eventHead + 1, __ATOMIC_RELEASE);
+
+  publish(radio);
+
+  uint64_t one = 1;
+  write(_eventFd, &one, sizeof(one));
+}
+
+/**
+ * Hand all events of the ring to the listener (main thread, single consumer).
+ *
+ * The frame stays in its ring slot during the call; the listener takes a
+ * reference (which copies it into the pool of the main thread) to keep it.
+ */
+void RadioActor::dispatchEvents()
+{
+  uint32_t tail = _eventTail;
+
+  while (tail != __atomic_load_n(&_eventHead, __ATOMIC_ACQUIRE))
+  {
+    Event* event = &_events[tail & (RADIOACTOR_EVENTS - 1)];
+
+    if (0 != _listener && event->radio < _radioCount)
+    {
+      if (RADIOACTOR_RECEIVED == event->type)
+      {
+        frameStage(&event->frame, FRAME_STAGE_DEQUEUE, frameClock());
+        _listener->radioReceive(_radios[event->radio], &event->frame);
+      }
+      else if (RADIOACTOR_CONFIGURED == event->type)
+        _listener->radioConfigured(_radios[event->radio], event->registers, event->downtime);
+      else
+        _listener->radioSent(_radios[event->radio], event->success);
+    }
+
+    __atomic_add_fetch(&_stats.events, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&_eventTail, ++tail, __ATOMIC_RELEASE);
+  }
+}
+
+/** @}
+ *
+ */
@@ -0,0 +1,220 @@
+/**
+ * @file radioactor.hxx
+ *
+ * @brief Dedicated radio thread that owns all RFM69 modules.
+ *
+ * The RFM69 driver has no locking: its mode, RX buffer and SPI file descriptor
+ * must only be touched by one thread. The actor runs the radios (and everything
+ * else that talks SPI, like the scanner) in an event loop of its own thread.
+ * Other threads post commands into a lock-free multi producer queue and never
+ * block on the radio, not even during a long transmission.
+ *
+ * Results travel back without locks as well: received frames, TX completions and
+ * applied configuration changes are passed through a single producer ring to the
+ * thread of the main event loop and handed to the listener there; counters are
+ * published per radio under a sequence lock. Frame pools are per thread, so a
+ * received frame is copied once, from the pool of the radio thread straight into
+ * its ring slot; a listener that keeps it takes a reference, which copies it into
+ * the pool of the main thread. The listener may only call getId()
+ * on the Radio it is passed.
+ */
+
+#ifndef RADIOACTOR_HXX_
+#define RADIOACTOR_HXX_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "radio.hxx"
+#include "frame.hxx"
+#include "eventloop.hxx"
+
+/** @addtogroup Radio
+ * @{
+ */
+#define RADIOACTOR_MAX_RADIOS   4   ///< Radios per actor
+#define RADIOACTOR_COMMANDS     64  ///< Size of the command queue; must be a power of two
+#define RADIOACTOR_EVENTS       64  ///< Size of the event ring; must be a power of two
+
+/** Function executed on the radio thread, see RadioActor::call(). */
+typedef void (*RadioFunction)(Radio* radio, void* context);
+
+/** Radio state published by the radio thread. */
+typedef struct
+{
+  RadioStats stats;         //!< Counters of the radio
+  unsigned int frequency;   //!< Carrier frequency [Hz]
+  int rssi;                 //!< Last RSSI [dBm]
+  int fei;                  //!< Last frequency error [Hz]
+  FramePoolStats pool;      //!< Frame pool of the radio thread (shared by its radios)
+} RadioSnapshot;
+
+/** Actor counters. */
+typedef struct
+{
+  unsigned int commands;        //!< Commands executed
+  unsigned int rejected;        //!< Commands rejected because the queue was full
+  unsigned int events;          //!< Events passed to the listener
+  unsigned int eventsDropped;   //!< Events lost because the ring was full
+} RadioActorStats;
+
+/** Runs radios in a thread of their own. */
+class RadioActor : public EventHandler, public RadioListener
+{
+public:
+  RadioActor(RadioListener* listener);
+  virtual ~RadioActor();
+
+  bool addRadio(Radio* radio);
+
+  /**
+   * Get the event loop of the radio thread. Radios and scanners are started on it
+   * before start().
+   */
+  EventLoop* getLoop()
+  {
+    return &_loop;
+  }
+
+  /**
+   * Get the number of radios.
+   */
+  unsigned int getCount()
+  {
+    return _radioCount;
+  }
+
+  /**
+   * Run the radio thread under SCHED_FIFO; see realtime.hxx. Call before start().
+   *
+   * @param priority SCHED_FIFO priority (1..99); 0 for normal scheduling
+   * @param cpu CPU to pin the thread to; -1 for any
+   */
+  void setRealtime(int priority, int cpu = -1)
+  {
+    _priority = priority;
+    _cpu = cpu;
+  }
+
+  bool start(EventLoop* loop);
+
+  void stop();
+
+  int send(uint8_t radio, const void* data, unsigned int dataLength);
+
+  int tune(uint8_t radio, unsigned int frequency, const uint8_t* syncWord = 0, unsigned int syncLength = 0);
+
+  int call(uint8_t radio, RadioFunction function, void* context);
+
+  bool getSnapshot(uint8_t radio, RadioSnapshot* snapshot);
+
+  RadioActorStats getStats();
+
+  void handleEvent(int fd, uint32_t events);
+
+  void radioReceive(Radio* radio, Frame* frame);
+
+  void radioSent(Radio* radio, bool success);
+
+  void radioConfigured(Radio* radio, int registers, unsigned int downtime);
+
+private:
+  typedef enum
+  {
+    RADIOACTOR_SEND = 0,
+    RADIOACTOR_TUNE,
+    RADIOACTOR_CALL,
+    RADIOACTOR_STOP
+  } CommandType;
+
+  typedef struct
+  {
+    uint8_t type;
+    uint8_t radio;
+    uint8_t length;
+    uint8_t syncLength;
+    unsigned int frequency;
+    RadioFunction function;
+    void* context;
+    uint8_t sync[8];
+    uint8_t data[RFM69_MAX_PAYLOAD];
+  } Command;
+
+  typedef struct
+  {
+    uint32_t sequence;
+    Command command;
+  } CommandCell;
+
+  typedef enum
+  {
+    RADIOACTOR_RECEIVED = 0,
+    RADIOACTOR_SENT,
+    RADIOACTOR_CONFIGURED
+  } EventType;
+
+  typedef struct
+  {
+    uint8_t type;
+    uint8_t radio;
+    bool success;
+    int registers;
+    unsigned int downtime;
+    Frame frame;
+  } Event;
+
+  typedef struct
+  {
+    uint32_t seq;
+    RadioSnapshot snapshot;
+  } PublishedSnapshot;
+
+  static void* thread(void* context);
+
+  CommandCell* claim(uint32_t* position);
+
+  void post(CommandCell* cell, uint32_t position);
+
+  void execute(const Command& command);
+
+  void publish(unsigned int index);
+
+  unsigned int indexOf(Radio* radio);
+
+  Event* claimEvent(unsigned int radio);
+
+  void pushEvent(unsigned int radio);
+
+  void dispatchEvents();
+
+  RadioListener* _listener;
+  EventLoop _loop;
+  EventLoop* _mainLoop;
+  pthread_t _thread;
+  bool _running;
+  int _priority;
+  int _cpu;
+  int _commandFd;
+  int _eventFd;
+  Radio* _radios[RADIOACTOR_MAX_RADIOS];
+  unsigned int _radioCount;
+  RadioActorStats _stats;
+
+  // command queue: any thread -> radio thread
+  CommandCell _commands[RADIOACTOR_COMMANDS];
+  uint32_t _enqueue __attribute__((aligned(64)));
+  uint32_t _dequeue __attribute__((aligned(64)));
+
+  // event ring: radio thread -> main thread
+  Event _events[RADIOACTOR_EVENTS];
+  uint32_t _eventHead __attribute__((aligned(64)));
+  uint32_t _eventTail __attribute__((aligned(64)));
+
+  PublishedSnapshot _snapshots[RADIOACTOR_MAX_RADIOS];
+};
+
+/** @}
+ *
+ */
+
+#endif /* RADIOACTOR_HXX_ */
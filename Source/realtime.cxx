@@ -0,0 +1,95 @@
+/**
+ * @file realtime.cxx
+ *
+ * @brief Real-time scheduling of the radio thread.
+ */
+
+/** @addtogroup Realtime
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "realtime.hxx"
+
+/**
+ * Lock all current and future memory of the process into RAM.
+ *
+ * @return true on success (needs CAP_IPC_LOCK or a sufficient RLIMIT_MEMLOCK)
+ */
+bool realtimeLockMemory()
+{
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+  {
+    perror("mlockall");
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Touch the stack of the calling thread, so it is mapped (and locked) before
+ * the first deep call path needs it.
+ *
+ * @param size Number of bytes below the current stack pointer
+ */
+void realtimePrefaultStack(size_t size)
+{
+  volatile uint8_t* stack = (volatile uint8_t*) __builtin_alloca(size);
+
+  // one write per page is enough
+  for (size_t i = 0; i < size; i += 4096)
+    stack[i] = 0;
+}
+
+/**
+ * Schedule the calling thread with SCHED_FIFO and pin it to a CPU.
+ *
+ * @param priority SCHED_FIFO priority (1..99); 0 keeps the normal policy
+ * @param cpu CPU to run on; -1 keeps the affinity
+ * @return true on success
+ */
+bool realtimeSetThread(int priority, int cpu)
+{
+  bool ok = true;
+
+  if (cpu >= 0)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (0 != ret)
+    {
+      fprintf(stderr, "CPU %d: %s\n", cpu, strerror(ret));
+      ok = false;
+    }
+  }
+
+  if (priority > 0)
+  {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+
+    int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (0 != ret)
+    {
+      fprintf(stderr, "SCHED_FIFO %d: %s\n", priority, strerror(ret));
+      ok = false;
+    }
+  }
+
+  return ok;
+}
+
+/** @}
+ *
+ */
@@ -0,0 +1,33 @@
+/**
+ * @file realtime.hxx
+ *
+ * @brief Real-time scheduling of the radio thread.
+ *
+ * On a loaded board a normally scheduled thread can be woken up late enough to
+ * miss the window in which the FIFO has to be drained. The radio thread can be
+ * run under SCHED_FIFO, pinned to a (preferably isolated, isolcpus=) CPU, with
+ * all memory of the process locked and its stack prefaulted, so neither the
+ * scheduler nor page faults delay it.
+ */
+
+#ifndef REALTIME_HXX_
+#define REALTIME_HXX_
+
+#include <stddef.h>
+
+/** @addtogroup Realtime
+ * @{
+ */
+#define REALTIME_STACK_PREFAULT   (256 * 1024) ///< Stack prefaulted per real-time thread [bytes]
+
+bool realtimeLockMemory();
+
+void realtimePrefaultStack(size_t size = REALTIME_STACK_PREFAULT);
+
+bool realtimeSetThread(int priority, int cpu);
+
+/** @}
+ *
+ */
+
+#endif /* REALTIME_HXX_ */
@@ -30,11 +30,6 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <getopt.h>
-#include <fcntl.h>
-#include <sys/ioctl.h>
-#include <linux/types.h>
-#include <linux/spi/spidev.h>
-#include <wiringPi.h>
 #include <inttypes.h>
 #include <math.h>
 #include <time.h>
@@ -47,52 +42,8 @@
 #define TIMEOUT_CSMA_READY    500 ///< Maximum CSMA wait time for channel free detection [ms]
 #define CSMA_RSSI_THRESHOLD   -85 ///< If RSSI value is smaller than this, consider channel as free [dBm]
 
-/** RFM69 base configuration after init().
- *
- * Change these to your needs or call setCustomConfig() after module init.
- */
-static const uint8_t rfm69_base_config[][2] =
-{
-            {0x01, 0x04}, // RegOpMode: Standby Mode
-            {0x02, 0x00}, // RegDataModul: Packet mode, FSK, no shaping
-            {0x03, RF_BITRATEMSB_9600},
-            {0x04, RF_BITRATELSB_9600},
-            {0x05, RF_FDEVMSB_20000},
-            {0x06, RF_FDEVLSB_20000},
-            {0x07, 0xD9}, // RegFrfMsb: 868,3 MHz
-            {0x08, 0x13}, // RegFrfMid
-            {0x09, 0x33}, // RegFrfLsb
-            {0x18, RF_LNA_GAINSELECT_AUTO},
-            {0x19, RF_RXBW_DCCFREQ_010 | RF_RXBW_MANT_20 | RF_RXBW_EXP_3}, // 20/2 -> 100khz
-            {0x2C, 0x00}, // RegPreambleMsb: 3 bytes preamble
-            {0x2D, 0x06}, // RegPreambleLsb
-            {0x2E, RF_SYNC_ON | RF_SYNC_SIZE_4}, // RegSyncConfig: Enable sync word, 2 bytes sync word
-            {0x2F, 0xDE}, // RegSyncValue1: 0xDEADBEEF
-            {0x30, 0xAD}, // RegSyncValue2
-            {0x31, 0xBE}, // RegSyncValue3
-            {0x32, 0xEF}, // RegSyncValue4
-            {0x37, 0xD0}, // RegPacketConfig1: Variable length, CRC on, whitening
-            {0x38, 0x40}, // RegPayloadLength: 64 bytes max payload
-            {0x3C, 0x8F}, // RegFifoThresh: TxStart on FifoNotEmpty, 15 bytes FifoLevel
-            {0x58, 0x1B}, // RegTestLna: Normal sensitivity mode
-            {0x6F, 0x30}, // RegTestDagc: Improved margin, use if AfcLowBetaOn=0 (default)
-
-};
-
-// Clock constants. DO NOT CHANGE THESE!
-#define RFM69_XO               32000000    ///< Internal clock frequency [Hz]
-#define RFM69_FSTEP            61
-
-
-// Device settings
-static const char *device = "/dev/spidev0.0";
-static uint8_t spi_mode = 0;
-static uint8_t spi_bits = 8; // Must be 8-bit, as that's the only mode the SPI driver support
-static uint32_t spi_speed = 500000; // .5 MHz is the maximum rate the RF12 support (??)
-// Going above this value gives wrong readings, and errors
-// ...^^^ is this really true? it probably won't even reaching
-//    the speed of 2.5 MHz...
-static uint16_t spi_delay = 0;    // Must be 0, we don't want a delay
+/** Register image of the base profile. */
+static constexpr RFM69Image rfm69_base_image = rfm69Image(rfm69_base_profile);
 
 //
 // Helper function for fatal errors
@@ -103,180 +54,253 @@ void pabort(const char *s)
   abort();
 }
 
-//
-// rf12_xferCmd
-//
-// Full duplex, always sends and receives 2 bytes at the same time.
-//
-uint16_t rf12_xferCmd(int fd, uint16_t cmd)
+/**
+ * RFM69 constructor. Use init() to start working with the RFM69 module.
+ *
+ * Several instances can be used at the same time, one per SPI chip select.
+ *
+ * @param spi The SPI transport, SPIDev or the simulator RFM69Sim; not deleted by the driver
+ * @param highPowerDevice Set to true, if this is a RFM69Hxx device (default: false)
+ */
+RFM69::RFM69(SPIBase* spi, bool highPowerDevice)
 {
-  struct spi_ioc_transfer xfer[1];
-  unsigned char tx_buf[2];
-  unsigned char rx_buf[2];
-  int status;
-
-  // Clear spi_ioc_transfer structure
-  memset(xfer, 0, sizeof(xfer));
-
-  // Store command in buffer
-  tx_buf[0] = (cmd >> 8) & 0xff;
-  tx_buf[1] = (cmd) & 0xff;
-
-  // Set up spi_ioc_transfer structure
-  // ...rf12 uses full duplex, so we receive bits the
-  //    while we're sending
-  xfer[0].tx_buf = (unsigned long) tx_buf;
-  xfer[0].rx_buf = (unsigned long) rx_buf;
-  xfer[0].len = 2;
-  xfer[0].delay_usecs = spi_delay;
-  xfer[0].speed_hz = spi_speed;
-  xfer[0].bits_per_word = spi_bits;
-
-  status = ioctl(fd, SPI_IOC_MESSAGE(1), xfer);
-  if (status < 0)
-  {
-    pabort("SPI_IOC_MESSAGE");
-  }
-
-  return (rx_buf[0] << 8) | rx_buf[1];
+  defaults(highPowerDevice);
 
+  _spi = spi;
 }
 
-uint16_t rf12_xferByte(int fd, uint8_t cmd)
+RFM69::~RFM69()
 {
-  struct spi_ioc_transfer xfer[1];
-  unsigned char tx_buf[1];
-  unsigned char rx_buf[1];
-  int status;
-
-  // Clear spi_ioc_transfer structure
-  memset(xfer, 0, sizeof(xfer));
-
-  // Store command in buffer
-  tx_buf[0] = cmd;
-
-  xfer[0].tx_buf = (unsigned long) tx_buf;
-  xfer[0].rx_buf = (unsigned long) rx_buf;
-  xfer[0].len = 1;
-  xfer[0].delay_usecs = spi_delay;
-  xfer[0].speed_hz = spi_speed;
-  xfer[0].bits_per_word = spi_bits;
-
-  status = ioctl(fd, SPI_IOC_MESSAGE(1), xfer);
-  if (status < 0)
-  {
-    pabort("SPI_IOC_MESSAGE");
-  }
-
-  return rx_buf[0];
 }
 
 /**
- * RFM69 default constructor. Use init() to start working with the RFM69 module.
- *
- * @param spi Pointer to a SPI device
- * @param csGPIO GPIO of /CS line (ie. GPIOA, GPIOB, ...)
- * @param csPin Pin of /CS line (eg. GPIO_Pin_1)
- * @param highPowerDevice Set to true, if this is a RFM69Hxx device (default: false)
+ * Set the members to their initial values.
  */
-RFM69::RFM69(bool highPowerDevice)
+void RFM69::defaults(bool highPowerDevice)
 {
   _init = false;
   _mode = RFM69_MODE_STANDBY;
   _highPowerDevice = highPowerDevice;
   _powerLevel = 0;
+  _powerDBm = 13;
   _rssi = -127;
   _ookEnabled = false;
   _autoReadRSSI = true;
+  _autoReadFEI = false;
+  _fei = 0;
   _dataMode = RFM69_DATA_MODE_PACKET;
   _highPowerSettings = false;
   _csmaEnabled = false;
   _rxBufferLength = 0;
+  memset(&_shadow, 0, sizeof(_shadow));
+}
 
-  _fd = open(device, O_RDWR);
-  if (_fd < 0)
-    pabort("Can't open device");
-
-  int _ret = ioctl(_fd, SPI_IOC_WR_MODE, &spi_mode);
-  if (_ret == -1)
-    pabort("Can't set SPI mode");
+/**
+ * Reset the RFM69 module using the external reset line of the transport.
+ * All registers return to their reset values; call init() afterwards.
+ *
+ * @return false if no reset line is wired.
+ */
+bool RFM69::reset()
+{
+  if (false == _spi->reset())
+    return false;
 
-  _ret = ioctl(_fd, SPI_IOC_RD_MODE, &spi_mode);
-  if (_ret == -1)
-    pabort("Can't set SPI mode");
+  _init = false;
+  _mode = RFM69_MODE_STANDBY;
+  memset(&_shadow, 0, sizeof(_shadow));
 
-  // Bits per word
-  _ret = ioctl(_fd, SPI_IOC_WR_BITS_PER_WORD, &spi_bits);
-  if (_ret == -1)
-    pabort("Can't set bits per word");
+  return true;
+}
 
-  _ret = ioctl(_fd, SPI_IOC_RD_BITS_PER_WORD, &spi_bits);
-  if (_ret == -1)
-    pabort("Can't set bits per word");
+/**
+ * Initialize the RFM69 module.
+ * A base configuration is set and the module is put in standby mode.
+ *
+ * @return Always true
+ */
+bool RFM69::init()
+{
+  // standby, then the base configuration
+  writeRegister(0x01, 0x04);
+  _mode = RFM69_MODE_STANDBY;
+  writeImage(rfm69_base_image);
 
-  // Max speed hz
-  _ret = ioctl(_fd, SPI_IOC_WR_MAX_SPEED_HZ, &spi_speed);
-  if (_ret == -1)
-    pabort("Can't set max speed hz");
+  // set PA and OCP settings according to RF module (normal/high power)
+  setPASettings();
 
-  _ret = ioctl(_fd, SPI_IOC_RD_MAX_SPEED_HZ, &spi_speed);
-  if (_ret == -1)
-    pabort("Can't set max speed hz");
+  // clear FIFO and flags
+  clearFIFO();
 
-  printf("spi mode: %d\n", spi_mode);
-  printf("bits per word: %d\n", spi_bits);
-  printf("max speed: %d Hz (%d KHz)\n", spi_speed, spi_speed / 1000);
+  _init = true;
 
+  return _init;
 }
 
-RFM69::~RFM69()
+/**
+ * Initialize the RFM69 module if it kept its configuration, e.g. across a
+ * restart of the bridge.
+ *
+ * All registers are read in one burst and compared with the image. Only runs
+ * of registers that differ are rewritten; if none does, the module keeps its
+ * mode and the FIFO is not cleared, so a receiver that is running goes on and
+ * a packet it holds is not lost. The PA settings are applied as in init().
+ * Trigger and status bits are not compared (rfm69CompareBits()), neither is
+ * the AES key; with AES on it is written again in any case.
+ *
+ * @param image Desired configuration, e.g. rfm69Image() of the radio's profile
+ * @return Number of registers rewritten; -1 if the module does not answer with
+ *         its version, call init() then.
+ */
+int RFM69::warmInit(const RFM69Image& image)
 {
-  close(_fd);
+  // chip values of the registers of the image
+  RFM69Image current = image;
+
+  // RegOpMode..RegTestAfc in one burst
+  readBurst(0x01, current.values + 1, RFM69_IMAGE_SIZE - 1);
+  if (0x24 != current.values[0x10])
+    return -1;
+
+  uint8_t opMode = current.values[0x01];
+  bool changes = false;
+
+  for (unsigned int reg = 1; reg < RFM69_IMAGE_SIZE; reg++)
+  {
+    // bits that can't be compared are taken as they should be, so they are not rewritten either
+    uint8_t bits = rfm69CompareBits(reg);
+    current.values[reg] = (current.values[reg] & bits) | (image.values[reg] & ~bits);
+
+    if (rfm69ImageHas(image, reg) && current.values[reg] != image.values[reg])
+      changes = true;
+  }
+
+  int rewritten = 0;
+
+  if (changes)
+  {
+    // standby before the configuration changes
+    writeRegister(0x01, 0x04);
+    _mode = RFM69_MODE_STANDBY;
+
+    rewritten = writeChanges(image, current);
+    clearFIFO();
+  }
+  else
+  {
+    switch ((opMode >> 2) & 0x07)
+    {
+    case 0:
+      _mode = RFM69_MODE_SLEEP;
+      break;
+    case 2:
+      _mode = RFM69_MODE_FS;
+      break;
+    case 4:
+      _mode = RFM69_MODE_RX;
+      break;
+    default:
+      // a transmission of the previous process is not completed
+      setMode(RFM69_MODE_STANDBY);
+      break;
+    }
+  }
+
+  // RegAesKey1..16: the key can't be read back
+  if (rfm69ImageHas(image, 0x3D) && (image.values[0x3D] & 0x01))
+    writeBurst(0x3E, image.values + 0x3E, 16);
+
+  // the chip now matches the image
+  _shadow = image;
+
+  setPASettings();
+
+  _init = true;
+
+  return rewritten;
 }
 
 /**
- * Reset the RFM69 module using the external reset line.
+ * Change the configuration to a register image without re-initialization.
+ *
+ * The image is compared with the shadow copy and only the registers that differ
+ * are written; differences that are only a few registers apart go into one
+ * burst. In RX mode the receiver is restarted, so the new configuration is
+ * effective immediately; the module does not leave RX mode.
  *
- * @note Use setResetPin() before calling this function.
+ * @param image Desired configuration, e.g. rfm69Image() of a changed profile
+ * @return Number of registers that differed
  */
-//void RFM69::reset()
-//{
-//  if (0 == _resetGPIO)
-//    return;
-//
-//  _init = false;
-//
-//  // generate reset impulse
-//  GPIO_SetBits(_resetGPIO, _resetPin);
-//  HAL_Delay(1);
-//  GPIO_ResetBits(_resetGPIO, _resetPin);
-//
-//  // wait until module is ready
-//  HAL_Delay(10);
-//
-//  _mode = RFM69_MODE_STANDBY;
-//}
+int RFM69::applyImage(const RFM69Image& image)
+{
+  RFM69Image current = _shadow;
+
+  int changed = writeChanges(image, current);
+
+  // registers of the image that were not tracked so far have been written as well
+  for (unsigned int reg = 1; reg < RFM69_IMAGE_SIZE; reg++)
+  {
+    if (rfm69ImageHas(image, reg))
+      rfm69ImageSet(_shadow, reg, image.values[reg]);
+  }
+
+  if (changed > 0 && RFM69_MODE_RX == _mode)
+    restartRx();
+
+  return changed;
+}
 
 /**
- * Initialize the RFM69 module.
- * A base configuration is set and the module is put in standby mode.
+ * Write the registers of an image that differ from the current values.
  *
- * @return Always true
+ * A burst starts at a register that differs and extends over all following
+ * registers whose values are known, from the image or as current values, up
+ * to the last one that differs. Registers with unknown values are never written.
+ *
+ * @param image Desired values
+ * @param current Current values; registers not in its mask are unknown
+ * @return Number of registers that differed
  */
-bool RFM69::init()
+int RFM69::writeChanges(const RFM69Image& image, const RFM69Image& current)
 {
-  // set base configuration
-  setCustomConfig(rfm69_base_config, sizeof(rfm69_base_config) / 2);
+  uint8_t values[RFM69_IMAGE_SIZE];
+  int changed = 0;
+  unsigned int reg = 1;
 
-  // set PA and OCP settings according to RF module (normal/high power)
-  setPASettings();
+  while (reg < RFM69_IMAGE_SIZE)
+  {
+    if (false == rfm69ImageHas(image, reg)
+        || (rfm69ImageHas(current, reg) && current.values[reg] == image.values[reg]))
+    {
+      reg++;
+      continue;
+    }
 
-  // clear FIFO and flags
-  clearFIFO();
+    unsigned int first = reg;
+    unsigned int last = reg;
 
-  _init = true;
+    for (unsigned int r = first; r < RFM69_IMAGE_SIZE; r++)
+    {
+      bool desired = rfm69ImageHas(image, r);
+      bool known = rfm69ImageHas(current, r);
 
-  return _init;
+      if (false == desired && false == known)
+        break;
+
+      values[r] = desired ? image.values[r] : current.values[r];
+
+      if (desired && (false == known || current.values[r] != image.values[r]))
+      {
+        last = r;
+        changed++;
+      }
+    }
+
+    writeBurst(first, values + first, last - first + 1);
+    reg = last + 1;
+  }
+
+  return changed;
 }
 
 /**
@@ -291,13 +315,11 @@ void RFM69::setFrequency(unsigned int frequency)
   if (RFM69_MODE_RX == _mode || RFM69_MODE_TX == _mode)
     setMode(RFM69_MODE_STANDBY);
 
-  // calculate register value
-  frequency /= RFM69_FSTEP;
+  uint32_t frf = rfm69Frf(frequency);
+  uint8_t values[3] = { (uint8_t) (frf >> 16), (uint8_t) (frf >> 8), (uint8_t) frf };
 
   // set new frequency
-  writeRegister(0x07, frequency >> 16);
-  writeRegister(0x08, frequency >> 8);
-  writeRegister(0x09, frequency);
+  writeBurst(0x07, values, 3);
 }
 
 /**
@@ -312,12 +334,11 @@ void RFM69::setFrequencyDeviation(unsigned int frequency)
   if (RFM69_MODE_RX == _mode || RFM69_MODE_TX == _mode)
     setMode(RFM69_MODE_STANDBY);
 
-  // calculate register value
-  frequency /= RFM69_FSTEP;
+  uint16_t fdev = rfm69Fdev(frequency);
+  uint8_t values[2] = { (uint8_t) (fdev >> 8), (uint8_t) fdev };
 
-  // set new frequency
-  writeRegister(0x05, frequency >> 8);
-  writeRegister(0x06, frequency);
+  // set new frequency deviation
+  writeBurst(0x05, values, 2);
 }
 
 /**
@@ -332,12 +353,40 @@ void RFM69::setBitrate(unsigned int bitrate)
   if (RFM69_MODE_RX == _mode || RFM69_MODE_TX == _mode)
     setMode(RFM69_MODE_STANDBY);
 
-  // calculate register value
-  bitrate = RFM69_XO / bitrate;
+  uint16_t value = rfm69Bitrate(bitrate);
+  uint8_t values[2] = { (uint8_t) (value >> 8), (uint8_t) value };
 
   // set new bitrate
-  writeRegister(0x03, bitrate >> 8);
-  writeRegister(0x04, bitrate);
+  writeBurst(0x03, values, 2);
+}
+
+/**
+ * Set the sync word.
+ * After calling this function, the module is in standby mode.
+ *
+ * @param syncWord Pointer to the sync word bytes (first byte is sent first)
+ * @param syncLength Number of sync word bytes (1..8); 0 disables sync word detection
+ */
+void RFM69::setSyncWord(const uint8_t* syncWord, unsigned int syncLength)
+{
+  // switch to standby if TX/RX was active
+  if (RFM69_MODE_RX == _mode || RFM69_MODE_TX == _mode)
+    setMode(RFM69_MODE_STANDBY);
+
+  if (syncLength > 8)
+    syncLength = 8;
+
+  if (0 == syncLength)
+  {
+    writeRegister(0x2E, readRegister(0x2E) & 0x7F);
+    return;
+  }
+
+  // SyncOn, keep the tolerated bit errors, set SyncSize = syncLength - 1
+  writeRegister(0x2E, 0x80 | ((syncLength - 1) << 3) | (readRegister(0x2E) & 0x07));
+
+  for (unsigned int i = 0; i < syncLength; i++)
+    writeRegister(0x2F + i, syncWord[i]);
 }
 
 /**
@@ -355,12 +404,13 @@ uint8_t RFM69::readRegister(uint8_t reg)
   // read value from register
   chipSelect();
 
-  uint16_t cmd = (reg << 8);
-  uint8_t value = rf12_xferCmd(_fd, cmd);
+  uint8_t tx[2] = { reg, 0 };
+  uint8_t rx[2];
+  _spi->transfer(tx, rx, 2);
 
   chipUnselect();
 
-  return value;
+  return rx[1];
 }
 
 /**
@@ -378,12 +428,167 @@ void RFM69::writeRegister(uint8_t reg, uint8_t value)
   // transfer value to register and set the write flag
   chipSelect();
 
-  uint16_t cmd = ((reg | 0x80) << 8) | (((uint16_t)value) & 0xff);
-  rf12_xferCmd(_fd, cmd);
+  uint8_t tx[2] = { (uint8_t) (reg | 0x80), value };
+  _spi->transfer(tx, 0, 2);
+
+  chipUnselect();
+
+  updateShadow(reg, &value, 1);
+}
+
+/**
+ * Track written configuration registers in the shadow copy. Trigger bits such
+ * as RestartRx are not kept: the module reads them back as 0.
+ *
+ * @param reg First register written
+ * @param values Register values
+ * @param count Number of registers
+ */
+void RFM69::updateShadow(uint8_t reg, const uint8_t* values, unsigned int count)
+{
+  // FIFO writes do not increment the address
+  if (0x00 == reg)
+    return;
+
+  for (unsigned int i = 0; i < count; i++)
+  {
+    if (rfm69ImageHas(_shadow, reg + i))
+      _shadow.values[reg + i] = values[i] & ~rfm69TriggerBits(reg + i);
+  }
+}
+
+/**
+ * Write consecutive RFM69 registers in a single SPI transfer.
+ *
+ * The module auto-increments the address, except for the FIFO (0x00) where all
+ * bytes go into the FIFO.
+ *
+ * @param reg First register to be written
+ * @param values Register values
+ * @param count Number of registers; at most RFM69_MAX_BURST
+ */
+void RFM69::writeBurst(uint8_t reg, const uint8_t* values, unsigned int count)
+{
+  uint8_t tx[RFM69_MAX_BURST + 1];
+
+  // sanity check
+  if (reg > 0x7f || count > RFM69_MAX_BURST)
+    return;
+
+  tx[0] = reg | 0x80;
+  memcpy(tx + 1, values, count);
+
+  chipSelect();
+  _spi->transfer(tx, 0, count + 1);
+  chipUnselect();
+
+  updateShadow(reg, values, count);
+}
+
+/**
+ * Read consecutive RFM69 registers in a single SPI transfer.
+ *
+ * The values are received directly into the caller's buffer.
+ *
+ * @param reg First register to be read
+ * @param values Buffer for the register values
+ * @param count Number of registers; at most RFM69_MAX_BURST
+ */
+void RFM69::readBurst(uint8_t reg, uint8_t* values, unsigned int count)
+{
+  // sanity check
+  if (reg > 0x7f || 0 == count || count > RFM69_MAX_BURST)
+    return;
 
+  chipSelect();
+  _spi->read(reg, values, count);
   chipUnselect();
 }
 
+/**
+ * Read RegIrqFlags1 and RegIrqFlags2 in one transfer.
+ *
+ * @return RegIrqFlags1 in the upper, RegIrqFlags2 in the lower byte
+ */
+uint16_t RFM69::readIrqFlags()
+{
+  uint8_t flags[2];
+
+  readBurst(0x27, flags, 2);
+
+  return (flags[0] << 8) | flags[1];
+}
+
+/**
+ * Restart the receiver, e.g. after the carrier frequency has been changed in RX mode.
+ */
+void RFM69::restartRx()
+{
+  writeRegister(0x3D, (readRegister(0x3D) & 0xFB) | 0x04);
+}
+
+/**
+ * Switch to another channel without leaving the current mode.
+ *
+ * The carrier frequency is written with a single burst of 0x07..0x09 and, if given,
+ * the sync word with a single burst starting at 0x2E. In RX mode the receiver is
+ * restarted, so the new settings are effective immediately. Settings the shadow
+ * copy shows on the chip already are not written again.
+ *
+ * @param frequency Carrier frequency in Hz
+ * @param syncWord Pointer to the sync word bytes; 0 keeps the current sync word
+ * @param syncLength Number of sync word bytes (1..8)
+ */
+void RFM69::retune(unsigned int frequency, const uint8_t* syncWord, unsigned int syncLength)
+{
+  uint32_t frf = rfm69Frf(frequency);
+  uint8_t values[9];
+  bool changed = false;
+
+  values[0] = frf >> 16;
+  values[1] = frf >> 8;
+  values[2] = frf;
+  if (false == shadowMatches(0x07, values, 3))
+  {
+    writeBurst(0x07, values, 3);
+    changed = true;
+  }
+
+  if (0 != syncWord && syncLength >= 1 && syncLength <= 8)
+  {
+    // SyncOn, FifoFillCondition = 0, SyncSize = syncLength - 1, no tolerated bit errors
+    values[0] = 0x80 | ((syncLength - 1) << 3);
+    memcpy(values + 1, syncWord, syncLength);
+    if (false == shadowMatches(0x2E, values, syncLength + 1))
+    {
+      writeBurst(0x2E, values, syncLength + 1);
+      changed = true;
+    }
+  }
+
+  if (changed && RFM69_MODE_RX == _mode)
+    restartRx();
+}
+
+/**
+ * Check if registers are known to hold the given values already.
+ *
+ * @param reg First register
+ * @param values Register values
+ * @param count Number of registers
+ * @return true if all registers are in the shadow copy with these values
+ */
+bool RFM69::shadowMatches(uint8_t reg, const uint8_t* values, unsigned int count)
+{
+  for (unsigned int i = 0; i < count; i++)
+  {
+    if (false == rfm69ImageHas(_shadow, reg + i) || _shadow.values[reg + i] != values[i])
+      return false;
+  }
+
+  return true;
+}
+
 /**
  * Acquire the chip.
  */
@@ -545,11 +750,41 @@ void RFM69::setCustomConfig(const uint8_t config[][2], unsigned int length)
   }
 }
 
+/**
+ * Write a register image, see rfm69Image().
+ * Every run of consecutive registers the image sets is written with one burst.
+ *
+ * @param image Register image
+ */
+void RFM69::writeImage(const RFM69Image& image)
+{
+  unsigned int reg = 1;
+
+  // the registers of the image become part of the shadow copy
+  for (unsigned int i = 0; i < sizeof(_shadow.mask); i++)
+    _shadow.mask[i] |= image.mask[i];
+
+  while (reg < RFM69_IMAGE_SIZE)
+  {
+    if (false == rfm69ImageHas(image, reg))
+    {
+      reg++;
+      continue;
+    }
+
+    unsigned int first = reg;
+    while (reg < RFM69_IMAGE_SIZE && rfm69ImageHas(image, reg))
+      reg++;
+
+    writeBurst(first, image.values + first, reg - first);
+  }
+}
+
 uint32_t HAL_GetTick()
 {
   struct timespec spec;
-  clock_gettime(CLOCK_REALTIME, &spec);
-  return (spec.tv_sec + (spec.tv_nsec / 1000000));
+  clock_gettime(CLOCK_MONOTONIC, &spec);
+  return (spec.tv_sec * 1000 + (spec.tv_nsec / 1000000));
 }
 
 /**
@@ -605,7 +840,7 @@ int RFM69::send(const void* data, unsigned int dataLength)
     while ((false == channelFree()) && ((HAL_GetTick() - timeEntry) < TIMEOUT_CSMA_READY))
     {
       // wait for a random time before checking again
-      delay(rand() % 10);
+      usleep((rand() % 10) * 1000);
 
       /* try to receive packets while waiting for a free channel
        * and put them into a temporary buffer */
@@ -626,17 +861,11 @@ int RFM69::send(const void* data, unsigned int dataLength)
     setMode(RFM69_MODE_STANDBY);
   }
 
-  // transfer packet to FIFO
-  chipSelect();
-
-  rf12_xferByte(_fd, 0x00 | 0x80);
-  rf12_xferByte(_fd, dataLength);
-
-  // send payload
-  for (unsigned int i = 0; i < dataLength; i++)
-    rf12_xferByte(_fd, ((uint8_t*)data)[i]);
-
-  chipUnselect();
+  // transfer length byte and packet to FIFO in one burst
+  uint8_t fifo[RFM69_MAX_PAYLOAD + 1];
+  fifo[0] = dataLength;
+  memcpy(fifo + 1, data, dataLength);
+  writeBurst(0x00, fifo, dataLength + 1);
 
   // start radio transmission
   setMode(RFM69_MODE_TX);
@@ -650,6 +879,62 @@ int RFM69::send(const void* data, unsigned int dataLength)
   return dataLength;
 }
 
+/**
+ * Start sending a packet without waiting for it to leave the air.
+ *
+ * The packet is written to the FIFO and the module is switched to TX mode.
+ * Completion is signalled by PacketSent on DIO0 or can be checked with packetSent().
+ * Call receive() or setMode() afterwards to leave TX mode.
+ *
+ * @note No CSMA/CA is done here; the caller is responsible for checking channelFree().
+ *
+ * @param data Pointer to buffer with data
+ * @param dataLength Size of buffer
+ *
+ * @return Number of bytes that are being sent
+ */
+int RFM69::startSend(const void* data, unsigned int dataLength)
+{
+  // limit max payload
+  if (dataLength > RFM69_MAX_PAYLOAD)
+    dataLength = RFM69_MAX_PAYLOAD;
+
+  // payload must be available
+  if (0 == dataLength)
+    return 0;
+
+  // switch to standby and wait for mode ready, if not in sleep mode
+  if (RFM69_MODE_SLEEP != _mode)
+  {
+    setMode(RFM69_MODE_STANDBY);
+    waitForModeReady();
+  }
+
+  // clear FIFO to remove old data and clear flags
+  clearFIFO();
+
+  // transfer length byte and packet to FIFO in one burst
+  uint8_t fifo[RFM69_MAX_PAYLOAD + 1];
+  fifo[0] = dataLength;
+  memcpy(fifo + 1, data, dataLength);
+  writeBurst(0x00, fifo, dataLength + 1);
+
+  // start radio transmission
+  setMode(RFM69_MODE_TX);
+
+  return dataLength;
+}
+
+/**
+ * Check if the packet started with startSend() has been sent.
+ *
+ * @return true if PacketSent is set
+ */
+bool RFM69::packetSent()
+{
+  return (readRegister(0x28) & 0x08) != 0;
+}
+
 /**
  * Clear FIFO and flags of RFM69 module.
  */
@@ -714,11 +999,67 @@ int RFM69::receive(unsigned char* data, unsigned int dataLength)
  * @note This is an internal function.
  * @note The module resides in RX mode.
  *
- * @param data Pointer to a receiving buffer
+ * @param data Pointer to a receiving buffer; the length byte is stored first
  * @param dataLength Maximum size of buffer
  * @return Number of received bytes; 0 if no payload is available.
  */
 int RFM69::_receive(unsigned char* data, unsigned int dataLength)
+{
+  if (dataLength < 1)
+    return 0;
+
+  int bytesRead = readPacket(data + 1, dataLength - 1);
+  if (bytesRead < 0)
+    return 0;
+
+  data[0] = bytesRead;
+
+  return bytesRead + 1;
+}
+
+/**
+ * Receive a packet straight into the caller's buffer, without the length byte.
+ *
+ * @note The module resides in RX mode.
+ *
+ * @param payload Buffer for the payload, e.g. the data of a pooled frame
+ * @param maxLength Size of the buffer
+ * @return Number of payload bytes; 0 if no payload is available.
+ */
+int RFM69::receivePayload(uint8_t* payload, unsigned int maxLength)
+{
+  // packet received while waiting for a free channel in send()
+  if (_rxBufferLength > 0)
+  {
+    unsigned int length = _rxBufferLength - 1;
+    if (length > maxLength)
+      length = maxLength;
+
+    memcpy(payload, _rxBuffer + 1, length);
+    _rxBufferLength = 0;
+
+    return length;
+  }
+
+  int bytesRead = readPacket(payload, maxLength);
+
+  return (bytesRead < 0) ? 0 : bytesRead;
+}
+
+/**
+ * Read a packet from the FIFO if PayloadReady is set.
+ *
+ * The length byte is read first, the payload follows in a single burst
+ * directly into the destination buffer.
+ *
+ * @note This is an internal function.
+ * @note The module resides in RX mode.
+ *
+ * @param payload Buffer for the payload
+ * @param maxLength Size of the buffer
+ * @return Number of payload bytes; -1 if no packet is available.
+ */
+int RFM69::readPacket(uint8_t* payload, unsigned int maxLength)
 {
   // go to RX mode if not already in this mode
   if (RFM69_MODE_RX != _mode)
@@ -727,53 +1068,55 @@ int RFM69::_receive(unsigned char* data, unsigned int dataLength)
     waitForModeReady();
   }
 
-  uint8_t r;
-  r = readRegister(0x24);
-  uint8_t r2 = readRegister(0x27);
-  if ((r < 0xc0) || (r2 & 0x07))
+  // RegRssiValue..RegIrqFlags2 in one burst
+  uint8_t regs[5];
+  readBurst(0x24, regs, sizeof(regs));
+#ifdef DEBUG
+  if ((regs[0] < 0xc0) || (regs[3] & 0x07))
   {
-    printf("0x24: %x 0x27:%x\r\n", r, r2);
+    printf("0x24: %x 0x27:%x\r\n", regs[0], regs[3]);
   }
+#endif
 
+  if (0 == (regs[4] & 0x04))
+    return -1;
 
-  r = readRegister(0x28);
-//  if (r)  printf("0x28: %x\r\n", r);
-  if (r & 0x04)
-  {
-    // go to standby before reading data
-    setMode(RFM69_MODE_STANDBY);
+  // go to standby before reading data
+  setMode(RFM69_MODE_STANDBY);
 
-    // get FIFO content
-    unsigned int bytesRead = 0;
+  // variable length packet: length byte first
+  unsigned int bytesRead = readRegister(0x00);
+  if (bytesRead > maxLength)
+    bytesRead = maxLength;
+  if (bytesRead > RFM69_MAX_PAYLOAD)
+    bytesRead = RFM69_MAX_PAYLOAD;
 
-    // read until FIFO is empty or buffer length exceeded
-    while ((readRegister(0x28) & 0x40) && (bytesRead < dataLength))
-    {
-      // read next byte
-      data[bytesRead] = readRegister(0x00);
-      printf("%x ", data[bytesRead]);
-      bytesRead++;
-    }
+  if (bytesRead > 0)
+    readBurst(0x00, payload, bytesRead);
 
-    printf("\r\n");
-    // automatically read RSSI if requested
-    if (true == _autoReadRSSI)
-    {
-      readRSSI();
-      printf("rssi: %d\r\n", _rssi);
-    }
+  // automatically read RSSI if requested
+  if (true == _autoReadRSSI)
+  {
+    readRSSI();
+#ifdef DEBUG
+    printf("rssi: %d\r\n", _rssi);
+#endif
+  }
 
-    // go back to RX mode
-    setMode(RFM69_MODE_RX);
-    writeRegister(0x3D, readRegister (0x3D) | 0x04 );
+  // automatically read frequency error if requested
+  if (true == _autoReadFEI)
+  {
+    readFEI();
+  }
 
-    // todo: wait needed?
-    //    waitForModeReady();
+  // go back to RX mode
+  setMode(RFM69_MODE_RX);
+  writeRegister(0x3D, readRegister (0x3D) | 0x04 );
 
-    return bytesRead;
-  }
-  else
-    return 0;
+  // todo: wait needed?
+  //    waitForModeReady();
+
+  return bytesRead;
 }
 
 /**
@@ -802,17 +1145,8 @@ bool RFM69::setAESEncryption(const void* aesKey, unsigned int keyLength)
 
   if (true == enable)
   {
-    // transfer AES key to AES key register
-    chipSelect();
-
-    // address first AES MSB register
-    rf12_xferByte(_fd, 0x3E | 0x80);
-
-    // transfer key (0x3E..0x4D)
-    for (unsigned int i = 0; i < keyLength; i++)
-      rf12_xferByte(_fd, ((uint8_t*)aesKey)[i]);
-
-    chipUnselect();
+    // transfer key (0x3E..0x4D) in one burst
+    writeBurst(0x3E, (const uint8_t*)aesKey, keyLength);
   }
 
   // set/reset AesOn Bit in packet config
@@ -847,6 +1181,42 @@ int RFM69::readRSSI()
   return _rssi;
 }
 
+/**
+ * Enable/disable the measurement of the frequency error of every packet.
+ *
+ * The module performs an AFC at every receiver start (AfcAutoOn, AfcAutoclearOn);
+ * the measured offset is read after each packet and available with getFEI().
+ *
+ * Default is off (no AFC, FEI reads 0).
+ *
+ * @param enable true or false
+ */
+void RFM69::setAutoReadFEI(bool enable)
+{
+  writeRegister(0x1E, enable ? 0x0C : 0x00);
+
+  _autoReadFEI = enable;
+  _fei = 0;
+}
+
+/**
+ * Read the frequency offset measured by the last AFC.
+ *
+ * @return Frequency error in Hz
+ */
+int RFM69::readFEI()
+{
+  uint8_t value[2];
+
+  readBurst(0x1F, value, 2);
+
+  // two's complement in steps of Fstep = XO / 2^19
+  int16_t afc = (value[0] << 8) | value[1];
+  _fei = ((int64_t)afc * RFM69_XO) / (1 << 19);
+
+  return _fei;
+}
+
 /**
  * Debug function to dump all RFM69 registers.
  *
@@ -944,6 +1314,8 @@ int RFM69::setPowerDBm(int8_t dBm)
 
   uint8_t powerLevel = 0;
 
+  _powerDBm = dBm;
+
   if (false == _highPowerDevice)
   {
     // only PA0 can be used
@@ -999,6 +1371,7 @@ int RFM69::setPowerDBm(int8_t dBm)
  * Check if the channel is free using RSSI measurements.
  *
  * This function is part of the CSMA/CA algorithm.
+ * The module has to be in RX mode, otherwise no RSSI sample is available.
  *
  * @return true = channel free; otherwise false.
  */
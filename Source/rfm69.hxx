@@ -23,10 +23,14 @@
 #ifndef RFM69_HXX_
 #define RFM69_HXX_
 
+#include "rfm69profile.hxx"
+#include "spibase.hxx"
+
 /** @addtogroup RFM69
  * @{
  */
 #define RFM69_MAX_PAYLOAD   64 ///< Maximum bytes payload
+#define RFM69_MAX_BURST     128 ///< Maximum bytes of one register burst
 
 /**
  * Valid RFM69 operation modes.
@@ -55,33 +59,78 @@ class RFM69
    * @{
    */
 public:
-  RFM69(bool highPowerDevice = false);
+  RFM69(SPIBase* spi, bool highPowerDevice = false);
   virtual ~RFM69();
 
-  void reset();
+  bool reset();
 
   bool init();
 
+  int warmInit(const RFM69Image& image);
+
+  int applyImage(const RFM69Image& image);
+
   void setFrequency(unsigned int frequency);
 
   void setFrequencyDeviation(unsigned int frequency);
 
   void setBitrate(unsigned int bitrate);
 
+  void setSyncWord(const uint8_t* syncWord, unsigned int syncLength);
+
+  void retune(unsigned int frequency, const uint8_t* syncWord = 0, unsigned int syncLength = 0);
+
+  void restartRx();
+
+  void clearFIFO();
+
+  uint16_t readIrqFlags();
+
+  void writeBurst(uint8_t reg, const uint8_t* values, unsigned int count);
+
+  void readBurst(uint8_t reg, uint8_t* values, unsigned int count);
+
   RFM69Mode setMode(RFM69Mode mode);
 
   void setPowerLevel(uint8_t power);
 
   int setPowerDBm(int8_t dBm);
 
+  /**
+   * Get the output power last set with setPowerDBm() [dBm].
+   */
+  int8_t getPowerDBm()
+  {
+    return _powerDBm;
+  }
+
   void setHighPowerSettings(bool enable);
 
   void setCustomConfig(const uint8_t config[][2], unsigned int length);
 
+  void writeImage(const RFM69Image& image);
+
+  /**
+   * Get the shadow copy of the configuration registers: the values last written
+   * to the registers of the image set with init(), warmInit() or writeImage().
+   */
+  const RFM69Image& getShadow()
+  {
+    return _shadow;
+  }
+
   int send(const void* data, unsigned int dataLength);
 
+  int startSend(const void* data, unsigned int dataLength);
+
+  bool packetSent();
+
+  bool channelFree();
+
   int receive(unsigned char* data, unsigned int dataLength);
 
+  int receivePayload(uint8_t* payload, unsigned int maxLength);
+
   void sleep();
 
   /**
@@ -96,6 +145,20 @@ public:
     return _rssi;
   }
 
+  /**
+   * Gets the frequency error of the last packet.
+   *
+   * @note Only available if enabled with setAutoReadFEI().
+   *
+   * @return Frequency error in Hz; 0 if not measured.
+   */
+  int getFEI()
+  {
+    return _fei;
+  }
+
+  void setAutoReadFEI(bool enable);
+
   void setOOKMode(bool enable);
 
   void setDataMode(RFM69DataMode dataMode = RFM69_DATA_MODE_PACKET);
@@ -129,39 +192,51 @@ public:
   bool setAESEncryption(const void* aesKey, unsigned int keyLength);
 
 private:
+  void defaults(bool highPowerDevice);
+
   uint8_t readRegister(uint8_t reg);
 
   void writeRegister(uint8_t reg, uint8_t value);
 
+  void updateShadow(uint8_t reg, const uint8_t* values, unsigned int count);
+
+  bool shadowMatches(uint8_t reg, const uint8_t* values, unsigned int count);
+
+  int writeChanges(const RFM69Image& image, const RFM69Image& current);
+
   void chipSelect();
 
   void chipUnselect();
 
-  void clearFIFO();
-
   void waitForModeReady();
 
   void waitForPacketSent();
 
   int readRSSI();
 
-  bool channelFree();
+  int readFEI();
 
   int _receive(unsigned char* data, unsigned int dataLength);
 
+  int readPacket(uint8_t* payload, unsigned int maxLength);
+
   bool _init;
   RFM69Mode _mode;
   bool _highPowerDevice;
   uint8_t _powerLevel;
+  int8_t _powerDBm;
   int _rssi;
   bool _autoReadRSSI;
+  bool _autoReadFEI;
+  int _fei;
   bool _ookEnabled;
   RFM69DataMode _dataMode;
   bool _highPowerSettings;
   bool _csmaEnabled;
   unsigned char _rxBuffer[RFM69_MAX_PAYLOAD];
   unsigned int _rxBufferLength;
-  int _fd;
+  RFM69Image _shadow;
+  SPIBase* _spi;
 
   /** @}
    *
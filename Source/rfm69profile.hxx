@@ -0,0 +1,293 @@
+/**
+ * @file rfm69profile.hxx
+ *
+ * @brief Compile-time computation of RFM69 register images.
+ *
+ * A radio profile describes the physical layer and packet format in natural
+ * units (Hz, bit/s, bytes). rfm69Image() turns it into the register values with
+ * exact rounding, e.g. Frf = round(f * 2^19 / FXOSC) instead of dividing by a
+ * truncated step of 61 Hz, which is about 500 kHz off at 868 MHz.
+ *
+ * Define the profile constexpr and check it with RFM69_PROFILE_CHECK(): a
+ * carrier outside the bands of the module, a bitrate or deviation out of range,
+ * a modulation index outside 0.5..10 or a receiver bandwidth narrower than
+ * the Carson bandwidth (deviation + bitrate / 2) do not compile.
+ *
+ * The image holds the value of every register the profile sets together with
+ * a mask; RFM69::writeImage() writes each run of consecutive registers with a
+ * single SPI burst, RFM69::warmInit() and RFM69::applyImage() only the
+ * registers that differ from the chip or its shadow copy.
+ */
+
+#ifndef RFM69PROFILE_HXX_
+#define RFM69PROFILE_HXX_
+
+#include <stdint.h>
+
+/** @addtogroup RFM69
+ * @{
+ */
+#define RFM69_XO              32000000 ///< Internal clock frequency [Hz]
+#define RFM69_IMAGE_SIZE      0x72     ///< Registers 0x00..0x71
+#define RFM69_PROFILE_MAX_PAYLOAD 64   ///< Largest payload the FIFO holds [bytes]
+
+/** Physical layer and packet format of a radio (FSK, packet mode). */
+typedef struct
+{
+  uint32_t frequency;     //!< Carrier frequency [Hz]
+  uint32_t bitrate;       //!< Bitrate [bit/s]
+  uint32_t deviation;     //!< FSK frequency deviation [Hz]
+  uint32_t rxBandwidth;   //!< Single side receiver bandwidth [Hz]; the next wider available one is used
+  uint16_t preamble;      //!< Preamble length [bytes]
+  uint8_t syncLength;     //!< Sync word length [bytes]; 0 disables sync word detection
+  uint8_t syncWord[8];    //!< Sync word, first byte is sent first
+  uint8_t packetConfig;   //!< RegPacketConfig1 (RF_PACKET1_*)
+  uint8_t payloadLength;  //!< Maximum (variable length) or fixed payload length [bytes]
+  bool aes;               //!< AES-128 encryption of the payload
+  uint8_t aesKey[16];     //!< AES key
+} RFM69Profile;
+
+/** Register values computed from a profile, ready to be written in bursts. */
+typedef struct
+{
+  uint8_t values[RFM69_IMAGE_SIZE];           //!< Register values, indexed by address
+  uint8_t mask[(RFM69_IMAGE_SIZE + 7) / 8];   //!< Registers the image sets
+} RFM69Image;
+
+/**
+ * Check if the image sets a register.
+ */
+constexpr bool rfm69ImageHas(const RFM69Image& image, unsigned int reg)
+{
+  return reg < RFM69_IMAGE_SIZE && (image.mask[reg / 8] & (1 << (reg % 8)));
+}
+
+/**
+ * Set a register of an image.
+ */
+constexpr void rfm69ImageSet(RFM69Image& image, unsigned int reg, uint8_t value)
+{
+  image.values[reg] = value;
+  image.mask[reg / 8] |= 1 << (reg % 8);
+}
+
+/**
+ * Get the trigger bits of a register: writing 1 starts an action, they always
+ * read back as 0 and are no part of the configuration.
+ */
+constexpr uint8_t rfm69TriggerBits(unsigned int reg)
+{
+  return (0x0A == reg) ? 0x80     // RegOsc1: RcCalStart
+      : (0x1E == reg) ? 0x23      // RegAfcFei: FeiStart, AfcClear, AfcStart
+      : (0x23 == reg) ? 0x01      // RegRssiConfig: RssiStart
+      : (0x3D == reg) ? 0x04      // RegPacketConfig2: RestartRx
+      : 0x00;
+}
+
+/**
+ * Get the read-only status bits of a configuration register: the chip reports
+ * its state in them, whatever has been written.
+ */
+constexpr uint8_t rfm69StatusBits(unsigned int reg)
+{
+  return (0x18 == reg) ? 0x38     // RegLna: LnaCurrentGain, set by the AGC
+      : 0x00;
+}
+
+/**
+ * Get the bits of a register that can be compared between the chip and an
+ * image: no trigger or status bits, and nothing of the AES key, which does not
+ * read back reliably.
+ */
+constexpr uint8_t rfm69CompareBits(unsigned int reg)
+{
+  return (reg >= 0x3E && reg <= 0x4D) ? 0x00 : (uint8_t) ~(rfm69TriggerBits(reg) | rfm69StatusBits(reg));
+}
+
+/**
+ * Compute RegFrf (0x07..0x09) for a carrier frequency [Hz], rounded.
+ */
+constexpr uint32_t rfm69Frf(uint32_t frequency)
+{
+  return (((uint64_t) frequency << 19) + RFM69_XO / 2) / RFM69_XO;
+}
+
+/**
+ * Compute RegFdev (0x05..0x06) for a frequency deviation [Hz], rounded.
+ */
+constexpr uint16_t rfm69Fdev(uint32_t deviation)
+{
+  return (((uint64_t) deviation << 19) + RFM69_XO / 2) / RFM69_XO;
+}
+
+/**
+ * Compute RegBitrate (0x03..0x04) for a bitrate [bit/s], rounded.
+ */
+constexpr uint16_t rfm69Bitrate(uint32_t bitrate)
+{
+  return (RFM69_XO + bitrate / 2) / bitrate;
+}
+
+/**
+ * Get the single side receiver bandwidth of RxBwMant/RxBwExp (FSK) [Hz].
+ */
+constexpr uint32_t rfm69RxBandwidth(uint8_t rxBw)
+{
+  return RFM69_XO / ((16 + 4 * ((rxBw >> 3) & 0x03)) << ((rxBw & 0x07) + 2));
+}
+
+/**
+ * Compute RxBwMant/RxBwExp of RegRxBw for the narrowest bandwidth that is at
+ * least the requested one; 500 kHz if none is.
+ */
+constexpr uint8_t rfm69RxBw(uint32_t bandwidth)
+{
+  for (int exp = 7; exp >= 0; exp--)
+  {
+    for (int mant = 2; mant >= 0; mant--)
+    {
+      uint8_t rxBw = (mant << 3) | exp;
+      if (rfm69RxBandwidth(rxBw) >= bandwidth)
+        return rxBw;
+    }
+  }
+
+  return 0x00;
+}
+
+/**
+ * Compute the register image of a profile.
+ * Registers the profile does not cover keep their current value on the chip.
+ */
+constexpr RFM69Image rfm69Image(const RFM69Profile& profile)
+{
+  RFM69Image image = { };
+
+  uint16_t bitrate = rfm69Bitrate(profile.bitrate);
+  uint16_t fdev = rfm69Fdev(profile.deviation);
+  uint32_t frf = rfm69Frf(profile.frequency);
+
+  rfm69ImageSet(image, 0x02, 0x00); // RegDataModul: Packet mode, FSK, no shaping
+  rfm69ImageSet(image, 0x03, bitrate >> 8);
+  rfm69ImageSet(image, 0x04, bitrate);
+  rfm69ImageSet(image, 0x05, fdev >> 8);
+  rfm69ImageSet(image, 0x06, fdev);
+  rfm69ImageSet(image, 0x07, frf >> 16);
+  rfm69ImageSet(image, 0x08, frf >> 8);
+  rfm69ImageSet(image, 0x09, frf);
+  rfm69ImageSet(image, 0x18, 0x00); // RegLna: 50 ohm, gain set by AGC
+  rfm69ImageSet(image, 0x19, 0x40 | rfm69RxBw(profile.rxBandwidth)); // RegRxBw: DccFreq 4 %
+  rfm69ImageSet(image, 0x2C, profile.preamble >> 8);
+  rfm69ImageSet(image, 0x2D, profile.preamble);
+  // RegSyncConfig: SyncOn, FifoFillCondition = 0, SyncSize = syncLength - 1, no tolerated bit errors
+  rfm69ImageSet(image, 0x2E, profile.syncLength ? 0x80 | ((profile.syncLength - 1) << 3) : 0x00);
+  for (unsigned int i = 0; i < 8; i++)
+    rfm69ImageSet(image, 0x2F + i, i < profile.syncLength ? profile.syncWord[i] : 0x00);
+  rfm69ImageSet(image, 0x37, profile.packetConfig);
+  rfm69ImageSet(image, 0x38, profile.payloadLength);
+  rfm69ImageSet(image, 0x39, 0x00); // RegNodeAdrs
+  rfm69ImageSet(image, 0x3A, 0x00); // RegBroadcastAdrs
+  rfm69ImageSet(image, 0x3B, 0x00); // RegAutoModes: off
+  rfm69ImageSet(image, 0x3C, 0x8F); // RegFifoThresh: TxStart on FifoNotEmpty, 15 bytes FifoLevel
+  rfm69ImageSet(image, 0x3D, 0x02 | (profile.aes ? 0x01 : 0x00)); // RegPacketConfig2: AutoRxRestartOn, AesOn
+  for (unsigned int i = 0; i < 16; i++)
+    rfm69ImageSet(image, 0x3E + i, profile.aes ? profile.aesKey[i] : 0x00);
+  rfm69ImageSet(image, 0x58, 0x1B); // RegTestLna: Normal sensitivity mode
+  rfm69ImageSet(image, 0x6F, 0x30); // RegTestDagc: Improved margin, use if AfcLowBetaOn=0
+
+  return image;
+}
+
+/**
+ * Check if the carrier frequency is within a band of the module (290..340,
+ * 424..510, 862..1020 MHz).
+ */
+constexpr bool rfm69ProfileBand(const RFM69Profile& profile)
+{
+  return (profile.frequency >= 290000000 && profile.frequency <= 340000000)
+      || (profile.frequency >= 424000000 && profile.frequency <= 510000000)
+      || (profile.frequency >= 862000000 && profile.frequency <= 1020000000);
+}
+
+/**
+ * Check bitrate (1.2..300 kbit/s) and deviation (600 Hz, deviation + bitrate / 2
+ * at most 500 kHz).
+ */
+constexpr bool rfm69ProfileRates(const RFM69Profile& profile)
+{
+  return profile.bitrate >= 1200 && profile.bitrate <= 300000 && profile.deviation >= 600
+      && profile.deviation + profile.bitrate / 2 <= 500000;
+}
+
+/**
+ * Check the modulation index 2 * deviation / bitrate (0.5..10).
+ */
+constexpr bool rfm69ProfileIndex(const RFM69Profile& profile)
+{
+  return (uint64_t) 4 * profile.deviation >= profile.bitrate
+      && (uint64_t) 2 * profile.deviation <= (uint64_t) 10 * profile.bitrate;
+}
+
+/**
+ * Check the Carson rule: the receiver bandwidth (single side) used for the
+ * profile covers deviation + bitrate / 2.
+ */
+constexpr bool rfm69ProfileCarson(const RFM69Profile& profile)
+{
+  return rfm69RxBandwidth(rfm69RxBw(profile.rxBandwidth)) >= profile.deviation + profile.bitrate / 2;
+}
+
+/**
+ * Check sync word and payload length.
+ */
+constexpr bool rfm69ProfilePacket(const RFM69Profile& profile)
+{
+  return profile.syncLength <= 8 && profile.payloadLength >= 1
+      && profile.payloadLength <= RFM69_PROFILE_MAX_PAYLOAD;
+}
+
+/**
+ * Check a profile at run time, e.g. one derived from rfm69_base_profile.
+ */
+constexpr bool rfm69ProfileValid(const RFM69Profile& profile)
+{
+  return rfm69ProfileBand(profile) && rfm69ProfileRates(profile) && rfm69ProfileIndex(profile)
+      && rfm69ProfileCarson(profile) && rfm69ProfilePacket(profile);
+}
+
+/**
+ * Reject invalid profiles at compile time.
+ *
+ * @param profile A constexpr RFM69Profile
+ */
+#define RFM69_PROFILE_CHECK(profile) \
+  static_assert(rfm69ProfileBand(profile), #profile ": carrier frequency outside the bands of the RFM69"); \
+  static_assert(rfm69ProfileRates(profile), #profile ": bitrate or frequency deviation out of range"); \
+  static_assert(rfm69ProfileIndex(profile), #profile ": modulation index not within 0.5..10"); \
+  static_assert(rfm69ProfileCarson(profile), #profile ": RX bandwidth below deviation + bitrate / 2 (Carson)"); \
+  static_assert(rfm69ProfilePacket(profile), #profile ": sync word or payload length out of range")
+
+/** RFM69 base profile after init().
+ *
+ * Change this to your needs or call setCustomConfig() after module init.
+ */
+static constexpr RFM69Profile rfm69_base_profile =
+{
+  868300000,  // carrier frequency [Hz]
+  9600,       // bitrate [bit/s]
+  20000,      // frequency deviation [Hz]
+  50000,      // RX bandwidth, single side [Hz]
+  6,          // preamble [bytes]
+  4, { 0xDE, 0xAD, 0xBE, 0xEF }, // sync word
+  0xD0,       // RegPacketConfig1: Variable length, CRC on, whitening
+  64,         // maximum payload [bytes]
+  false, { }  // no encryption
+};
+
+RFM69_PROFILE_CHECK(rfm69_base_profile);
+
+/** @}
+ *
+ */
+
+#endif /* RFM69PROFILE_HXX_ */
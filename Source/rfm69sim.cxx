@@ -0,0 +1,576 @@
+/**
+ * @file rfm69sim.cxx
+ *
+ * @brief Register level simulator of the RFM69 (SX1231) on the host.
+ */
+
+/** @addtogroup RFM69
+ * @{
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "rfm69sim.hxx"
+#include "rfm69profile.hxx"
+
+#define MODE_SLEEP    0
+#define MODE_STANDBY  1
+#define MODE_FS       2
+#define MODE_TX       3
+#define MODE_RX       4
+
+#define NEVER         UINT64_MAX
+
+/** Register values after power on (SX1231 datasheet, "default" column). */
+static const uint8_t resetValues[][2] =
+{
+  { 0x01, 0x04 }, { 0x02, 0x00 }, { 0x03, 0x1A }, { 0x04, 0x0B }, { 0x05, 0x00 }, { 0x06, 0x52 },
+  { 0x07, 0xE4 }, { 0x08, 0xC0 }, { 0x09, 0x00 }, { 0x0A, 0x41 }, { 0x0B, 0x40 }, { 0x0C, 0x02 },
+  { 0x0D, 0x92 }, { 0x0E, 0xF5 }, { 0x0F, 0x20 }, { 0x10, 0x24 }, { 0x11, 0x9F }, { 0x12, 0x09 },
+  { 0x13, 0x1A }, { 0x14, 0x40 }, { 0x15, 0xB0 }, { 0x16, 0x7B }, { 0x17, 0x9B }, { 0x18, 0x88 },
+  { 0x19, 0x55 }, { 0x1A, 0x8B }, { 0x1B, 0x40 }, { 0x1C, 0x80 }, { 0x1D, 0x06 }, { 0x1E, 0x10 },
+  { 0x23, 0x02 }, { 0x24, 0xFF }, { 0x26, 0x05 }, { 0x27, 0x80 }, { 0x29, 0xE4 }, { 0x2D, 0x03 },
+  { 0x2E, 0x98 }, { 0x2F, 0x01 }, { 0x30, 0x01 }, { 0x31, 0x01 }, { 0x32, 0x01 }, { 0x33, 0x01 },
+  { 0x34, 0x01 }, { 0x35, 0x01 }, { 0x36, 0x01 }, { 0x37, 0x10 }, { 0x38, 0x40 }, { 0x3C, 0x8F },
+  { 0x3D, 0x02 }, { 0x4E, 0x01 }, { 0x58, 0x1B }, { 0x5A, 0x55 }, { 0x5C, 0x70 }, { 0x6F, 0x30 }
+};
+
+/**
+ * Get the simulator time.
+ *
+ * @return CLOCK_MONOTONIC [ns]
+ */
+uint64_t RFM69Sim::now()
+{
+  struct timespec spec;
+  clock_gettime(CLOCK_MONOTONIC, &spec);
+  return (uint64_t) spec.tv_sec * 1000000000 + spec.tv_nsec;
+}
+
+/**
+ * Simulator constructor; the module is in standby mode with its power on
+ * register values.
+ */
+RFM69Sim::RFM69Sim()
+{
+  _queueHead = 0;
+  _queueCount = 0;
+  _noise = RFM69SIM_NOISE;
+  memset(&_stats, 0, sizeof(_stats));
+  reset();
+}
+
+RFM69Sim::~RFM69Sim()
+{
+}
+
+/**
+ * Reset the module: power on register values, standby mode, empty FIFO.
+ * Scheduled frames and counters are kept.
+ *
+ * @return Always true: the simulator behaves as if a reset line was wired.
+ */
+bool RFM69Sim::reset()
+{
+  memset(_regs, 0, sizeof(_regs));
+  for (unsigned int i = 0; i < sizeof(resetValues) / sizeof(resetValues[0]); i++)
+    _regs[resetValues[i][0]] = resetValues[i][1];
+
+  _fifoHead = 0;
+  _fifoCount = 0;
+  _mode = MODE_STANDBY;
+  _readyAt = 0;
+  _rxSince = NEVER;
+  _txEnd = 0;
+  _airUntil = 0;
+  _sentLength = 0;
+
+  return true;
+}
+
+/**
+ * One SPI transaction: the first byte is the address with the write bit (0x80),
+ * the address increments after every byte except for the FIFO (0x00).
+ */
+void RFM69Sim::transfer(const uint8_t* tx, uint8_t* rx, unsigned int length)
+{
+  if (0 == length)
+    return;
+
+  update();
+
+  _stats.transfers++;
+  _stats.bytes += length;
+
+  uint8_t address = tx[0] & 0x7F;
+  bool write = tx[0] & 0x80;
+
+  if (rx)
+    rx[0] = 0;
+
+  for (unsigned int i = 1; i < length; i++)
+  {
+    if (write)
+    {
+      writeRegister(address, tx[i]);
+    }
+    else
+    {
+      uint8_t value = readRegister(address);
+      if (rx)
+        rx[i] = value;
+    }
+
+    if (0x00 != address)
+      address = (address + 1) & 0x7F;
+  }
+}
+
+/**
+ * One SPI transaction that sends the address byte and zeros after it.
+ */
+void RFM69Sim::read(uint8_t address, uint8_t* rx, unsigned int length)
+{
+  uint8_t tx[RFM69SIM_REGISTERS + 1];
+
+  if (length > RFM69SIM_REGISTERS)
+    length = RFM69SIM_REGISTERS;
+
+  memset(tx, 0, length + 1);
+  tx[0] = address;
+
+  uint8_t buffer[RFM69SIM_REGISTERS + 1];
+  transfer(tx, buffer, length + 1);
+  memcpy(rx, buffer + 1, length);
+}
+
+/**
+ * Schedule a frame on the air.
+ *
+ * @param payload Payload, without the length byte
+ * @param length Payload length; at most RFM69_PROFILE_MAX_PAYLOAD
+ * @param rssi RSSI of the frame [dBm]
+ * @param start Time the preamble starts (see now()); 0 for now
+ * @param frequency Carrier frequency [Hz]; 0 for the channel the receiver is on
+ * @return false if the frame is invalid or the schedule is full
+ */
+bool RFM69Sim::inject(const uint8_t* payload, unsigned int length, int rssi, uint64_t start, unsigned int frequency)
+{
+  if (0 == length || length > RFM69_PROFILE_MAX_PAYLOAD || _queueCount >= RFM69SIM_QUEUE)
+    return false;
+
+  if (0 == start)
+    start = now();
+
+  // keep the schedule sorted by start time
+  unsigned int position = _queueCount;
+  while (position > 0 && _queue[(_queueHead + position - 1) % RFM69SIM_QUEUE].start > start)
+  {
+    _queue[(_queueHead + position) % RFM69SIM_QUEUE] = _queue[(_queueHead + position - 1) % RFM69SIM_QUEUE];
+    position--;
+  }
+
+  Scheduled* frame = &_queue[(_queueHead + position) % RFM69SIM_QUEUE];
+  frame->start = start;
+  frame->end = start + (uint64_t) airtime(length) * 1000;
+  frame->rssi = rssi;
+  frame->frequency = frequency;
+  frame->length = length;
+  memcpy(frame->data, payload, length);
+  _queueCount++;
+
+  return true;
+}
+
+/**
+ * Get the airtime of a packet with the current settings: preamble, sync word,
+ * length byte (variable length), payload and CRC.
+ *
+ * @param length Payload length
+ * @return Airtime [us]
+ */
+unsigned int RFM69Sim::airtime(unsigned int length)
+{
+  unsigned int bytes = ((_regs[0x2C] << 8) | _regs[0x2D]) + length;
+
+  if (_regs[0x2E] & 0x80)
+    bytes += ((_regs[0x2E] >> 3) & 0x07) + 1;
+  if (_regs[0x37] & 0x80)
+    bytes++;
+  if (_regs[0x37] & 0x10)
+    bytes += 2;
+
+  return (bytes * 8 * bitTime()) / 1000;
+}
+
+/**
+ * Get the level of DIO0 with DioMapping 00: PayloadReady in RX, PacketSent in TX.
+ */
+bool RFM69Sim::getDio0()
+{
+  update();
+
+  if (0x00 != (_regs[0x25] & 0xC0))
+    return false;
+
+  if (MODE_RX == _mode)
+    return _regs[0x28] & 0x04;
+  if (MODE_TX == _mode)
+    return _regs[0x28] & 0x08;
+
+  return false;
+}
+
+/**
+ * Take the last packet the module has sent.
+ *
+ * @param payload Buffer for the payload, without the length byte
+ * @param maxLength Size of the buffer
+ * @return Payload length; -1 if nothing has been sent since the last call
+ */
+int RFM69Sim::getSent(uint8_t* payload, unsigned int maxLength)
+{
+  update();
+
+  if (0 == _sentLength)
+    return -1;
+
+  unsigned int length = (_sentLength > maxLength) ? maxLength : _sentLength;
+  memcpy(payload, _sent, length);
+  _sentLength = 0;
+
+  return length;
+}
+
+/**
+ * Read a register without side effects (the FIFO is not popped).
+ */
+uint8_t RFM69Sim::peek(uint8_t reg)
+{
+  update();
+
+  if (0x00 == reg)
+    return _fifoCount ? _fifo[_fifoHead] : 0;
+
+  return _regs[reg & 0x7F];
+}
+
+/**
+ * Overwrite a register without side effects, e.g. to simulate a module that
+ * lost its configuration (0x07..0x09) or does not answer (0x10).
+ */
+void RFM69Sim::poke(uint8_t reg, uint8_t value)
+{
+  update();
+
+  _regs[reg & 0x7F] = value;
+}
+
+/**
+ * Advance the model to the current time: mode transitions, the end of a
+ * transmission and frames on the air.
+ */
+void RFM69Sim::update()
+{
+  uint64_t time = now();
+
+  // mode switch completed
+  if (0 == (_regs[0x27] & 0x80) && time >= _readyAt)
+  {
+    uint8_t flags = 0x80;
+    if (_mode >= MODE_FS)
+      flags |= 0x10;
+    if (MODE_RX == _mode)
+      flags |= 0x40;
+    if (MODE_TX == _mode)
+      flags |= 0x20;
+    _regs[0x27] |= flags;
+  }
+
+  bool ready = _regs[0x27] & 0x80;
+
+  // TxStartCondition FifoNotEmpty: the packet goes on the air as soon as TX is ready
+  if (MODE_TX == _mode && ready && 0 == _txEnd && _fifoCount > 0 && 0 == (_regs[0x28] & 0x08))
+  {
+    unsigned int length = (_regs[0x37] & 0x80) ? _fifo[_fifoHead] : _regs[0x38];
+    _txEnd = time + (uint64_t) airtime(length) * 1000;
+  }
+
+  if (0 != _txEnd && time >= _txEnd)
+  {
+    // the length byte is not part of the payload
+    unsigned int skip = (_regs[0x37] & 0x80) ? 1 : 0;
+    _sentLength = 0;
+    for (unsigned int i = skip; i < _fifoCount; i++)
+      _sent[_sentLength++] = _fifo[(_fifoHead + i) % RFM69SIM_FIFO_SIZE];
+
+    fifoClear();
+    _regs[0x28] |= 0x08;
+    _txEnd = 0;
+    _stats.txFrames++;
+  }
+
+  // frames that are over go into the FIFO; the one on the air sets RSSI and sync match, which latch
+  bool onAir = false;
+  while (_queueCount > 0)
+  {
+    Scheduled* frame = &_queue[_queueHead];
+    if (frame->start > time)
+      break;
+
+    if (frame->end > time)
+    {
+      onAir = true;
+
+      if (MODE_RX == _mode && ready && 0 == (_regs[0x28] & 0x04))
+      {
+        _regs[0x24] = -2 * frame->rssi;
+        agc(frame->rssi);
+        if (_regs[0x24] <= _regs[0x29])
+          _regs[0x27] |= 0x08;
+
+        uint64_t sync = frame->start + preambleTime();
+        if (time >= sync && _rxSince <= sync && frame->start >= _airUntil)
+          _regs[0x27] |= 0x01;
+      }
+      break;
+    }
+
+    receive(frame);
+    _queueHead = (_queueHead + 1) % RFM69SIM_QUEUE;
+    _queueCount--;
+  }
+
+  // RssiValue keeps the level of the packet in the FIFO
+  if (false == onAir && MODE_RX == _mode && ready && 0 == (_regs[0x28] & 0x04))
+  {
+    _regs[0x24] = -2 * _noise;
+    agc(_noise);
+    if (_regs[0x24] <= _regs[0x29])
+      _regs[0x27] |= 0x08;
+  }
+}
+
+/**
+ * Set LnaCurrentGain (RegLna bits 5:3) for a signal level: the AGC lowers the
+ * gain from G1 (highest) in steps for stronger signals, unless LnaGainSelect
+ * fixes it.
+ */
+void RFM69Sim::agc(int rssi)
+{
+  unsigned int gain = _regs[0x18] & 0x07;
+
+  if (0 == gain || gain > 6)
+    gain = (rssi < -90) ? 1 : (rssi >= -40) ? 6 : 2 + (rssi + 90) / 10;
+
+  _regs[0x18] = (_regs[0x18] & ~0x38) | (gain << 3);
+}
+
+/**
+ * Decide about a frame that is over: into the FIFO, missed, collided or filtered.
+ */
+void RFM69Sim::receive(const Scheduled* frame)
+{
+  if (frame->start < _airUntil)
+  {
+    _stats.rxCollided++;
+    return;
+  }
+  _airUntil = frame->end;
+
+  // another channel: outside the receiver bandwidth
+  uint32_t frf = (_regs[0x07] << 16) | (_regs[0x08] << 8) | _regs[0x09];
+  uint32_t carrier = ((uint64_t) frf * RFM69_XO) >> 19;
+  uint32_t offset = (frame->frequency > carrier) ? frame->frequency - carrier : carrier - frame->frequency;
+  bool variable = _regs[0x37] & 0x80;
+
+  if ((0 != frame->frequency && offset > rfm69RxBandwidth(_regs[0x19] & 0x1F))
+      || (variable && frame->length > _regs[0x38]))
+  {
+    _stats.rxFiltered++;
+    return;
+  }
+
+  // the receiver has to run before the sync word starts, and the FIFO has to be free
+  bool ready = _regs[0x27] & 0x80;
+  if (MODE_RX != _mode || false == ready || _rxSince > frame->start + preambleTime() || _fifoCount > 0
+      || (_regs[0x28] & 0x04))
+  {
+    _stats.rxMissed++;
+    return;
+  }
+
+  unsigned int length = variable ? frame->length : _regs[0x38];
+  _fifoHead = 0;
+  if (variable)
+    _fifo[_fifoCount++] = length;
+  for (unsigned int i = 0; i < length && _fifoCount < RFM69SIM_FIFO_SIZE; i++)
+    _fifo[_fifoCount++] = (i < frame->length) ? frame->data[i] : 0;
+  fifoFlags();
+
+  _regs[0x28] |= 0x06; // PayloadReady, CrcOk
+  _regs[0x24] = -2 * frame->rssi;
+  _stats.rxFrames++;
+}
+
+/**
+ * Read a register; reading 0x00 pops the FIFO.
+ */
+uint8_t RFM69Sim::readRegister(uint8_t reg)
+{
+  if (0x00 != reg)
+    return _regs[reg];
+
+  if (0 == _fifoCount)
+    return 0;
+
+  uint8_t value = _fifo[_fifoHead];
+  _fifoHead = (_fifoHead + 1) % RFM69SIM_FIFO_SIZE;
+  _fifoCount--;
+  fifoFlags();
+
+  // packet read: PayloadReady and SyncAddressMatch clear, AutoRxRestartOn restarts the receiver
+  if (0 == _fifoCount && (_regs[0x28] & 0x04))
+  {
+    _regs[0x28] &= ~0x06;
+    _regs[0x27] &= ~0x01;
+    if (MODE_RX == _mode && (_regs[0x3D] & 0x02))
+    {
+      _rxSince = now();
+      _regs[0x27] &= ~0x08;
+    }
+  }
+
+  return value;
+}
+
+/**
+ * Write a register; writing 0x00 pushes into the FIFO.
+ */
+void RFM69Sim::writeRegister(uint8_t reg, uint8_t value)
+{
+  switch (reg)
+  {
+  case 0x00:
+    if (_fifoCount >= RFM69SIM_FIFO_SIZE)
+    {
+      _regs[0x28] |= 0x10;
+      _stats.overruns++;
+      return;
+    }
+    _fifo[(_fifoHead + _fifoCount++) % RFM69SIM_FIFO_SIZE] = value;
+    fifoFlags();
+    break;
+  case 0x01:
+    _regs[0x01] = value & 0xFC;
+    setMode((value >> 2) & 0x07);
+    break;
+  case 0x10: // version
+  case 0x24: // RssiValue
+  case 0x27: // IrqFlags1
+    break;
+  case 0x28:
+    // FifoOverrun: clears the FIFO and its flags
+    if (value & 0x10)
+      fifoClear();
+    break;
+  case 0x18:
+    // LnaCurrentGain is read-only
+    _regs[0x18] = (value & ~0x38) | (_regs[0x18] & 0x38);
+    break;
+  case 0x3D:
+    _regs[0x3D] = value & ~0x04;
+    // RestartRx: a packet in reception is lost
+    if ((value & 0x04) && MODE_RX == _mode)
+    {
+      _rxSince = now();
+      _regs[0x27] &= ~0x09;
+    }
+    break;
+  default:
+    _regs[reg] = value;
+    break;
+  }
+}
+
+/**
+ * Start a mode switch; ModeReady is set by update() after the start-up times.
+ */
+void RFM69Sim::setMode(unsigned int mode)
+{
+  if (mode > MODE_RX || mode == _mode)
+    return;
+
+  // sleep 0, standby 1, FS 2, RX/TX 3
+  unsigned int from = (_mode > MODE_FS) ? 3 : _mode;
+  unsigned int to = (mode > MODE_FS) ? 3 : mode;
+  unsigned int delay = 0;
+
+  if (from < 1 && to >= 1)
+    delay += RFM69SIM_TS_OSC;
+  if (from < 2 && to >= 2)
+    delay += RFM69SIM_TS_FS;
+  if (3 == to)
+    delay += RFM69SIM_TS_TR;
+
+  // PacketSent clears when TX is left; a packet on the air is aborted
+  if (MODE_TX == _mode)
+  {
+    _regs[0x28] &= ~0x08;
+    _txEnd = 0;
+  }
+
+  _mode = mode;
+  _readyAt = now() + (uint64_t) delay * 1000;
+  _rxSince = (MODE_RX == mode) ? _readyAt : NEVER;
+  _regs[0x27] &= ~0xF9;
+  _stats.modeChanges++;
+}
+
+/**
+ * Empty the FIFO and clear its flags.
+ */
+void RFM69Sim::fifoClear()
+{
+  _fifoHead = 0;
+  _fifoCount = 0;
+  _regs[0x28] &= ~0xF6;
+}
+
+/**
+ * Update FifoFull, FifoNotEmpty and FifoLevel.
+ */
+void RFM69Sim::fifoFlags()
+{
+  _regs[0x28] &= ~0xE0;
+  if (_fifoCount >= RFM69SIM_FIFO_SIZE)
+    _regs[0x28] |= 0x80;
+  if (_fifoCount > 0)
+    _regs[0x28] |= 0x40;
+  if (_fifoCount > (unsigned int) (_regs[0x3C] & 0x7F))
+    _regs[0x28] |= 0x20;
+}
+
+/**
+ * Get the duration of one bit at the configured bitrate [ns].
+ */
+uint64_t RFM69Sim::bitTime()
+{
+  unsigned int bitrate = (_regs[0x03] << 8) | _regs[0x04];
+
+  return ((uint64_t) bitrate * 1000000000) / RFM69_XO;
+}
+
+/**
+ * Get the time from the start of a frame until its sync word starts [ns].
+ */
+uint64_t RFM69Sim::preambleTime()
+{
+  return ((_regs[0x2C] << 8) | _regs[0x2D]) * 8 * bitTime();
+}
+
+/** @}
+ *
+ */
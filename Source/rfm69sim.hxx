@@ -0,0 +1,172 @@
+/**
+ * @file rfm69sim.hxx
+ *
+ * @brief Register level simulator of the RFM69 (SX1231) on the host.
+ *
+ * RFM69Sim is an SPI transport: pass it to RFM69(SPIBase*) instead of a spidev
+ * device and the unchanged driver runs against it on any machine. The model
+ * decodes the SPI protocol (write bit, address auto-increment, FIFO access
+ * without increment) and keeps the register file, the 66 byte FIFO and the IRQ
+ * flags consistent with the mode:
+ *
+ * - a mode switch sets ModeReady (and RxReady/TxReady/PllLock) only after the
+ *   oscillator, synthesizer and transceiver start-up times;
+ * - in TX the packet in the FIFO is on the air for its airtime (preamble, sync
+ *   word, length byte, payload and CRC at the configured bitrate) before
+ *   PacketSent is set and the FIFO is emptied;
+ * - frames are scheduled with inject() for a start time and RSSI. While one is
+ *   on the air the RSSI register follows it and it sets the Rssi and
+ *   SyncAddressMatch flags; at its end it lands in the FIFO with PayloadReady if
+ *   the receiver ran before the sync word started and the FIFO was empty,
+ *   otherwise it is counted as missed. Overlapping frames collide: the first
+ *   one wins;
+ * - as on the chip, Rssi and SyncAddressMatch stay set until the receiver
+ *   restarts (RestartRx, AutoRxRestartOn once the packet has been read, or a
+ *   mode change); SyncAddressMatch also clears when the FIFO has been read. A
+ *   noise level above RssiThreshold (setNoise()) sets Rssi without a packet;
+ * - the AGC sets LnaCurrentGain in RegLna from the RSSI in RX, whatever has
+ *   been written to these read-only bits.
+ *
+ * Time is CLOCK_MONOTONIC, like the timeouts of the driver. The model advances
+ * on every SPI transaction, so the driver sees the same sequence of flags as
+ * on the real module, including busy waits for ModeReady. AES, OOK, listen mode,
+ * the temperature sensor and address filtering are not modelled.
+ */
+
+#ifndef RFM69SIM_HXX_
+#define RFM69SIM_HXX_
+
+#include <stdint.h>
+
+#include "spibase.hxx"
+
+/** @addtogroup RFM69
+ * @{
+ */
+#define RFM69SIM_REGISTERS    0x80  ///< Address space (7 bit)
+#define RFM69SIM_FIFO_SIZE    66    ///< FIFO size [bytes]
+#define RFM69SIM_QUEUE        64    ///< Frames that can be scheduled
+#define RFM69SIM_NOISE        -120  ///< Default RSSI without a frame on the air; below the default RssiThreshold [dBm]
+#define RFM69SIM_TS_OSC       250   ///< Sleep to standby: crystal oscillator wake-up [us]
+#define RFM69SIM_TS_FS        60    ///< Standby to FS: synthesizer wake-up [us]
+#define RFM69SIM_TS_TR        100   ///< FS to RX or TX, RX to TX and back [us]
+
+/** Simulator counters. */
+typedef struct
+{
+  unsigned int transfers;   //!< SPI transactions
+  unsigned int bytes;       //!< Bytes clocked, including the address bytes
+  unsigned int modeChanges; //!< Writes of RegOpMode that changed the mode
+  unsigned int rxFrames;    //!< Scheduled frames that landed in the FIFO
+  unsigned int rxMissed;    //!< Frames lost: receiver not ready or FIFO still full
+  unsigned int rxCollided;  //!< Frames lost because another frame was on the air
+  unsigned int rxFiltered;  //!< Frames on another channel or too long for PayloadLength
+  unsigned int txFrames;    //!< Packets sent
+  unsigned int overruns;    //!< FIFO writes to a full FIFO
+} RFM69SimStats;
+
+/** Simulated RFM69 module behind an SPI bus. */
+class RFM69Sim : public SPIBase
+{
+public:
+  RFM69Sim();
+  virtual ~RFM69Sim();
+
+  void transfer(const uint8_t* tx, uint8_t* rx, unsigned int length);
+
+  void read(uint8_t address, uint8_t* rx, unsigned int length);
+
+  bool reset();
+
+  bool inject(const uint8_t* payload, unsigned int length, int rssi, uint64_t start = 0, unsigned int frequency = 0);
+
+  unsigned int airtime(unsigned int length);
+
+  bool getDio0();
+
+  int getSent(uint8_t* payload, unsigned int maxLength);
+
+  uint8_t peek(uint8_t reg);
+
+  void poke(uint8_t reg, uint8_t value);
+
+  /**
+   * Set the RSSI without a frame on the air [dBm].
+   */
+  void setNoise(int rssi)
+  {
+    _noise = rssi;
+  }
+
+  static uint64_t now();
+
+  /**
+   * Get the number of frames scheduled but not yet over.
+   */
+  unsigned int getPending()
+  {
+    return _queueCount;
+  }
+
+  /**
+   * Get the simulator counters.
+   */
+  const RFM69SimStats& getStats()
+  {
+    return _stats;
+  }
+
+private:
+  typedef struct
+  {
+    uint64_t start;                   // first preamble bit on the air [ns]
+    uint64_t end;                     // last CRC bit on the air [ns]
+    int16_t rssi;
+    uint32_t frequency;
+    uint8_t length;
+    uint8_t data[RFM69SIM_FIFO_SIZE];
+  } Scheduled;
+
+  void update();
+
+  uint8_t readRegister(uint8_t reg);
+
+  void writeRegister(uint8_t reg, uint8_t value);
+
+  void setMode(unsigned int mode);
+
+  void receive(const Scheduled* frame);
+
+  void fifoClear();
+
+  void fifoFlags();
+
+  void agc(int rssi);
+
+  uint64_t bitTime();
+
+  uint64_t preambleTime();
+
+  uint8_t _regs[RFM69SIM_REGISTERS];
+  uint8_t _fifo[RFM69SIM_FIFO_SIZE];
+  unsigned int _fifoHead;
+  unsigned int _fifoCount;
+  unsigned int _mode;
+  uint64_t _readyAt;
+  uint64_t _rxSince;
+  uint64_t _txEnd;
+  uint64_t _airUntil;
+  int _noise;
+  uint8_t _sent[RFM69SIM_FIFO_SIZE];
+  unsigned int _sentLength;
+  Scheduled _queue[RFM69SIM_QUEUE];
+  unsigned int _queueHead;
+  unsigned int _queueCount;
+  RFM69SimStats _stats;
+};
+
+/** @}
+ *
+ */
+
+#endif /* RFM69SIM_HXX_ */
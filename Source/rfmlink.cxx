@@ -0,0 +1,565 @@
+/**
+ * @file rfmlink.cxx
+ *
+ * @brief Optional reliable link layer on top of the RFM69 driver.
+ *
+ * See rfmlink.hxx for the frame layout.
+ */
+
+/** @addtogroup RFMLink
+ * @{
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "rfmlink.hxx"
+
+/**
+ * RFMLink constructor.
+ *
+ * @param transport Transport used to put frames on the air
+ * @param handler Receives in-order payloads and failure notifications
+ * @param address Own node address
+ * @param window Maximum number of unacknowledged frames per peer (1..RFMLINK_MAX_WINDOW)
+ */
+RFMLink::RFMLink(RFMLinkTransport* transport, RFMLinkHandler* handler, uint8_t address,
+    unsigned int window)
+{
+  _transport = transport;
+  _handler = handler;
+  _address = address;
+
+  if (window < 1)
+    window = 1;
+  if (window > RFMLINK_MAX_WINDOW)
+    window = RFMLINK_MAX_WINDOW;
+  _window = window;
+
+  memset(&_stats, 0, sizeof(_stats));
+  memset(_peers, 0, sizeof(_peers));
+}
+
+/**
+ * Look up the state of a peer node.
+ *
+ * @param address Address of the peer
+ * @param create Allocate a free entry if the peer is unknown
+ * @return Pointer to the peer; 0 if unknown or no free entry is left.
+ */
+RFMLink::Peer* RFMLink::findPeer(uint8_t address, bool create)
+{
+  Peer* freePeer = 0;
+
+  for (unsigned int i = 0; i < RFMLINK_MAX_PEERS; i++)
+  {
+    if (_peers[i].used)
+    {
+      if (_peers[i].address == address)
+        return &_peers[i];
+    }
+    else if (0 == freePeer)
+    {
+      freePeer = &_peers[i];
+    }
+  }
+
+  if (false == create || 0 == freePeer)
+    return 0;
+
+  memset(freePeer, 0, sizeof(Peer));
+  freePeer->used = true;
+  freePeer->address = address;
+  freePeer->txNeedSync = true;
+  freePeer->rto = RFMLINK_INITIAL_RTO;
+
+  return freePeer;
+}
+
+/**
+ * Queue a payload for acknowledged delivery and transmit it immediately.
+ *
+ * @param destination Address of the peer node
+ * @param data Pointer to the payload
+ * @param dataLength Length of the payload; at most RFMLINK_MAX_PAYLOAD bytes
+ * @param now Current time [ms]
+ * @return Sequence number of the frame; -1 if the window is full, -2 on invalid arguments.
+ */
+int RFMLink::send(uint8_t destination, const void* data, unsigned int dataLength, uint32_t now)
+{
+  if (0 == dataLength || dataLength > RFMLINK_MAX_PAYLOAD || RFMLINK_BROADCAST == destination)
+    return -2;
+
+  Peer* peer = findPeer(destination, true);
+  if (0 == peer)
+    return -2;
+
+  // window full?
+  if ((uint8_t)(peer->txNext - peer->txBase) >= _window)
+    return -1;
+
+  uint8_t seq = peer->txNext++;
+  TxSlot* slot = &peer->tx[seq % RFMLINK_MAX_WINDOW];
+
+  memcpy(slot->data, data, dataLength);
+  slot->length = dataLength;
+  slot->retries = 0;
+  slot->acked = false;
+  slot->retransmitted = false;
+
+  transmitData(peer, seq, now);
+  _stats.framesSent++;
+
+  return seq;
+}
+
+/**
+ * Put a data frame on the air and arm its retransmit timer.
+ */
+void RFMLink::transmitData(Peer* peer, uint8_t seq, uint32_t now)
+{
+  TxSlot* slot = &peer->tx[seq % RFMLINK_MAX_WINDOW];
+  uint8_t frame[RFMLINK_HEADER_SIZE + RFMLINK_MAX_PAYLOAD];
+
+  frame[0] = RFMLINK_MARKER | RFMLINK_TYPE_DATA;
+  // only the oldest outstanding frame tells the receiver where to start
+  if (peer->txNeedSync && seq == peer->txBase)
+    frame[0] |= RFMLINK_FLAG_SYNC;
+  frame[1] = peer->address;
+  frame[2] = _address;
+  frame[3] = seq;
+  memcpy(frame + RFMLINK_HEADER_SIZE, slot->data, slot->length);
+
+  _transport->transmit(frame, RFMLINK_HEADER_SIZE + slot->length);
+
+  slot->sentAt = now;
+  slot->deadline = now + peer->rto;
+}
+
+/**
+ * Send a cumulative + selective acknowledgement for everything received from a peer.
+ */
+void RFMLink::transmitAck(Peer* peer)
+{
+  uint8_t frame[RFMLINK_HEADER_SIZE + 4];
+
+  // rxMask bit 0 is rxExpected itself which is never set here
+  uint32_t bitmap = peer->rxMask >> 1;
+
+  frame[0] = RFMLINK_MARKER | RFMLINK_TYPE_ACK;
+  frame[1] = peer->address;
+  frame[2] = _address;
+  frame[3] = peer->rxExpected;
+  frame[4] = bitmap;
+  frame[5] = bitmap >> 8;
+  frame[6] = bitmap >> 16;
+  frame[7] = bitmap >> 24;
+
+  _transport->transmit(frame, sizeof(frame));
+  _stats.acksSent++;
+}
+
+/**
+ * Ask the sender for its oldest outstanding frame with FLAG_SYNC.
+ */
+void RFMLink::transmitSyncRequest(Peer* peer)
+{
+  uint8_t frame[RFMLINK_HEADER_SIZE + 4] = { 0 };
+
+  frame[0] = RFMLINK_MARKER | RFMLINK_TYPE_ACK | RFMLINK_FLAG_SYNC;
+  frame[1] = peer->address;
+  frame[2] = _address;
+
+  _transport->transmit(frame, sizeof(frame));
+  _stats.acksSent++;
+}
+
+/**
+ * Feed a received frame into the link.
+ *
+ * Frames that are no link frames or are addressed to another node are ignored
+ * and may be processed by the caller.
+ *
+ * @param frame Pointer to the received frame (without RFM69 length byte)
+ * @param frameLength Length of the frame
+ * @param now Current time [ms]
+ * @return true if the frame was a link frame for this node and has been consumed.
+ */
+bool RFMLink::input(const uint8_t* frame, unsigned int frameLength, uint32_t now)
+{
+  if (frameLength < RFMLINK_HEADER_SIZE)
+    return false;
+
+  if ((frame[0] & 0xF0) != RFMLINK_MARKER)
+    return false;
+
+  if (frame[1] != _address && frame[1] != RFMLINK_BROADCAST)
+    return false;
+
+  uint8_t type = frame[0] & 0x03;
+  uint8_t flags = frame[0] & 0x0C;
+
+  Peer* peer = findPeer(frame[2], true);
+  if (0 == peer)
+    return true;
+
+  if (RFMLINK_TYPE_DATA == type)
+  {
+    handleData(peer, flags, frame[3], frame + RFMLINK_HEADER_SIZE, frameLength - RFMLINK_HEADER_SIZE);
+  }
+  else if (RFMLINK_TYPE_ACK == type && (flags & RFMLINK_FLAG_SYNC))
+  {
+    _stats.acksReceived++;
+    handleSyncRequest(peer, now);
+  }
+  else if (RFMLINK_TYPE_ACK == type && frameLength >= RFMLINK_HEADER_SIZE + 4)
+  {
+    uint32_t bitmap = frame[4] | (frame[5] << 8) | (frame[6] << 16) | ((uint32_t)frame[7] << 24);
+    _stats.acksReceived++;
+    handleAck(peer, frame[3], bitmap, now);
+  }
+
+  return true;
+}
+
+/**
+ * Receiver side: buffer the frame, deliver everything that is now in order and ACK.
+ */
+void RFMLink::handleData(Peer* peer, uint8_t flags, uint8_t seq, const uint8_t* data,
+    unsigned int dataLength)
+{
+  if (dataLength > RFMLINK_MAX_PAYLOAD)
+    dataLength = RFMLINK_MAX_PAYLOAD;
+
+  // (re)synchronise to the sender, but never to a retransmission of something already delivered
+  if (false == peer->rxSynced && (flags & RFMLINK_FLAG_SYNC))
+  {
+    rebase(peer, seq);
+    peer->rxSynced = true;
+  }
+  else if (false == peer->rxSynced)
+  {
+    // where the sender starts is not known yet: keep the frame, but neither deliver nor ACK it
+    if (0 == peer->rxMask || (uint8_t)(seq - peer->rxExpected) >= RFMLINK_MAX_WINDOW)
+      rebase(peer, seq);
+
+    unsigned int index = seq % RFMLINK_MAX_WINDOW;
+    memcpy(peer->rxData[index], data, dataLength);
+    peer->rxLength[index] = dataLength;
+    peer->rxMask |= 1UL << (uint8_t)(seq - peer->rxExpected);
+
+    transmitSyncRequest(peer);
+    return;
+  }
+  else if ((flags & RFMLINK_FLAG_SYNC) && seq != peer->rxExpected
+      && (uint8_t)(peer->rxExpected - seq) > RFMLINK_MAX_WINDOW)
+  {
+    resync(peer, seq);
+  }
+
+  uint8_t offset = seq - peer->rxExpected;
+
+  if (offset < RFMLINK_MAX_WINDOW)
+  {
+    if (peer->rxMask & (1UL << offset))
+    {
+      _stats.duplicates++;
+    }
+    else
+    {
+      unsigned int index = seq % RFMLINK_MAX_WINDOW;
+      memcpy(peer->rxData[index], data, dataLength);
+      peer->rxLength[index] = dataLength;
+      peer->rxMask |= (1UL << offset);
+    }
+
+    // deliver in order
+    while (peer->rxMask & 1)
+    {
+      deliver(peer);
+      peer->rxMask >>= 1;
+      peer->rxExpected++;
+    }
+  }
+  else
+  {
+    // old frame whose ACK got lost; just ACK again
+    _stats.duplicates++;
+  }
+
+  transmitAck(peer);
+}
+
+/**
+ * Receiver side: the sender gave up on the frames in front of seq and starts
+ * over there. Frames buffered before seq have been acknowledged already: they
+ * are delivered in order and the gaps between them are counted as lost. If seq
+ * is within the window, frames buffered from seq on are kept.
+ */
+void RFMLink::resync(Peer* peer, uint8_t seq)
+{
+  bool inWindow = (uint8_t)(seq - peer->rxExpected) < RFMLINK_MAX_WINDOW;
+
+  while (peer->rxExpected != seq && (inWindow || 0 != peer->rxMask))
+  {
+    if (peer->rxMask & 1)
+      deliver(peer);
+    else
+      _stats.lost++;
+
+    peer->rxMask >>= 1;
+    peer->rxExpected++;
+  }
+
+  peer->rxExpected = seq;
+}
+
+/**
+ * Receiver side, not in sync yet: move the window to start at seq. Frames
+ * buffered from seq on are kept, the ones in front of it dropped.
+ */
+void RFMLink::rebase(Peer* peer, uint8_t seq)
+{
+  uint8_t ahead = seq - peer->rxExpected;
+  uint8_t behind = peer->rxExpected - seq;
+
+  if (ahead < RFMLINK_MAX_WINDOW)
+    peer->rxMask >>= ahead;
+  else if (behind < RFMLINK_MAX_WINDOW)
+    peer->rxMask <<= behind;
+  else
+    peer->rxMask = 0;
+
+  peer->rxExpected = seq;
+}
+
+/**
+ * Receiver side: hand the buffered frame rxExpected to the handler.
+ */
+void RFMLink::deliver(Peer* peer)
+{
+  unsigned int index = peer->rxExpected % RFMLINK_MAX_WINDOW;
+
+  _stats.delivered++;
+  if (0 != _handler)
+    _handler->linkDeliver(peer->address, peer->rxData[index], peer->rxLength[index]);
+}
+
+/**
+ * Sender side: mark acknowledged frames, take RTT samples and slide the window.
+ */
+void RFMLink::handleAck(Peer* peer, uint8_t cumAck, uint32_t bitmap, uint32_t now)
+{
+  uint8_t outstanding = peer->txNext - peer->txBase;
+
+  // ignore ACKs that acknowledge frames we never sent
+  if ((uint8_t)(cumAck - peer->txBase) > outstanding)
+    return;
+
+  for (uint8_t i = 0; i < outstanding; i++)
+  {
+    uint8_t seq = peer->txBase + i;
+    TxSlot* slot = &peer->tx[seq % RFMLINK_MAX_WINDOW];
+
+    if (slot->acked)
+      continue;
+
+    uint8_t offset = seq - cumAck;
+    bool acked;
+
+    if ((uint8_t)(seq - peer->txBase) < (uint8_t)(cumAck - peer->txBase))
+      acked = true;
+    else if (offset >= 1 && offset <= 32)
+      acked = (bitmap >> (offset - 1)) & 1;
+    else
+      acked = false;
+
+    if (acked)
+    {
+      slot->acked = true;
+
+      // Karn's rule: no samples from retransmitted frames
+      if (false == slot->retransmitted)
+        updateRTT(peer, now - slot->sentAt);
+    }
+  }
+
+  // the receiver is in sync once anything has been acknowledged
+  if (peer->tx[peer->txBase % RFMLINK_MAX_WINDOW].acked)
+    peer->txNeedSync = false;
+
+  advanceWindow(peer);
+}
+
+/**
+ * Sender side: the receiver does not know where to start. The oldest
+ * outstanding frame goes out again with FLAG_SYNC, unless it is on its way
+ * with it already.
+ */
+void RFMLink::handleSyncRequest(Peer* peer, uint32_t now)
+{
+  if (peer->txNeedSync || peer->txBase == peer->txNext)
+    return;
+
+  TxSlot* slot = &peer->tx[peer->txBase % RFMLINK_MAX_WINDOW];
+
+  peer->txNeedSync = true;
+  slot->retransmitted = true;
+  transmitData(peer, peer->txBase, now);
+  _stats.retransmissions++;
+}
+
+/**
+ * Move the window base over all acknowledged frames.
+ */
+void RFMLink::advanceWindow(Peer* peer)
+{
+  while (peer->txBase != peer->txNext && peer->tx[peer->txBase % RFMLINK_MAX_WINDOW].acked)
+    peer->txBase++;
+}
+
+/**
+ * Update smoothed RTT and retransmit timeout with a new sample (RFC 6298).
+ *
+ * @param sample Measured round trip time [ms]
+ */
+void RFMLink::updateRTT(Peer* peer, uint32_t sample)
+{
+  if (false == peer->rttValid)
+  {
+    peer->srtt = sample;
+    peer->rttvar = sample / 2;
+    peer->rttValid = true;
+  }
+  else
+  {
+    uint32_t delta = (peer->srtt > sample) ? peer->srtt - sample : sample - peer->srtt;
+    peer->rttvar = (3 * peer->rttvar + delta) / 4;
+    peer->srtt = (7 * peer->srtt + sample) / 8;
+  }
+
+  uint32_t rto = peer->srtt + ((4 * peer->rttvar > 1) ? 4 * peer->rttvar : 1);
+
+  if (rto < RFMLINK_MIN_RTO)
+    rto = RFMLINK_MIN_RTO;
+  if (rto > RFMLINK_MAX_RTO)
+    rto = RFMLINK_MAX_RTO;
+
+  peer->rto = rto;
+}
+
+/**
+ * Retransmit all frames whose timeout has expired.
+ *
+ * Call this periodically or when the time returned by nextTimeout() has passed.
+ *
+ * @param now Current time [ms]
+ */
+void RFMLink::poll(uint32_t now)
+{
+  for (unsigned int p = 0; p < RFMLINK_MAX_PEERS; p++)
+  {
+    Peer* peer = &_peers[p];
+    if (false == peer->used)
+      continue;
+
+    bool backoff = false;
+    uint8_t outstanding = peer->txNext - peer->txBase;
+
+    for (uint8_t i = 0; i < outstanding; i++)
+    {
+      uint8_t seq = peer->txBase + i;
+      TxSlot* slot = &peer->tx[seq % RFMLINK_MAX_WINDOW];
+
+      if (slot->acked || (int32_t)(now - slot->deadline) < 0)
+        continue;
+
+      if (slot->retries >= RFMLINK_MAX_RETRIES)
+      {
+        // give up; the receiver has to resynchronise on the next frame
+        slot->acked = true;
+        peer->txNeedSync = true;
+        _stats.failed++;
+        if (0 != _handler)
+          _handler->linkFailed(peer->address, seq);
+        continue;
+      }
+
+      if (false == backoff)
+      {
+        // exponential backoff, once per poll and peer
+        peer->rto = (peer->rto * 2 > RFMLINK_MAX_RTO) ? RFMLINK_MAX_RTO : peer->rto * 2;
+        backoff = true;
+      }
+
+      slot->retries++;
+      slot->retransmitted = true;
+      transmitData(peer, seq, now);
+      _stats.retransmissions++;
+    }
+
+    advanceWindow(peer);
+  }
+}
+
+/**
+ * Get the time until the next retransmit timer expires.
+ *
+ * @param now Current time [ms]
+ * @return Milliseconds until poll() has work to do; -1 if nothing is outstanding.
+ */
+int RFMLink::nextTimeout(uint32_t now)
+{
+  int timeout = -1;
+
+  for (unsigned int p = 0; p < RFMLINK_MAX_PEERS; p++)
+  {
+    Peer* peer = &_peers[p];
+    if (false == peer->used)
+      continue;
+
+    uint8_t outstanding = peer->txNext - peer->txBase;
+    for (uint8_t i = 0; i < outstanding; i++)
+    {
+      TxSlot* slot = &peer->tx[(uint8_t)(peer->txBase + i) % RFMLINK_MAX_WINDOW];
+      if (slot->acked)
+        continue;
+
+      int32_t remaining = slot->deadline - now;
+      if (remaining < 0)
+        remaining = 0;
+      if (timeout < 0 || remaining < timeout)
+        timeout = remaining;
+    }
+  }
+
+  return timeout;
+}
+
+/**
+ * Get the number of unacknowledged frames towards a peer.
+ */
+unsigned int RFMLink::pending(uint8_t destination)
+{
+  Peer* peer = findPeer(destination, false);
+  if (0 == peer)
+    return 0;
+
+  return (uint8_t)(peer->txNext - peer->txBase);
+}
+
+/**
+ * Get the current retransmit timeout towards a peer [ms].
+ */
+unsigned int RFMLink::getRTO(uint8_t destination)
+{
+  Peer* peer = findPeer(destination, false);
+  if (0 == peer)
+    return RFMLINK_INITIAL_RTO;
+
+  return peer->rto;
+}
+
+/** @}
+ *
+ */
@@ -0,0 +1,216 @@
+/**
+ * @file rfmlink.hxx
+ *
+ * @brief Optional reliable link layer on top of the RFM69 driver.
+ *
+ * Frames sent through RFM69::send() are fire-and-forget. RFMLink adds per-node
+ * sequence numbers, selective acknowledgements and a sliding window, so several
+ * frames can be in flight while waiting for ACKs. Retransmit timeouts are derived
+ * from measured round trip times (RFC 6298 style smoothing with Karn's rule).
+ *
+ * The link does not own a radio; frames go out through an RFMLinkTransport and come
+ * in through input(). This way two RFMLink instances can be wired back to back to
+ * simulate a peer node without any hardware.
+ *
+ * Link frame layout (inside the RFM69 payload, length byte not included):
+ *
+ *   DATA: [type|flags] [dst] [src] [seq] [payload ...]
+ *   ACK:  [type|flags] [dst] [src] [cumulative ack] [sack bitmap, 4 bytes LSB first]
+ *
+ * The cumulative ack is the next sequence number the receiver expects; bit n of the
+ * bitmap acknowledges sequence number (cumulative ack + 1 + n).
+ *
+ * The oldest outstanding frame carries FLAG_SYNC until something has been
+ * acknowledged: the receiver starts its window only there. Data that arrives
+ * before is buffered, and answered with an ACK with FLAG_SYNC (a sync request,
+ * e.g. after a restart of the receiver): the sender retransmits its oldest
+ * frame with FLAG_SYNC right away.
+ */
+
+#ifndef RFMLINK_HXX_
+#define RFMLINK_HXX_
+
+#include <stdint.h>
+
+/** @addtogroup RFMLink
+ * @{
+ */
+#define RFMLINK_HEADER_SIZE   4   ///< Bytes of link header in front of the payload
+#define RFMLINK_MAX_PAYLOAD   (64 - RFMLINK_HEADER_SIZE) ///< Maximum payload per link frame
+#define RFMLINK_MAX_WINDOW    32  ///< Upper limit of the window (width of the SACK bitmap)
+#define RFMLINK_MAX_PEERS     8   ///< Number of nodes a link can talk to at the same time
+#define RFMLINK_MAX_RETRIES   8   ///< Retransmissions before a frame is given up
+#define RFMLINK_MIN_RTO       50  ///< Lower bound for the retransmit timeout [ms]
+#define RFMLINK_MAX_RTO       5000 ///< Upper bound for the retransmit timeout [ms]
+#define RFMLINK_INITIAL_RTO   500 ///< Retransmit timeout before the first RTT sample [ms]
+#define RFMLINK_BROADCAST     0xFF ///< Destination address accepted by every node
+
+#define RFMLINK_MARKER        0xA0 ///< High nibble of the type byte of every link frame
+#define RFMLINK_TYPE_DATA     0x01 ///< Frame carries payload
+#define RFMLINK_TYPE_ACK      0x02 ///< Frame carries cumulative and selective ACK
+#define RFMLINK_FLAG_SYNC     0x04 ///< DATA: receiver shall (re)synchronise to this sequence number; ACK: sync request
+
+/**
+ * Interface used by RFMLink to put frames on the air.
+ */
+class RFMLinkTransport
+{
+public:
+  virtual ~RFMLinkTransport()
+  {
+  }
+
+  /**
+   * Transmit a single link frame.
+   *
+   * @param data Pointer to the frame
+   * @param dataLength Length of the frame in bytes
+   * @return Number of bytes sent; <= 0 on failure.
+   */
+  virtual int transmit(const uint8_t* data, unsigned int dataLength) = 0;
+};
+
+/**
+ * Callbacks of RFMLink towards the application.
+ */
+class RFMLinkHandler
+{
+public:
+  virtual ~RFMLinkHandler()
+  {
+  }
+
+  /**
+   * Called for every payload received in order from a peer node.
+   */
+  virtual void linkDeliver(uint8_t source, const uint8_t* data, unsigned int dataLength) = 0;
+
+  /**
+   * Called when a frame could not be delivered after RFMLINK_MAX_RETRIES retransmissions.
+   */
+  virtual void linkFailed(uint8_t destination, uint8_t seq)
+  {
+  }
+};
+
+/** Link statistics. */
+typedef struct
+{
+  unsigned int framesSent;       //!< Data frames transmitted the first time
+  unsigned int retransmissions;  //!< Data frames retransmitted
+  unsigned int acksSent;         //!< ACK frames transmitted
+  unsigned int acksReceived;     //!< ACK frames received
+  unsigned int delivered;        //!< Payloads handed to the handler
+  unsigned int duplicates;       //!< Data frames received more than once
+  unsigned int failed;           //!< Frames given up after too many retries
+  unsigned int lost;             //!< Frames skipped when the sender resynchronised after giving up on them
+} RFMLinkStats;
+
+/** Reliable, windowed link layer for RFM69 frames. */
+class RFMLink
+{
+public:
+  RFMLink(RFMLinkTransport* transport, RFMLinkHandler* handler, uint8_t address,
+      unsigned int window = 8);
+
+  int send(uint8_t destination, const void* data, unsigned int dataLength, uint32_t now);
+
+  bool input(const uint8_t* frame, unsigned int frameLength, uint32_t now);
+
+  void poll(uint32_t now);
+
+  int nextTimeout(uint32_t now);
+
+  unsigned int pending(uint8_t destination);
+
+  unsigned int getRTO(uint8_t destination);
+
+  /**
+   * Get the link statistics.
+   */
+  const RFMLinkStats& getStats()
+  {
+    return _stats;
+  }
+
+  /**
+   * Get the own node address.
+   */
+  uint8_t getAddress()
+  {
+    return _address;
+  }
+
+private:
+  typedef struct
+  {
+    uint8_t data[RFMLINK_MAX_PAYLOAD];
+    uint8_t length;
+    uint8_t retries;
+    bool acked;
+    bool retransmitted;
+    uint32_t sentAt;
+    uint32_t deadline;
+  } TxSlot;
+
+  typedef struct
+  {
+    bool used;
+    uint8_t address;
+
+    // sender side
+    uint8_t txBase;
+    uint8_t txNext;
+    bool txNeedSync;
+    TxSlot tx[RFMLINK_MAX_WINDOW];
+    bool rttValid;
+    uint32_t srtt;
+    uint32_t rttvar;
+    uint32_t rto;
+
+    // receiver side
+    bool rxSynced;
+    uint8_t rxExpected;
+    uint32_t rxMask;
+    uint8_t rxLength[RFMLINK_MAX_WINDOW];
+    uint8_t rxData[RFMLINK_MAX_WINDOW][RFMLINK_MAX_PAYLOAD];
+  } Peer;
+
+  Peer* findPeer(uint8_t address, bool create);
+
+  void transmitData(Peer* peer, uint8_t seq, uint32_t now);
+
+  void transmitAck(Peer* peer);
+
+  void handleData(Peer* peer, uint8_t flags, uint8_t seq, const uint8_t* data,
+      unsigned int dataLength);
+
+  void transmitSyncRequest(Peer* peer);
+
+  void resync(Peer* peer, uint8_t seq);
+
+  void rebase(Peer* peer, uint8_t seq);
+
+  void handleSyncRequest(Peer* peer, uint32_t now);
+
+  void deliver(Peer* peer);
+
+  void handleAck(Peer* peer, uint8_t cumAck, uint32_t bitmap, uint32_t now);
+
+  void updateRTT(Peer* peer, uint32_t sample);
+
+  void advanceWindow(Peer* peer);
+
+  RFMLinkTransport* _transport;
+  RFMLinkHandler* _handler;
+  uint8_t _address;
+  unsigned int _window;
+  RFMLinkStats _stats;
+  Peer _peers[RFMLINK_MAX_PEERS];
+};
+
+/** @}
+ *
+ */
+
+#endif /* RFMLINK_HXX_ */
@@ -0,0 +1,199 @@
+/**
+ * @file scanner.cxx
+ *
+ * @brief Time sliced channel scanner for one radio.
+ */
+
+/** @addtogroup Scanner
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "scanner.hxx"
+
+Scanner::Scanner(Radio* radio)
+{
+  _radio = radio;
+  _loop = 0;
+  _timer = -1;
+  _channelCount = 0;
+  _current = 0;
+  _extended = 0;
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+Scanner::~Scanner()
+{
+  stop();
+}
+
+/**
+ * Append a channel to the scan list.
+ *
+ * @return false if the list is full
+ */
+bool Scanner::addChannel(const ScanChannel& channel)
+{
+  if (_channelCount >= SCANNER_MAX_CHANNELS)
+    return false;
+
+  _channels[_channelCount] = channel;
+  if (0 == _channels[_channelCount].dwell)
+    _channels[_channelCount].dwell = SCANNER_DEFAULT_DWELL;
+  _channelCount++;
+
+  return true;
+}
+
+/**
+ * Parse a scan list of the form "frequency[/sync][@dwell],...".
+ *
+ * Example: 868300000/DEADBEEF@50,868950000/2DD4@80
+ *
+ * @return false on syntax errors or if the list is too long
+ */
+bool Scanner::parse(const char* list)
+{
+  while (*list)
+  {
+    ScanChannel channel;
+    char* end;
+
+    memset(&channel, 0, sizeof(channel));
+
+    channel.frequency = strtoul(list, &end, 10);
+    if (end == list || 0 == channel.frequency)
+      return false;
+    list = end;
+
+    if ('/' == *list)
+    {
+      list++;
+      while (isxdigit(list[0]) && isxdigit(list[1]) && channel.syncLength < sizeof(channel.syncWord))
+      {
+        char byte[3] = { list[0], list[1], 0 };
+        channel.syncWord[channel.syncLength++] = strtoul(byte, 0, 16);
+        list += 2;
+      }
+    }
+
+    if ('@' == *list)
+    {
+      channel.dwell = strtoul(list + 1, &end, 10);
+      list = end;
+    }
+
+    if (',' == *list)
+      list++;
+    else if (*list)
+      return false;
+
+    if (false == addChannel(channel))
+      return false;
+  }
+
+  return true;
+}
+
+/**
+ * Tune to the first channel and start cycling.
+ */
+void Scanner::start(EventLoop* loop)
+{
+  if (0 == _channelCount)
+    return;
+
+  _loop = loop;
+  _timer = timerCreate();
+  _loop->add(_timer, EPOLLIN, this);
+
+  _current = _channelCount - 1;
+  hop();
+}
+
+/**
+ * Stop cycling; the radio stays on the current channel.
+ */
+void Scanner::stop()
+{
+  if (0 == _loop)
+    return;
+
+  _loop->remove(_timer);
+  close(_timer);
+  _timer = -1;
+  _loop = 0;
+}
+
+/**
+ * Dwell time is over: extend it while a frame is in flight, otherwise switch.
+ */
+void Scanner::handleEvent(int fd, uint32_t events)
+{
+  timerRead(_timer);
+
+  // never switch in the middle of a transmission
+  bool busy = _radio->isTransmitting();
+
+  if (false == busy && _extended < SCANNER_MAX_EXTENSION)
+  {
+    uint16_t flags = _radio->getRFM69()->readIrqFlags();
+
+    // Rssi (carrier), SyncAddressMatch or PayloadReady not yet drained
+    busy = (flags & 0x0900) || (flags & 0x0004);
+  }
+
+  if (busy && _extended < SCANNER_MAX_EXTENSION)
+  {
+    _extended += SCANNER_EXTENSION;
+    _stats.extensions++;
+    timerArm(_timer, SCANNER_EXTENSION);
+    return;
+  }
+
+  if (_radio->isTransmitting())
+  {
+    // keep the channel until the downlink packet is out
+    timerArm(_timer, SCANNER_EXTENSION);
+    return;
+  }
+
+  hop();
+}
+
+/**
+ * Switch to the next channel of the list and arm the dwell timer.
+ */
+void Scanner::hop()
+{
+  ScanChannel* previous = &_channels[_current];
+
+  _current = (_current + 1) % _channelCount;
+  _extended = 0;
+
+  ScanChannel* channel = &_channels[_current];
+
+  // only write the sync word if it differs from the one of the previous channel
+  bool syncChanged = channel->syncLength && (channel->syncLength != previous->syncLength
+      || memcmp(channel->syncWord, previous->syncWord, channel->syncLength));
+
+  if (_channelCount > 1 || 0 == _stats.hops)
+  {
+    _radio->tune(channel->frequency, syncChanged || 0 == _stats.hops ? channel->syncWord : 0,
+        channel->syncLength);
+    _stats.hops++;
+  }
+
+  timerArm(_timer, channel->dwell);
+}
+
+/** @}
+ *
+ */
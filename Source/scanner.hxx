@@ -0,0 +1,95 @@
+/**
+ * @file scanner.hxx
+ *
+ * @brief Time sliced channel scanner for one radio.
+ *
+ * The scanner cycles a radio across a list of frequency/sync word pairs with a
+ * dwell time per channel. A channel switch costs one register burst (0x07..0x09,
+ * plus 0x2E.. if the sync word differs) and an RX restart. While the radio sees
+ * a carrier (RSSI above threshold), a sync word match or a pending payload, the
+ * dwell is extended, so frames in flight are not cut off.
+ */
+
+#ifndef SCANNER_HXX_
+#define SCANNER_HXX_
+
+#include <stdint.h>
+
+#include "radio.hxx"
+#include "eventloop.hxx"
+
+/** @addtogroup Scanner
+ * @{
+ */
+#define SCANNER_MAX_CHANNELS    8   ///< Channels per scan list
+#define SCANNER_DEFAULT_DWELL   50  ///< Dwell time if none is given [ms]
+#define SCANNER_EXTENSION       10  ///< Dwell extension while a frame is in flight [ms]
+#define SCANNER_MAX_EXTENSION   250 ///< Maximum extension per dwell (longest frame at low bitrates) [ms]
+
+/** One entry of the scan list. */
+typedef struct
+{
+  unsigned int frequency;   //!< Carrier frequency [Hz]
+  uint8_t syncWord[8];      //!< Sync word
+  unsigned int syncLength;  //!< Sync word length; 0 keeps the sync word of the previous channel
+  unsigned int dwell;       //!< Dwell time [ms]
+} ScanChannel;
+
+/** Scanner counters. */
+typedef struct
+{
+  unsigned int hops;        //!< Channel switches
+  unsigned int extensions;  //!< Dwell extensions because of activity
+} ScanStats;
+
+/** Cycles one radio across several channels. */
+class Scanner : public EventHandler
+{
+public:
+  Scanner(Radio* radio);
+  virtual ~Scanner();
+
+  bool addChannel(const ScanChannel& channel);
+
+  bool parse(const char* list);
+
+  void start(EventLoop* loop);
+
+  void stop();
+
+  void handleEvent(int fd, uint32_t events);
+
+  /**
+   * Get the number of channels in the scan list.
+   */
+  unsigned int getChannelCount()
+  {
+    return _channelCount;
+  }
+
+  /**
+   * Get the scanner counters.
+   */
+  const ScanStats& getStats()
+  {
+    return _stats;
+  }
+
+private:
+  void hop();
+
+  Radio* _radio;
+  EventLoop* _loop;
+  int _timer;
+  ScanChannel _channels[SCANNER_MAX_CHANNELS];
+  unsigned int _channelCount;
+  unsigned int _current;
+  unsigned int _extended;
+  ScanStats _stats;
+};
+
+/** @}
+ *
+ */
+
+#endif /* SCANNER_HXX_ */
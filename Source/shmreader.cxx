@@ -0,0 +1,57 @@
+/**
+ * @file shmreader.cxx
+ *
+ * @brief Example consumer of the shared memory frame ring.
+ *
+ * Prints every frame the bridge publishes with -m. Build with "make shmreader".
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "shmring.hxx"
+
+int
+main(int argc, char *argv[])
+{
+  const char* path = (argc > 1) ? argv[1] : SHMRING_DEFAULT_PATH;
+  ShmRingReader reader;
+
+  while (false == reader.open(path))
+  {
+    // wait for the bridge
+    sleep(1);
+  }
+
+  uint64_t lost = 0;
+  Frame frame;
+
+  while (1)
+  {
+    int ret = reader.read(&frame);
+    if (ret < 0)
+      return 1;
+
+    if (0 == ret)
+    {
+      // nothing new; a real consumer would do its work here
+      usleep(1000);
+      continue;
+    }
+
+    if (reader.getLost() != lost)
+    {
+      lost = reader.getLost();
+      printf("%" PRIu64 " frames lost\n", lost);
+    }
+
+    printf("%" PRIu64 " radio %d %d dBm %u Hz:", frame.timestamp, frame.radio, frame.rssi, frame.frequency);
+    for (unsigned int i = 0; i < frame.length; i++)
+      printf(" %02x", frame.data[i]);
+    printf("\n");
+  }
+
+  return 0;
+}
@@ -0,0 +1,331 @@
+/**
+ * @file shmring.cxx
+ *
+ * @brief Shared memory frame ring for consumers on the same host.
+ */
+
+/** @addtogroup ShmRing
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmring.hxx"
+
+ShmRingSink::ShmRingSink()
+{
+  _header = 0;
+  _slots = 0;
+  _size = 0;
+}
+
+ShmRingSink::~ShmRingSink()
+{
+  close();
+}
+
+/**
+ * Create the ring file and map it. An existing ring is replaced, not
+ * truncated: readers that still map it would get SIGBUS. The new ring is
+ * written to path.new and renamed over it, then the old one is retired.
+ *
+ * @param path File name, e.g. /dev/shm/rfmbridge
+ * @param slotCount Number of frame slots
+ * @return true on success
+ */
+bool ShmRingSink::open(const char* path, unsigned int slotCount)
+{
+  close();
+
+  if (0 == slotCount)
+    return false;
+
+  char next[SHMRING_MAX_PATH + 4];
+  if (strlen(path) >= SHMRING_MAX_PATH)
+  {
+    fprintf(stderr, "%s: name too long\n", path);
+    return false;
+  }
+  snprintf(next, sizeof(next), "%s.new", path);
+
+  int fd = ::open(next, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    perror(next);
+    return false;
+  }
+
+  unsigned int size = sizeof(ShmRingHeader) + slotCount * sizeof(ShmRingSlot);
+
+  if (ftruncate(fd, size) < 0)
+  {
+    perror(next);
+    ::close(fd);
+    unlink(next);
+    return false;
+  }
+
+  void* map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (MAP_FAILED == map)
+  {
+    perror(next);
+    unlink(next);
+    return false;
+  }
+
+  _header = (ShmRingHeader*) map;
+  _slots = (ShmRingSlot*) (_header + 1);
+  _size = size;
+
+  _header->version = SHMRING_VERSION;
+  _header->slotCount = slotCount;
+  _header->slotSize = sizeof(ShmRingSlot);
+  __atomic_store_n(&_header->head, 0, __ATOMIC_RELEASE);
+
+  // magic last: readers wait for it
+  __atomic_store_n(&_header->magic, SHMRING_MAGIC, __ATOMIC_RELEASE);
+
+  // the old ring is retired only once the name leads to the new one
+  int old = ::open(path, O_RDWR | O_CLOEXEC);
+
+  if (rename(next, path) < 0)
+  {
+    perror(path);
+    if (old >= 0)
+      ::close(old);
+    unlink(next);
+    close();
+    return false;
+  }
+
+  struct stat st;
+  if (old >= 0 && 0 == fstat(old, &st) && (size_t) st.st_size >= sizeof(ShmRingHeader))
+  {
+    void* retired = mmap(0, sizeof(ShmRingHeader), PROT_READ | PROT_WRITE, MAP_SHARED, old, 0);
+    if (MAP_FAILED != retired)
+    {
+      __atomic_store_n(&((ShmRingHeader*) retired)->magic, SHMRING_RETIRED, __ATOMIC_RELEASE);
+      munmap(retired, sizeof(ShmRingHeader));
+    }
+  }
+  if (old >= 0)
+    ::close(old);
+
+  return true;
+}
+
+/**
+ * Unmap the ring. The file stays for readers that still have it mapped.
+ */
+void ShmRingSink::close()
+{
+  if (0 != _header)
+    munmap(_header, _size);
+
+  _header = 0;
+  _slots = 0;
+  _size = 0;
+}
+
+/**
+ * Publish a frame.
+ *
+ * @return 0 on success; -1 if the ring is not open.
+ */
+int ShmRingSink::deliver(const Frame& frame)
+{
+  if (0 == _header)
+    return -1;
+
+  uint64_t head = _header->head;
+  ShmRingSlot* slot = &_slots[head % _header->slotCount];
+
+  uint32_t seq = slot->seq;
+  __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  slot->radio = frame.radio;
+  slot->length = frame.length;
+  slot->rssi = frame.rssi;
+  slot->index = head;
+  slot->timestamp = frame.timestamp;
+  slot->frequency = frame.frequency;
+  slot->fei = frame.fei;
+  memcpy(slot->data, frame.data, frame.length);
+
+  __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+  __atomic_store_n(&_header->head, head + 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+ShmRingReader::ShmRingReader()
+{
+  _path[0] = '\0';
+  _header = 0;
+  _slots = 0;
+  _size = 0;
+  _position = 0;
+  _lost = 0;
+}
+
+ShmRingReader::~ShmRingReader()
+{
+  close();
+}
+
+/**
+ * Map an existing ring. Reading starts with the next published frame.
+ *
+ * @param path File name, e.g. /dev/shm/rfmbridge
+ * @return true on success; false if the file does not exist or is no valid ring (yet).
+ */
+bool ShmRingReader::open(const char* path)
+{
+  close();
+
+  if (strlen(path) >= SHMRING_MAX_PATH)
+    return false;
+  strcpy(_path, path);
+
+  if (false == reopen())
+    return false;
+
+  _position = __atomic_load_n(&_header->head, __ATOMIC_ACQUIRE);
+
+  return true;
+}
+
+/**
+ * Map the ring file by its name; a mapped ring is replaced only if that works.
+ * Reading starts with the first frame of the ring.
+ *
+ * @return false if the file does not exist or is no valid ring (yet).
+ */
+bool ShmRingReader::reopen()
+{
+  int fd = ::open(_path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(ShmRingHeader))
+  {
+    ::close(fd);
+    return false;
+  }
+
+  void* map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (MAP_FAILED == map)
+    return false;
+
+  ShmRingHeader* header = (ShmRingHeader*) map;
+
+  if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHMRING_MAGIC || header->version != SHMRING_VERSION
+      || header->slotSize != sizeof(ShmRingSlot)
+      || sizeof(ShmRingHeader) + (uint64_t) header->slotCount * sizeof(ShmRingSlot) > (uint64_t) st.st_size)
+  {
+    munmap(map, st.st_size);
+    return false;
+  }
+
+  close();
+
+  _header = header;
+  _slots = (ShmRingSlot*) (_header + 1);
+  _size = st.st_size;
+  _position = 0;
+
+  return true;
+}
+
+/**
+ * Unmap the ring.
+ */
+void ShmRingReader::close()
+{
+  if (0 != _header)
+    munmap(_header, _size);
+
+  _header = 0;
+  _slots = 0;
+  _size = 0;
+}
+
+/**
+ * Get the next frame. Does not block and enters the kernel only to switch to
+ * the new ring file of a restarted bridge.
+ *
+ * @param frame Receives the frame
+ * @return 1 if a frame was read; 0 if no new frame is available; -1 if not open.
+ */
+int ShmRingReader::read(Frame* frame)
+{
+  if (0 == _header)
+    return -1;
+
+  while (true)
+  {
+    uint32_t slotCount = _header->slotCount;
+    uint64_t head = __atomic_load_n(&_header->head, __ATOMIC_ACQUIRE);
+
+    // all of it read and replaced by a new ring: the bridge was restarted
+    if (head == _position && SHMRING_RETIRED == __atomic_load_n(&_header->magic, __ATOMIC_ACQUIRE) && reopen())
+      continue;
+
+    if (head == _position)
+      return 0;
+
+    // too slow: skip what has been overwritten already
+    if (head - _position > slotCount)
+    {
+      _lost += head - _position - slotCount;
+      _position = head - slotCount;
+    }
+
+    ShmRingSlot* slot = &_slots[_position % slotCount];
+
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+      continue;
+
+    uint64_t index = slot->index;
+    frame->radio = slot->radio;
+    frame->length = slot->length;
+    frame->rssi = slot->rssi;
+    frame->timestamp = slot->timestamp;
+    frame->frequency = slot->frequency;
+    frame->fei = slot->fei;
+    if (frame->length > FRAME_MAX_PAYLOAD)
+      frame->length = FRAME_MAX_PAYLOAD;
+    memcpy(frame->data, slot->data, frame->length);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+      continue;
+
+    if (index != _position)
+    {
+      // overwritten by a newer frame between reading head and the slot
+      continue;
+    }
+
+    _position++;
+
+    return 1;
+  }
+}
+
+/** @}
+ *
+ */
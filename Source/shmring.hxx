@@ -0,0 +1,123 @@
+/**
+ * @file shmring.hxx
+ *
+ * @brief Shared memory frame ring for consumers on the same host.
+ *
+ * The bridge publishes every frame into a memory mapped file (usually under
+ * /dev/shm). Any number of local readers map the same file and consume frames
+ * without system calls. There is a single writer; readers never block it.
+ *
+ * Every slot is protected by a sequence lock: the writer makes the slot sequence
+ * odd before and even after writing, readers retry if the sequence was odd or
+ * changed while copying. The header holds the number of published frames (head);
+ * frame n lives in slot n % slotCount. A reader that falls more than slotCount
+ * frames behind skips ahead and counts the frames it lost.
+ *
+ * A restarted bridge never truncates the file under its readers: it writes a
+ * new ring next to it, renames it over the old one and then marks the old one
+ * as retired (magic SHMRING_RETIRED). Readers keep the old file mapped until
+ * they have read all of it and then switch to the new file by name.
+ *
+ * Only GCC atomic builtins are used, so the layout can be read from C as well.
+ */
+
+#ifndef SHMRING_HXX_
+#define SHMRING_HXX_
+
+#include <stdint.h>
+
+#include "frame.hxx"
+#include "forward.hxx"
+
+/** @addtogroup ShmRing
+ * @{
+ */
+#define SHMRING_MAGIC         0x524D4652 ///< "RFMR"
+#define SHMRING_VERSION       2          ///< Layout version
+#define SHMRING_DEFAULT_SLOTS 1024       ///< Slots of a new ring
+#define SHMRING_DEFAULT_PATH  "/dev/shm/rfmbridge" ///< Default ring file
+#define SHMRING_RETIRED       0          ///< Magic of a ring replaced by a new file
+#define SHMRING_MAX_PATH      256        ///< Longest file name
+
+/** Ring header at offset 0 of the file. */
+typedef struct
+{
+  uint32_t magic;       //!< SHMRING_MAGIC
+  uint32_t version;     //!< SHMRING_VERSION
+  uint32_t slotCount;   //!< Number of slots
+  uint32_t slotSize;    //!< sizeof(ShmRingSlot)
+  uint64_t head;        //!< Number of frames published so far (atomic)
+  uint8_t reserved[40]; //!< Pad to one cache line
+} ShmRingHeader;
+
+/** One frame slot, following the header. */
+typedef struct
+{
+  uint32_t seq;                     //!< Sequence lock; odd while the writer is busy
+  uint8_t radio;                    //!< Tag of the receiving radio
+  uint8_t length;                   //!< Payload length
+  int16_t rssi;                     //!< RSSI [dBm]
+  uint64_t index;                   //!< Frame number stored in this slot
+  uint64_t timestamp;               //!< Reception time (CLOCK_REALTIME) [us]
+  uint32_t frequency;               //!< Carrier frequency [Hz]
+  int32_t fei;                      //!< Frequency error [Hz]
+  uint8_t data[FRAME_MAX_PAYLOAD];  //!< Payload
+  uint8_t reserved[32];             //!< Pad to two cache lines
+} ShmRingSlot;
+
+/** Writer side of the ring; a sink of the forwarding pipeline. */
+class ShmRingSink : public FrameSink
+{
+public:
+  ShmRingSink();
+  virtual ~ShmRingSink();
+
+  bool open(const char* path, unsigned int slotCount = SHMRING_DEFAULT_SLOTS);
+
+  void close();
+
+  int deliver(const Frame& frame);
+
+private:
+  ShmRingHeader* _header;
+  ShmRingSlot* _slots;
+  unsigned int _size;
+};
+
+/** Reader side of the ring. */
+class ShmRingReader
+{
+public:
+  ShmRingReader();
+  virtual ~ShmRingReader();
+
+  bool open(const char* path);
+
+  void close();
+
+  int read(Frame* frame);
+
+  /**
+   * Get the number of frames that were overwritten before this reader got them.
+   */
+  uint64_t getLost()
+  {
+    return _lost;
+  }
+
+private:
+  bool reopen();
+
+  char _path[SHMRING_MAX_PATH];
+  ShmRingHeader* _header;
+  ShmRingSlot* _slots;
+  unsigned int _size;
+  uint64_t _position;
+  uint64_t _lost;
+};
+
+/** @}
+ *
+ */
+
+#endif /* SHMRING_HXX_ */
@@ -0,0 +1,395 @@
+/**
+ * @file simcheck.cxx
+ *
+ * @brief Checks of the driver and the receive path against the simulated module.
+ *
+ * Each check drives the unchanged code on top of RFM69Sim, or two RFMLink
+ * instances over a simulated lossy channel, through a short scenario and
+ * compares what it does with what the real module or peer would show.
+ * One line per check is printed; the exit code is the number of failed checks.
+ *
+ * Build and run on the host with "make check"; no wiringPi is needed.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rfm69.hxx"
+#include "rfm69sim.hxx"
+#include "rfm69profile.hxx"
+#include "radio.hxx"
+#include "rfmlink.hxx"
+#include "eventloop.hxx"
+
+#define CHECK_RSSI        -60       ///< RSSI of the injected frames [dBm]
+#define CHECK_RX_READY    1000      ///< Time for the receiver to start [us]
+#define CHECK_WATCHDOG    50        ///< Watchdog interval [ms]
+#define CHECK_GAP         40        ///< Gap between frames on the air [ms]
+#define CHECK_FRAMES      10        ///< Frames put on the air per scenario
+#define CHECK_NOISE       -100      ///< Noise level above the default RssiThreshold [dBm]
+#define CHECK_NOISE_TIME  200       ///< Time in noise without frames [ms]
+#define CHECK_LINK_FRAMES 300       ///< Payloads sent over the lossy link
+#define CHECK_LINK_LOSS   20        ///< Frames lost on the lossy link [%]
+#define CHECK_LINK_POISON 5         ///< Payload that never gets through the lossy link
+#define CHECK_LINK_STEP   10        ///< Time step of the lossy link [ms]
+#define CHECK_LINK_FIRST  4         ///< Payloads sent when the first frame is lost
+
+extern uint32_t HAL_GetTick();
+
+/** Number of failed checks. */
+static unsigned int failures = 0;
+
+/**
+ * Report the result of a check.
+ */
+static void expect(bool condition, const char* name)
+{
+  printf("%-60s %s\n", name, condition ? "ok" : "FAILED");
+
+  if (false == condition)
+    failures++;
+}
+
+/** Counts the frames a radio receives. */
+class Receiver : public RadioListener
+{
+public:
+  Receiver()
+  {
+    frames = 0;
+  }
+
+  void radioReceive(Radio* radio, Frame* frame)
+  {
+    frames++;
+  }
+
+  unsigned int frames;
+};
+
+/**
+ * One direction of a lossy channel between two links: frames arrive one time
+ * step after they were sent, unless they are lost.
+ */
+class LossyChannel : public RFMLinkTransport
+{
+public:
+  /**
+   * @param loss Frames lost at random [%]
+   * @param poison Payload that is always lost; -1 none
+   * @param skip Number of frames lost at the start
+   */
+  LossyChannel(unsigned int loss, int poison, unsigned int skip = 0)
+  {
+    _loss = loss;
+    _poison = poison;
+    _skip = skip;
+    _count = 0;
+  }
+
+  int transmit(const uint8_t* data, unsigned int dataLength)
+  {
+    // the poisoned payload is always lost: the sender gives it up after RFMLINK_MAX_RETRIES
+    bool poisoned = (RFMLINK_MARKER | RFMLINK_TYPE_DATA) == (data[0] & ~RFMLINK_FLAG_SYNC)
+        && dataLength > RFMLINK_HEADER_SIZE && _poison == data[RFMLINK_HEADER_SIZE];
+
+    if (_skip > 0)
+    {
+      _skip--;
+      return dataLength;
+    }
+
+    if (false == poisoned && lrand48() % 100 >= _loss && _count < RFMLINK_MAX_WINDOW + 1)
+    {
+      memcpy(_frames[_count], data, dataLength);
+      _lengths[_count] = dataLength;
+      _count++;
+    }
+
+    return dataLength;
+  }
+
+  /**
+   * Hand the frames sent so far to the receiving link.
+   */
+  void pass(RFMLink* link, uint32_t now)
+  {
+    uint8_t frames[RFMLINK_MAX_WINDOW + 1][RFMLINK_HEADER_SIZE + RFMLINK_MAX_PAYLOAD];
+    unsigned int lengths[RFMLINK_MAX_WINDOW + 1];
+    unsigned int count = _count;
+
+    // the receiver answers right away: its frames go out with the next step
+    memcpy(frames, _frames, sizeof(frames));
+    memcpy(lengths, _lengths, sizeof(lengths));
+    _count = 0;
+
+    for (unsigned int i = 0; i < count; i++)
+      link->input(frames[i], lengths[i], now);
+  }
+
+private:
+  unsigned int _loss;
+  int _poison;
+  unsigned int _skip;
+  uint8_t _frames[RFMLINK_MAX_WINDOW + 1][RFMLINK_HEADER_SIZE + RFMLINK_MAX_PAYLOAD];
+  unsigned int _lengths[RFMLINK_MAX_WINDOW + 1];
+  unsigned int _count;
+};
+
+/** Checks the order of the payloads a link delivers. */
+class LinkReceiver : public RFMLinkHandler
+{
+public:
+  LinkReceiver()
+  {
+    delivered = 0;
+    next = 0;
+    ordered = true;
+    poisoned = false;
+  }
+
+  void linkDeliver(uint8_t source, const uint8_t* data, unsigned int dataLength)
+  {
+    unsigned int index = data[0] | (data[1] << 8);
+
+    if (index < next)
+      ordered = false;
+    if (CHECK_LINK_POISON == index)
+      poisoned = true;
+
+    next = index + 1;
+    delivered++;
+  }
+
+  unsigned int delivered;
+  unsigned int next;
+  bool ordered;
+  bool poisoned;
+};
+
+/**
+ * Run an event loop for a while.
+ */
+static void runFor(EventLoop* loop, unsigned int ms)
+{
+  uint32_t start = HAL_GetTick();
+
+  while (HAL_GetTick() - start < ms)
+    loop->runOnce(ms - (HAL_GetTick() - start));
+}
+
+/**
+ * Put a frame on the air and wait until it is over.
+ */
+static void airFrame(RFM69Sim* sim, uint8_t seqno)
+{
+  uint8_t payload[8] = { seqno, 1, 2, 3, 4, 5, 6, 7 };
+
+  sim->inject(payload, sizeof(payload), CHECK_RSSI);
+  usleep(sim->airtime(sizeof(payload)) + CHECK_RX_READY);
+}
+
+/**
+ * A received frame restarts the receiver with the RestartRx trigger bit; it
+ * must not end up in the shadow, so the profile still matches afterwards.
+ */
+static void checkShadowAfterRx()
+{
+  RFM69Sim sim;
+  RFM69 rfm69(&sim);
+  RFM69Image image = rfm69Image(rfm69_base_profile);
+
+  rfm69.init();
+  rfm69.setMode(RFM69_MODE_RX);
+  usleep(CHECK_RX_READY);
+
+  uint8_t payload[RFM69_PROFILE_MAX_PAYLOAD];
+  airFrame(&sim, 1);
+  expect(rfm69.receivePayload(payload, sizeof(payload)) > 0, "shadow: frame received");
+  expect(rfm69.getShadow().values[0x3D] == sim.peek(0x3D), "shadow: RegPacketConfig2 matches the module after RX");
+  expect(0 == rfm69.applyImage(image), "shadow: unchanged profile writes nothing after RX");
+
+  RFM69Profile profile = rfm69_base_profile;
+  profile.frequency = 915000000;
+  expect(3 == rfm69.applyImage(rfm69Image(profile)), "shadow: new carrier frequency writes RegFrf only");
+}
+
+/**
+ * A restart of the bridge while the module receives: warmInit() with the same
+ * image must find nothing to rewrite, leave the module in RX and keep the
+ * frame in the FIFO, although LnaCurrentGain reads back different.
+ */
+static void checkWarmInit()
+{
+  RFM69Sim sim;
+  RFM69 before(&sim);
+  before.init();
+  before.setMode(RFM69_MODE_RX);
+  usleep(CHECK_RX_READY);
+  airFrame(&sim, 1);
+
+  RFM69 after(&sim);
+  uint8_t payload[RFM69_PROFILE_MAX_PAYLOAD];
+  expect(0 == after.warmInit(rfm69Image(rfm69_base_profile)), "warm start: same image rewrites nothing");
+  expect(4 == ((sim.peek(0x01) >> 2) & 0x07), "warm start: module stays in RX");
+  expect(after.receivePayload(payload, sizeof(payload)) > 0 && 1 == payload[0], "warm start: pending frame still read");
+}
+
+/**
+ * The watchdog compares the registers with the shadow; after frames have been
+ * received (and RX restarted) it must not see drift and start a recovery.
+ */
+static void checkWatchdogAfterRx()
+{
+  RFM69Sim sim;
+  RFM69 rfm69(&sim);
+  rfm69.init();
+
+  EventLoop loop;
+  Receiver receiver;
+  Radio radio(0, &rfm69, &receiver);
+  radio.setWatchdog(CHECK_WATCHDOG);
+  radio.start(&loop, -1);
+
+  uint8_t payload[8] = { 0 };
+  uint64_t start = RFM69Sim::now() + CHECK_GAP * 1000000ull;
+  for (unsigned int i = 0; i < CHECK_FRAMES; i++)
+    sim.inject(payload, sizeof(payload), CHECK_RSSI, start + i * CHECK_GAP * 1000000ull);
+
+  runFor(&loop, (CHECK_FRAMES + 2) * CHECK_GAP);
+  radio.stop();
+
+  const RadioStats& stats = radio.getStats();
+  expect(CHECK_FRAMES == receiver.frames, "watchdog: frames received");
+  expect(0 == stats.faultDrift, "watchdog: no drift after RX");
+  expect(0 == stats.rxRestarts + stats.reinits + stats.resets, "watchdog: no recovery after RX");
+}
+
+/**
+ * Polling without DIO0 in noise above RssiThreshold: the Rssi flag latches
+ * like on the chip, the poller has to back off instead of staying at the
+ * shortest interval, and still receive the frames. A frame whose sync word is
+ * on the air while the receiver restarts is lost, as on the chip.
+ */
+static void checkPollNoise()
+{
+  RFM69Sim sim;
+  RFM69 rfm69(&sim);
+  rfm69.init();
+  sim.setNoise(CHECK_NOISE);
+
+  EventLoop loop;
+  Receiver receiver;
+  Radio radio(0, &rfm69, &receiver);
+  radio.start(&loop, -1);
+
+  runFor(&loop, 2 * RADIO_POLL_RSSI);
+
+  // polling at the shortest interval would take one transfer per POLLBACKOFF_MIN
+  unsigned int transfers = sim.getStats().transfers;
+  runFor(&loop, CHECK_NOISE_TIME);
+  transfers = sim.getStats().transfers - transfers;
+  expect(transfers < CHECK_NOISE_TIME * 1000 / POLLBACKOFF_MIN / 4, "poll: backs off while Rssi latches on noise");
+  expect(radio.getStats().noiseRestarts > 0, "poll: receiver restarted on noise");
+
+  uint8_t payload[8] = { 0 };
+  uint64_t start = RFM69Sim::now() + CHECK_GAP * 1000000ull;
+  for (unsigned int i = 0; i < CHECK_FRAMES; i++)
+    sim.inject(payload, sizeof(payload), CHECK_RSSI, start + i * CHECK_GAP * 1000000ull);
+
+  runFor(&loop, (CHECK_FRAMES + 2) * CHECK_GAP);
+  radio.stop();
+
+  expect(receiver.frames + 1 >= CHECK_FRAMES, "poll: frames received in noise");
+}
+
+/**
+ * Two links over a lossy channel. The sender gives up on one payload while the
+ * ones after it have been received and acknowledged; when it resynchronises,
+ * the receiver has to deliver those instead of dropping them.
+ */
+static void checkLinkResync()
+{
+  LossyChannel toB(CHECK_LINK_LOSS, CHECK_LINK_POISON), toA(CHECK_LINK_LOSS, CHECK_LINK_POISON);
+  LinkReceiver receiver;
+  RFMLink a(&toB, 0, 1);
+  RFMLink b(&toA, &receiver, 2);
+
+  srand48(1);
+
+  unsigned int sent = 0;
+  uint32_t now = 0;
+
+  // an hour of link time at most
+  while ((sent < CHECK_LINK_FRAMES || a.pending(2) > 0) && now < 3600000)
+  {
+    while (sent < CHECK_LINK_FRAMES)
+    {
+      uint8_t payload[2] = { (uint8_t) sent, (uint8_t) (sent >> 8) };
+      if (a.send(2, payload, sizeof(payload), now) < 0)
+        break;
+      sent++;
+    }
+
+    now += CHECK_LINK_STEP;
+    toB.pass(&b, now);
+    toA.pass(&a, now);
+    a.poll(now);
+    b.poll(now);
+  }
+
+  const RFMLinkStats& stats = b.getStats();
+  expect(CHECK_LINK_FRAMES == sent && 0 == a.pending(2), "link: all payloads sent and settled");
+  expect(receiver.ordered && false == receiver.poisoned, "link: payloads in order, the given up one missing");
+  expect(a.getStats().failed >= 1, "link: sender gave up the poisoned payload");
+  expect(CHECK_LINK_FRAMES == stats.delivered + stats.lost, "link: every payload delivered or reported lost");
+}
+
+/**
+ * The first frame of a link, the one with FLAG_SYNC, is lost and the next ones
+ * arrive first. The receiver must not start its window at them, but deliver
+ * all payloads in order once the first one has been retransmitted.
+ */
+static void checkLinkFirstLost()
+{
+  LossyChannel toB(0, -1, 1), toA(0, -1);
+  LinkReceiver receiver;
+  RFMLink a(&toB, 0, 1);
+  RFMLink b(&toA, &receiver, 2);
+
+  for (unsigned int i = 0; i < CHECK_LINK_FIRST; i++)
+  {
+    uint8_t payload[2] = { (uint8_t) i, 0 };
+    a.send(2, payload, sizeof(payload), 0);
+  }
+
+  for (uint32_t now = CHECK_LINK_STEP; a.pending(2) > 0 && now < 60000; now += CHECK_LINK_STEP)
+  {
+    toB.pass(&b, now);
+    toA.pass(&a, now);
+    a.poll(now);
+    b.poll(now);
+  }
+
+  const RFMLinkStats& stats = b.getStats();
+  expect(0 == a.pending(2) && 0 == a.getStats().failed, "link: first frame lost, all payloads acknowledged");
+  expect(CHECK_LINK_FIRST == stats.delivered && receiver.ordered && CHECK_LINK_FIRST == receiver.next,
+      "link: first frame lost, all payloads delivered in order");
+}
+
+int main(int argc, char* argv[])
+{
+  checkShadowAfterRx();
+  checkWarmInit();
+  checkWatchdogAfterRx();
+  checkPollNoise();
+  checkLinkResync();
+  checkLinkFirstLost();
+
+  printf("%u failed\n", failures);
+
+  return failures;
+}
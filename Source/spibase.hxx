@@ -0,0 +1,62 @@
+/**
+ * @file spibase.hxx
+ *
+ * @brief SPI transport of the RFM69 driver.
+ *
+ * The driver talks to the module only through this interface: SPIDev for a
+ * Linux spidev device, RFM69Sim for the register level simulator on the host.
+ * Every call is one transaction with the chip selected from the first to the
+ * last byte.
+ */
+
+#ifndef SPIBASE_HXX_
+#define SPIBASE_HXX_
+
+#include <stdint.h>
+
+/** @addtogroup RFM69
+ * @{
+ */
+
+/** SPI master the RFM69 is attached to. */
+class SPIBase
+{
+public:
+  virtual ~SPIBase()
+  {
+  }
+
+  /**
+   * Full duplex transfer: shift out tx while receiving into rx.
+   *
+   * @param tx Bytes to send
+   * @param rx Buffer for the received bytes; 0 to ignore them
+   * @param length Number of bytes
+   */
+  virtual void transfer(const uint8_t* tx, uint8_t* rx, unsigned int length) = 0;
+
+  /**
+   * Send an address byte and receive the following bytes.
+   *
+   * @param address The address byte
+   * @param rx Buffer for the received bytes
+   * @param length Number of bytes after the address byte
+   */
+  virtual void read(uint8_t address, uint8_t* rx, unsigned int length) = 0;
+
+  /**
+   * Pulse the RESET line of the module and wait until it is ready.
+   *
+   * @return false if no reset line is wired.
+   */
+  virtual bool reset()
+  {
+    return false;
+  }
+};
+
+/** @}
+ *
+ */
+
+#endif /* SPIBASE_HXX_ */
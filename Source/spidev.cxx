@@ -0,0 +1,166 @@
+/**
+ * @file spidev.cxx
+ *
+ * @brief SPI transport over a Linux spidev device.
+ */
+
+/** @addtogroup RFM69
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#include <linux/spi/spidev.h>
+#include <wiringPi.h>
+
+#include "spidev.hxx"
+#include "metrics.hxx"
+
+extern void pabort(const char *s);
+
+static const uint8_t spi_bits = 8; // Must be 8-bit, as that's the only mode the SPI driver support
+static const uint16_t spi_delay = 0;    // Must be 0, we don't want a delay
+
+/**
+ * Open and set up the device.
+ *
+ * @param device SPI device of the module
+ * @param speed SPI clock [Hz]
+ * @param mode SPI mode
+ * @param resetPin wiringPi pin wired to the RESET line of the module; -1 if not wired
+ */
+SPIDev::SPIDev(const char* device, uint32_t speed, uint8_t mode, int resetPin)
+{
+  _speed = speed;
+  _mode = mode;
+  _resetPin = resetPin;
+
+  uint8_t bits = spi_bits;
+
+  _fd = open(device, O_RDWR);
+  if (_fd < 0)
+    pabort("Can't open device");
+
+  int _ret = ioctl(_fd, SPI_IOC_WR_MODE, &_mode);
+  if (_ret == -1)
+    pabort("Can't set SPI mode");
+
+  _ret = ioctl(_fd, SPI_IOC_RD_MODE, &_mode);
+  if (_ret == -1)
+    pabort("Can't set SPI mode");
+
+  // Bits per word
+  _ret = ioctl(_fd, SPI_IOC_WR_BITS_PER_WORD, &bits);
+  if (_ret == -1)
+    pabort("Can't set bits per word");
+
+  _ret = ioctl(_fd, SPI_IOC_RD_BITS_PER_WORD, &bits);
+  if (_ret == -1)
+    pabort("Can't set bits per word");
+
+  // Max speed hz
+  _ret = ioctl(_fd, SPI_IOC_WR_MAX_SPEED_HZ, &_speed);
+  if (_ret == -1)
+    pabort("Can't set max speed hz");
+
+  _ret = ioctl(_fd, SPI_IOC_RD_MAX_SPEED_HZ, &_speed);
+  if (_ret == -1)
+    pabort("Can't set max speed hz");
+
+  printf("%s: spi mode: %d\n", device, _mode);
+  printf("%s: bits per word: %d\n", device, bits);
+  printf("%s: max speed: %d Hz (%d KHz)\n", device, _speed, _speed / 1000);
+}
+
+SPIDev::~SPIDev()
+{
+  close(_fd);
+}
+
+/**
+ * Full duplex transfer of several bytes with a single chip select, used for
+ * single registers, register bursts (address auto-increment) and FIFO access.
+ */
+void SPIDev::transfer(const uint8_t* tx, uint8_t* rx, unsigned int length)
+{
+  struct spi_ioc_transfer xfer[1];
+
+  // Clear spi_ioc_transfer structure
+  memset(xfer, 0, sizeof(xfer));
+
+  xfer[0].tx_buf = (unsigned long) tx;
+  xfer[0].rx_buf = (unsigned long) rx;
+  xfer[0].len = length;
+  xfer[0].delay_usecs = spi_delay;
+  xfer[0].speed_hz = _speed;
+  xfer[0].bits_per_word = spi_bits;
+
+  if (ioctl(_fd, SPI_IOC_MESSAGE(1), xfer) < 0)
+  {
+    pabort("SPI_IOC_MESSAGE");
+  }
+  metricsAdd(METRIC_SPI_TRANSFERS, 0);
+  metricsAdd(METRIC_SPI_BYTES, 0, length);
+}
+
+/**
+ * Send the register address and read the following bytes straight into the
+ * caller's buffer; two transfers of one message, so chip select stays active.
+ */
+void SPIDev::read(uint8_t address, uint8_t* rx, unsigned int length)
+{
+  struct spi_ioc_transfer xfer[2];
+
+  // Clear spi_ioc_transfer structure
+  memset(xfer, 0, sizeof(xfer));
+
+  xfer[0].tx_buf = (unsigned long) &address;
+  xfer[0].len = 1;
+  xfer[0].speed_hz = _speed;
+  xfer[0].bits_per_word = spi_bits;
+
+  // tx_buf 0: spidev shifts out zeros
+  xfer[1].rx_buf = (unsigned long) rx;
+  xfer[1].len = length;
+  xfer[1].delay_usecs = spi_delay;
+  xfer[1].speed_hz = _speed;
+  xfer[1].bits_per_word = spi_bits;
+
+  if (ioctl(_fd, SPI_IOC_MESSAGE(2), xfer) < 0)
+  {
+    pabort("SPI_IOC_MESSAGE");
+  }
+  metricsAdd(METRIC_SPI_TRANSFERS, 0);
+  metricsAdd(METRIC_SPI_BYTES, 0, 1 + length);
+}
+
+/**
+ * Reset the module using the external reset line.
+ *
+ * @return false if no reset line is wired.
+ */
+bool SPIDev::reset()
+{
+  if (_resetPin < 0)
+    return false;
+
+  // generate reset impulse (at least 100 us high)
+  pinMode(_resetPin, OUTPUT);
+  digitalWrite(_resetPin, HIGH);
+  delay(1);
+  digitalWrite(_resetPin, LOW);
+
+  // wait until module is ready
+  delay(10);
+
+  return true;
+}
+
+/** @}
+ *
+ */
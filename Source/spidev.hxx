@@ -0,0 +1,42 @@
+/**
+ * @file spidev.hxx
+ *
+ * @brief SPI transport over a Linux spidev device.
+ */
+
+#ifndef SPIDEV_HXX_
+#define SPIDEV_HXX_
+
+#include <stdint.h>
+
+#include "spibase.hxx"
+
+/** @addtogroup RFM69
+ * @{
+ */
+
+/** spidev device, e.g. /dev/spidev0.0; one instance per chip select. */
+class SPIDev : public SPIBase
+{
+public:
+  SPIDev(const char* device = "/dev/spidev0.0", uint32_t speed = 500000, uint8_t mode = 0, int resetPin = -1);
+  virtual ~SPIDev();
+
+  void transfer(const uint8_t* tx, uint8_t* rx, unsigned int length);
+
+  void read(uint8_t address, uint8_t* rx, unsigned int length);
+
+  bool reset();
+
+private:
+  int _fd;
+  uint32_t _speed;
+  uint8_t _mode;
+  int _resetPin;
+};
+
+/** @}
+ *
+ */
+
+#endif /* SPIDEV_HXX_ */
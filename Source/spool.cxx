@@ -0,0 +1,357 @@
+/**
+ * @file spool.cxx
+ *
+ * @brief Store-and-forward spool for frames the uplink could not take.
+ */
+
+/** @addtogroup Forward
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spool.hxx"
+
+extern uint32_t HAL_GetTick();
+
+/**
+ * CRC-32 (IEEE 802.3, reflected, polynomial 0xEDB88320).
+ *
+ * @param data Pointer to the data
+ * @param length Number of bytes
+ * @param crc CRC of the preceding data, to continue a calculation
+ * @return The CRC
+ */
+uint32_t crc32(const void* data, unsigned int length, uint32_t crc)
+{
+  static uint32_t table[256];
+
+  if (0 == table[1])
+  {
+    for (uint32_t i = 0; i < 256; i++)
+    {
+      uint32_t c = i;
+      for (unsigned int k = 0; k < 8; k++)
+        c = (c & 1) ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+  }
+
+  const uint8_t* p = (const uint8_t*) data;
+
+  crc = ~crc;
+  while (length--)
+    crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+  return ~crc;
+}
+
+/**
+ * CRC of a record, covering everything behind the CRC field.
+ */
+static uint32_t recordCRC(const SpoolRecord* record)
+{
+  return crc32(&record->index, sizeof(SpoolRecord) - sizeof(record->crc));
+}
+
+/**
+ * Spool constructor.
+ *
+ * @param output Sink that frames are passed on to
+ */
+Spool::Spool(FrameSink* output)
+{
+  _output = output;
+  _header = 0;
+  _records = 0;
+  _size = 0;
+  _loop = 0;
+  _timer = -1;
+  _draining = false;
+  _burst = 1;
+  _retryAt = 0;
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+Spool::~Spool()
+{
+  stop();
+  close();
+}
+
+/**
+ * Open or create the spool file and map it.
+ *
+ * An existing spool with the same geometry is taken over, so frames spooled
+ * before a restart are not lost; otherwise the file is initialized empty.
+ *
+ * @param path File name; should be on persistent storage
+ * @param size File size [kB]
+ * @return true on success
+ */
+bool Spool::open(const char* path, unsigned int size)
+{
+  close();
+
+  unsigned int recordCount = ((uint64_t) size * 1024 - sizeof(SpoolHeader)) / sizeof(SpoolRecord);
+  if (size * 1024 <= sizeof(SpoolHeader) || recordCount < 2)
+    return false;
+
+  int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    perror(path);
+    return false;
+  }
+
+  unsigned int length = sizeof(SpoolHeader) + recordCount * sizeof(SpoolRecord);
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || ((size_t) st.st_size != length && ftruncate(fd, length) < 0))
+  {
+    perror(path);
+    ::close(fd);
+    return false;
+  }
+
+  void* map = mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (MAP_FAILED == map)
+  {
+    perror(path);
+    return false;
+  }
+
+  _header = (SpoolHeader*) map;
+  _records = (SpoolRecord*) (_header + 1);
+  _size = length;
+
+  if (SPOOL_MAGIC != _header->magic || SPOOL_VERSION != _header->version
+      || recordCount != _header->recordCount || sizeof(SpoolRecord) != _header->recordSize
+      || _header->head < _header->tail || _header->head - _header->tail > recordCount)
+  {
+    memset(_header, 0, sizeof(SpoolHeader));
+    _header->version = SPOOL_VERSION;
+    _header->recordCount = recordCount;
+    _header->recordSize = sizeof(SpoolRecord);
+    _header->magic = SPOOL_MAGIC;
+  }
+  else
+  {
+    recover();
+  }
+
+  return true;
+}
+
+/**
+ * Take over records that were written after the last header update that reached
+ * the disk (the header is written after the record).
+ */
+void Spool::recover()
+{
+  while (_header->head - _header->tail < _header->recordCount)
+  {
+    const SpoolRecord* record = &_records[_header->head % _header->recordCount];
+
+    if ((uint32_t) _header->head != record->index || recordCRC(record) != record->crc)
+      break;
+
+    _header->head++;
+  }
+}
+
+/**
+ * Unmap the spool file. Its contents stay for the next start.
+ */
+void Spool::close()
+{
+  if (0 != _header)
+  {
+    msync(_header, _size, MS_SYNC);
+    munmap(_header, _size);
+  }
+
+  _header = 0;
+  _records = 0;
+  _size = 0;
+}
+
+/**
+ * Register the drain timer with the event loop.
+ *
+ * @param loop Event loop
+ * @param rate Maximum number of spooled frames delivered per second
+ */
+void Spool::start(EventLoop* loop, unsigned int rate)
+{
+  _loop = loop;
+  _timer = timerCreate();
+  _loop->add(_timer, EPOLLIN, this);
+
+  _burst = rate * SPOOL_DRAIN_INTERVAL / 1000;
+  if (0 == _burst)
+    _burst = 1;
+
+  // frames spooled before the restart
+  if (getBacklog() > 0)
+  {
+    _draining = true;
+    timerArm(_timer, SPOOL_DRAIN_INTERVAL, true);
+  }
+}
+
+/**
+ * Unregister from the event loop.
+ */
+void Spool::stop()
+{
+  if (0 == _loop)
+    return;
+
+  _loop->remove(_timer);
+  ::close(_timer);
+  _timer = -1;
+  _loop = 0;
+  _draining = false;
+}
+
+/**
+ * Pass a frame on to the output; spool it if the output fails.
+ *
+ * Live frames are not queued behind the backlog: the backlog is drained in the
+ * background, the envelope timestamps keep the original order recoverable.
+ *
+ * @return 0 if the frame was delivered or spooled; < 0 if it was lost.
+ */
+int Spool::deliver(const Frame& frame)
+{
+  // don't hammer an output that just failed
+  bool retry = (false == _draining) || (int32_t)(HAL_GetTick() - _retryAt) >= 0;
+
+  if (retry)
+  {
+    int ret = _output->deliver(frame);
+    if (ret >= 0)
+      return ret;
+
+    if (0 == _header)
+      return ret;
+
+    _retryAt = HAL_GetTick() + SPOOL_RETRY_INTERVAL;
+  }
+
+  append(frame);
+
+  return 0;
+}
+
+/**
+ * Drain timer.
+ */
+void Spool::handleEvent(int fd, uint32_t events)
+{
+  timerRead(_timer);
+  drain();
+}
+
+/**
+ * Append a frame to the spool, dropping the oldest record if it is full.
+ */
+void Spool::append(const Frame& frame)
+{
+  if (_header->head - _header->tail >= _header->recordCount)
+  {
+    _header->tail++;
+    _stats.dropped++;
+  }
+
+  SpoolRecord* record = &_records[_header->head % _header->recordCount];
+
+  record->index = (uint32_t) _header->head;
+  record->timestamp = frame.timestamp;
+  record->frequency = frame.frequency;
+  record->fei = frame.fei;
+  record->rssi = frame.rssi;
+  record->radio = frame.radio;
+  record->length = frame.length;
+  memcpy(record->data, frame.data, frame.length);
+  memset(record->data + frame.length, 0, sizeof(record->data) - frame.length + sizeof(record->reserved));
+  record->crc = recordCRC(record);
+
+  // the record before the header: a torn update loses at most the header change
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  _header->head++;
+  _stats.spooled++;
+
+  if (false == _draining && 0 != _loop)
+  {
+    _draining = true;
+    timerArm(_timer, SPOOL_DRAIN_INTERVAL, true);
+  }
+}
+
+/**
+ * Deliver up to one burst of spooled frames, oldest first.
+ */
+void Spool::drain()
+{
+  if (0 == _header)
+    return;
+
+  if ((int32_t)(HAL_GetTick() - _retryAt) < 0)
+    return;
+
+  // the fields a record does not carry (trace stages, references) start out empty
+  Frame frame;
+  memset(&frame, 0, sizeof(frame));
+
+  for (unsigned int i = 0; i < _burst && _header->tail != _header->head; i++)
+  {
+    const SpoolRecord* record = &_records[_header->tail % _header->recordCount];
+
+    if ((uint32_t) _header->tail != record->index || recordCRC(record) != record->crc
+        || record->length > FRAME_MAX_PAYLOAD)
+    {
+      _stats.corrupt++;
+      _header->tail++;
+      continue;
+    }
+
+    frame.timestamp = record->timestamp;
+    frame.frequency = record->frequency;
+    frame.fei = record->fei;
+    frame.rssi = record->rssi;
+    frame.radio = record->radio;
+    frame.length = record->length;
+    memcpy(frame.data, record->data, record->length);
+
+    if (_output->deliver(frame) < 0)
+    {
+      // still down, try again later
+      _retryAt = HAL_GetTick() + SPOOL_RETRY_INTERVAL;
+      return;
+    }
+
+    _header->tail++;
+    _stats.drained++;
+  }
+
+  if (_header->tail == _header->head)
+  {
+    _draining = false;
+    timerDisarm(_timer);
+  }
+}
+
+/** @}
+ *
+ */
@@ -0,0 +1,132 @@
+/**
+ * @file spool.hxx
+ *
+ * @brief Store-and-forward spool for frames the uplink could not take.
+ *
+ * The spool wraps a sink (usually the UDP uplink). Frames are passed on directly;
+ * if the sink reports a failure, the frame is appended to a memory mapped spool
+ * file instead. A timer drains the spool at a limited rate as soon as the sink
+ * takes frames again, so a recovering server is not flooded.
+ *
+ * The file is a fixed size circular log of fixed size records, so the disk usage
+ * is bounded: if it is full, the oldest record is dropped. Every record carries
+ * a CRC-32 and its record number; a record torn by a power loss is detected and
+ * skipped. The spool survives restarts of the bridge.
+ */
+
+#ifndef SPOOL_HXX_
+#define SPOOL_HXX_
+
+#include <stdint.h>
+
+#include "frame.hxx"
+#include "forward.hxx"
+#include "eventloop.hxx"
+
+/** @addtogroup Forward
+ * @{
+ */
+#define SPOOL_MAGIC           0x534D4652 ///< "RFMS"
+#define SPOOL_VERSION         1          ///< Layout version
+#define SPOOL_DEFAULT_SIZE    4096       ///< Default spool file size [kB]
+#define SPOOL_DEFAULT_RATE    50         ///< Default drain rate [frames/s]
+#define SPOOL_DRAIN_INTERVAL  100        ///< Drain timer period [ms]
+#define SPOOL_RETRY_INTERVAL  1000       ///< Wait after a failed delivery before draining again [ms]
+
+/** Spool file header at offset 0. */
+typedef struct
+{
+  uint32_t magic;       //!< SPOOL_MAGIC
+  uint32_t version;     //!< SPOOL_VERSION
+  uint32_t recordCount; //!< Number of record slots
+  uint32_t recordSize;  //!< sizeof(SpoolRecord)
+  uint64_t head;        //!< Number of records written so far
+  uint64_t tail;        //!< Number of records drained or dropped so far
+  uint8_t reserved[32]; //!< Pad to 64 bytes
+} SpoolHeader;
+
+/** One spooled frame; record n lives in slot n % recordCount. */
+typedef struct
+{
+  uint32_t crc;                     //!< CRC-32 of the rest of the record
+  uint32_t index;                   //!< Lower 32 bits of the record number
+  uint64_t timestamp;               //!< Reception time (CLOCK_REALTIME) [us]
+  uint32_t frequency;               //!< Carrier frequency [Hz]
+  int32_t fei;                      //!< Frequency error [Hz]
+  int16_t rssi;                     //!< RSSI [dBm]
+  uint8_t radio;                    //!< Tag of the receiving radio
+  uint8_t length;                   //!< Payload length
+  uint8_t data[FRAME_MAX_PAYLOAD];  //!< Payload
+  uint8_t reserved[4];              //!< Pad to 96 bytes
+} SpoolRecord;
+
+/** Spool counters. */
+typedef struct
+{
+  unsigned int spooled;     //!< Frames written to the spool
+  unsigned int drained;     //!< Spooled frames delivered later
+  unsigned int dropped;     //!< Oldest frames dropped because the spool was full
+  unsigned int corrupt;     //!< Records skipped because of a CRC or index mismatch
+} SpoolStats;
+
+/** Store-and-forward stage in front of a sink. */
+class Spool : public FrameSink, public EventHandler
+{
+public:
+  Spool(FrameSink* output);
+  virtual ~Spool();
+
+  bool open(const char* path, unsigned int size = SPOOL_DEFAULT_SIZE);
+
+  void close();
+
+  void start(EventLoop* loop, unsigned int rate = SPOOL_DEFAULT_RATE);
+
+  void stop();
+
+  int deliver(const Frame& frame);
+
+  void handleEvent(int fd, uint32_t events);
+
+  /**
+   * Get the number of frames waiting in the spool.
+   */
+  unsigned int getBacklog()
+  {
+    return (0 == _header) ? 0 : _header->head - _header->tail;
+  }
+
+  /**
+   * Get the spool counters.
+   */
+  const SpoolStats& getStats()
+  {
+    return _stats;
+  }
+
+private:
+  void append(const Frame& frame);
+
+  void drain();
+
+  void recover();
+
+  FrameSink* _output;
+  SpoolHeader* _header;
+  SpoolRecord* _records;
+  unsigned int _size;
+  EventLoop* _loop;
+  int _timer;
+  bool _draining;
+  unsigned int _burst;
+  uint32_t _retryAt;
+  SpoolStats _stats;
+};
+
+uint32_t crc32(const void* data, unsigned int length, uint32_t crc = 0);
+
+/** @}
+ *
+ */
+
+#endif /* SPOOL_HXX_ */
@@ -0,0 +1,433 @@
+/**
+ * @file subscribe.cxx
+ *
+ * @brief Subscription based, filtered unicast delivery of frames.
+ */
+
+/** @addtogroup Forward
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "subscribe.hxx"
+
+extern uint32_t HAL_GetTick();
+
+/**
+ * Subscription sink constructor.
+ *
+ * @param nodeOffset Offset of the node ID byte in the payload
+ */
+SubscriptionSink::SubscriptionSink(unsigned int nodeOffset)
+{
+  _nodeOffset = nodeOffset;
+  _loop = 0;
+  _fd = -1;
+  _timer = -1;
+  _active = 0;
+  memset(_subscribers, 0, sizeof(_subscribers));
+  memset(&_stats, 0, sizeof(_stats));
+  compile();
+}
+
+SubscriptionSink::~SubscriptionSink()
+{
+  stop();
+}
+
+/**
+ * Open the subscription port and start the expiry timer.
+ *
+ * @param loop Event loop
+ * @param port UDP port for requests; frames are sent from this port as well
+ * @return true on success
+ */
+bool SubscriptionSink::start(EventLoop* loop, int port)
+{
+  _fd = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+  if (_fd < 0)
+    return false;
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+
+  if (bind(_fd, (struct sockaddr*) &addr, sizeof addr) < 0)
+  {
+    perror("bind subscription port");
+    close(_fd);
+    _fd = -1;
+    return false;
+  }
+
+  _loop = loop;
+  _timer = timerCreate();
+  _loop->add(_fd, EPOLLIN, this);
+  _loop->add(_timer, EPOLLIN, this);
+  timerArm(_timer, 1000, true);
+
+  return true;
+}
+
+/**
+ * Close the subscription port. All subscriptions are dropped.
+ */
+void SubscriptionSink::stop()
+{
+  if (0 == _loop)
+    return;
+
+  _loop->remove(_fd);
+  _loop->remove(_timer);
+  close(_fd);
+  close(_timer);
+  _fd = _timer = -1;
+  _loop = 0;
+
+  _active = 0;
+  compile();
+}
+
+/**
+ * Number of active subscriptions.
+ */
+unsigned int SubscriptionSink::getCount()
+{
+  return __builtin_popcount(_active);
+}
+
+/**
+ * Send a frame to every subscriber whose filter matches.
+ *
+ * @return 0 on success; -1 if sending to any subscriber failed.
+ */
+int SubscriptionSink::deliver(const Frame& frame)
+{
+  if (0 == frame.length)
+    return 0;
+
+  uint8_t type = frame.data[0];
+  uint8_t node = (frame.length > _nodeOffset) ? frame.data[_nodeOffset] : 0;
+  int index = -frame.rssi;
+  if (index < 0)
+    index = 0;
+  if (index > 127)
+    index = 127;
+
+  uint32_t mask = _nodeMask[node] & _typeMask[type] & _rssiMask[index];
+
+  if (0 == mask)
+  {
+    _stats.unmatched++;
+    return 0;
+  }
+
+  int ret = 0;
+
+  while (mask)
+  {
+    unsigned int i = __builtin_ctz(mask);
+    mask &= mask - 1;
+
+    Subscriber* subscriber = &_subscribers[i];
+    if (sendFrame(_fd, &subscriber->address, frame, subscriber->envelope, subscriber->seq++) < 0)
+      ret = -1;
+    else
+      _stats.delivered++;
+  }
+
+  return ret;
+}
+
+/**
+ * Handle requests and the expiry timer.
+ */
+void SubscriptionSink::handleEvent(int fd, uint32_t events)
+{
+  if (fd == _timer)
+  {
+    timerRead(_timer);
+    expire();
+    return;
+  }
+
+  char text[256];
+  struct sockaddr_in from;
+  socklen_t fromLength = sizeof(from);
+  int n;
+
+  while ((n = recvfrom(_fd, text, sizeof(text) - 1, 0, (struct sockaddr*) &from, &fromLength)) > 0)
+  {
+    text[n] = '\0';
+    request(text, &from);
+    fromLength = sizeof(from);
+  }
+}
+
+/**
+ * Process a SUB or UNSUB request.
+ */
+void SubscriptionSink::request(char* text, const struct sockaddr_in* from)
+{
+  // strip trailing line breaks of hand written requests (nc, socat)
+  unsigned int len = strlen(text);
+  while (len > 0 && (text[len - 1] == '\n' || text[len - 1] == '\r'))
+    text[--len] = '\0';
+
+  // find the subscription of this source; renewals and UNSUB address it
+  int found = -1;
+  int free = -1;
+  for (unsigned int i = 0; i < SUBSCRIBE_MAX; i++)
+  {
+    if (_active & (1UL << i))
+    {
+      if (_subscribers[i].source.sin_addr.s_addr == from->sin_addr.s_addr
+          && _subscribers[i].source.sin_port == from->sin_port)
+        found = i;
+    }
+    else if (free < 0)
+    {
+      free = i;
+    }
+  }
+
+  if (0 == strncmp(text, "UNSUB", 5))
+  {
+    _stats.requests++;
+    if (found >= 0)
+    {
+      _active &= ~(1UL << found);
+      compile();
+    }
+    reply(from, "OK 0");
+    return;
+  }
+
+  if (0 != strncmp(text, "SUB", 3) || (text[3] != '\0' && text[3] != ' '))
+  {
+    _stats.rejected++;
+    reply(from, "ERR unknown request");
+    return;
+  }
+
+  int slot = (found >= 0) ? found : free;
+  if (slot < 0)
+  {
+    _stats.rejected++;
+    reply(from, "ERR too many subscribers");
+    return;
+  }
+
+  Subscriber subscriber;
+  unsigned int ttl = SUBSCRIBE_DEFAULT_TTL;
+
+  memset(&subscriber, 0, sizeof(subscriber));
+  subscriber.source = *from;
+  subscriber.address = *from;
+
+  if (false == parse(text + 3, &subscriber, &ttl))
+  {
+    _stats.rejected++;
+    reply(from, "ERR invalid filter");
+    return;
+  }
+
+  // keep the datagram numbering of a renewed subscription
+  if (found >= 0)
+    subscriber.seq = _subscribers[found].seq;
+
+  subscriber.expires = HAL_GetTick() + ttl * 1000;
+  _subscribers[slot] = subscriber;
+  _active |= (1UL << slot);
+  _stats.requests++;
+  compile();
+
+  char answer[32];
+  snprintf(answer, sizeof(answer), "OK %u", ttl);
+  reply(from, answer);
+}
+
+/**
+ * Parse a value list like "1,2,10-20" or "L,T,0x41" into a 256 bit map.
+ *
+ * Single characters that are no digits stand for their character code.
+ */
+static bool parseList(char* list, uint8_t* bitmap)
+{
+  memset(bitmap, 0, 32);
+
+  char* save;
+  for (char* item = strtok_r(list, ",", &save); item; item = strtok_r(0, ",", &save))
+  {
+    unsigned long from, to;
+    char* end;
+
+    if (item[0] && !item[1] && (item[0] < '0' || item[0] > '9'))
+    {
+      from = to = (uint8_t) item[0];
+    }
+    else
+    {
+      from = strtoul(item, &end, 0);
+      if (end == item)
+        return false;
+      to = from;
+      if ('-' == *end)
+        to = strtoul(end + 1, &end, 0);
+      if (*end || from > 255 || to > 255 || from > to)
+        return false;
+    }
+
+    for (unsigned long v = from; v <= to; v++)
+      bitmap[v / 8] |= 1 << (v % 8);
+  }
+
+  return true;
+}
+
+/**
+ * Parse the filter of a SUB request.
+ */
+bool SubscriptionSink::parse(char* text, Subscriber* subscriber, unsigned int* ttl)
+{
+  bool nodes = false;
+  bool types = false;
+
+  subscriber->rssiFloor = -128;
+
+  char* save;
+  for (char* token = strtok_r(text, " ", &save); token; token = strtok_r(0, " ", &save))
+  {
+    char* value = strchr(token, '=');
+    if (value)
+      *value++ = '\0';
+
+    if (0 == strcmp(token, "envelope"))
+    {
+      subscriber->envelope = true;
+    }
+    else if (0 == value)
+    {
+      return false;
+    }
+    else if (0 == strcmp(token, "nodes"))
+    {
+      if (false == parseList(value, subscriber->nodes))
+        return false;
+      nodes = true;
+    }
+    else if (0 == strcmp(token, "types"))
+    {
+      if (false == parseList(value, subscriber->types))
+        return false;
+      types = true;
+    }
+    else if (0 == strcmp(token, "rssi"))
+    {
+      subscriber->rssiFloor = atoi(value);
+    }
+    else if (0 == strcmp(token, "ttl"))
+    {
+      *ttl = strtoul(value, 0, 10);
+      if (0 == *ttl)
+        return false;
+      if (*ttl > SUBSCRIBE_MAX_TTL)
+        *ttl = SUBSCRIBE_MAX_TTL;
+    }
+    else if (0 == strcmp(token, "port"))
+    {
+      subscriber->address.sin_port = htons(atoi(value));
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  // no list means everything
+  if (false == nodes)
+    memset(subscriber->nodes, 0xFF, 32);
+  if (false == types)
+    memset(subscriber->types, 0xFF, 32);
+
+  return true;
+}
+
+/**
+ * Drop subscriptions that have not been renewed in time.
+ */
+void SubscriptionSink::expire()
+{
+  uint32_t now = HAL_GetTick();
+  bool changed = false;
+
+  for (unsigned int i = 0; i < SUBSCRIBE_MAX; i++)
+  {
+    if ((_active & (1UL << i)) && (int32_t)(now - _subscribers[i].expires) >= 0)
+    {
+      _active &= ~(1UL << i);
+      _stats.expired++;
+      changed = true;
+    }
+  }
+
+  if (changed)
+    compile();
+}
+
+/**
+ * Rebuild the routing bitmaps from the active subscriptions.
+ */
+void SubscriptionSink::compile()
+{
+  memset(_nodeMask, 0, sizeof(_nodeMask));
+  memset(_typeMask, 0, sizeof(_typeMask));
+  memset(_rssiMask, 0, sizeof(_rssiMask));
+
+  for (unsigned int i = 0; i < SUBSCRIBE_MAX; i++)
+  {
+    if (0 == (_active & (1UL << i)))
+      continue;
+
+    Subscriber* subscriber = &_subscribers[i];
+    uint32_t bit = 1UL << i;
+
+    for (unsigned int v = 0; v < 256; v++)
+    {
+      if (subscriber->nodes[v / 8] & (1 << (v % 8)))
+        _nodeMask[v] |= bit;
+      if (subscriber->types[v / 8] & (1 << (v % 8)))
+        _typeMask[v] |= bit;
+    }
+
+    // index is -RSSI: the subscriber wants everything at or above its floor
+    for (int index = 0; index < 128; index++)
+    {
+      if (-index >= subscriber->rssiFloor)
+        _rssiMask[index] |= bit;
+    }
+  }
+}
+
+/**
+ * Answer a request.
+ */
+void SubscriptionSink::reply(const struct sockaddr_in* to, const char* text)
+{
+  sendto(_fd, text, strlen(text), 0, (const struct sockaddr*) to, sizeof(*to));
+}
+
+/** @}
+ *
+ */
@@ -0,0 +1,121 @@
+/**
+ * @file subscribe.hxx
+ *
+ * @brief Subscription based, filtered unicast delivery of frames.
+ *
+ * Instead of broadcasting every frame to the whole subnet, consumers register a
+ * filter on the subscription port and get matching frames as unicast datagrams.
+ * A request is a single text datagram:
+ *
+ *   SUB [nodes=1,2,10-20] [types=L,T,0x41] [rssi=-90] [ttl=60] [port=12345] [envelope]
+ *   UNSUB
+ *
+ * Omitted filters match everything. Frames are sent to the source address of the
+ * request (and the given port, default: the source port). The subscription
+ * expires after ttl seconds (1..SUBSCRIBE_MAX_TTL) unless it is renewed by
+ * sending SUB again; the reply is "OK <ttl>" or "ERR <reason>". Renewals and
+ * UNSUB have to come from the source address and port of the first request.
+ *
+ * The node ID is the payload byte at a configurable offset, the message type is
+ * the first payload byte. Filters are compiled into per-value bitmaps of
+ * subscribers (one bit per subscriber), so routing a frame is three table
+ * lookups and an AND, independent of the number of subscriptions.
+ */
+
+#ifndef SUBSCRIBE_HXX_
+#define SUBSCRIBE_HXX_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "frame.hxx"
+#include "forward.hxx"
+#include "eventloop.hxx"
+
+/** @addtogroup Forward
+ * @{
+ */
+#define SUBSCRIBE_PORT          12347 ///< Default subscription port
+#define SUBSCRIBE_MAX           32    ///< Maximum number of subscribers (bits of a mask)
+#define SUBSCRIBE_DEFAULT_TTL   60    ///< Subscription lifetime if none is given [s]
+#define SUBSCRIBE_MAX_TTL       3600  ///< Upper limit of the lifetime [s]
+#define SUBSCRIBE_NODE_OFFSET   1     ///< Default payload offset of the node ID
+
+/** Subscription counters. */
+typedef struct
+{
+  unsigned int requests;    //!< Valid SUB/UNSUB requests
+  unsigned int rejected;    //!< Invalid requests or no free subscriber slot
+  unsigned int expired;     //!< Subscriptions that expired
+  unsigned int delivered;   //!< Unicast datagrams sent
+  unsigned int unmatched;   //!< Frames no subscriber wanted
+} SubscribeStats;
+
+/** Filtered unicast fan-out; a sink of the forwarding pipeline. */
+class SubscriptionSink : public FrameSink, public EventHandler
+{
+public:
+  SubscriptionSink(unsigned int nodeOffset = SUBSCRIBE_NODE_OFFSET);
+  virtual ~SubscriptionSink();
+
+  bool start(EventLoop* loop, int port = SUBSCRIBE_PORT);
+
+  void stop();
+
+  int deliver(const Frame& frame);
+
+  void handleEvent(int fd, uint32_t events);
+
+  /**
+   * Get the number of active subscriptions.
+   */
+  unsigned int getCount();
+
+  /**
+   * Get the subscription counters.
+   */
+  const SubscribeStats& getStats()
+  {
+    return _stats;
+  }
+
+private:
+  typedef struct
+  {
+    struct sockaddr_in source;    // sender of the requests, identifies the subscription
+    struct sockaddr_in address;   // frames go here
+    uint32_t expires;
+    bool envelope;
+    uint32_t seq;
+    int16_t rssiFloor;
+    uint8_t nodes[32];  // bitmap over node IDs
+    uint8_t types[32];  // bitmap over message types
+  } Subscriber;
+
+  void request(char* text, const struct sockaddr_in* from);
+
+  bool parse(char* text, Subscriber* subscriber, unsigned int* ttl);
+
+  void expire();
+
+  void compile();
+
+  void reply(const struct sockaddr_in* to, const char* text);
+
+  unsigned int _nodeOffset;
+  EventLoop* _loop;
+  int _fd;
+  int _timer;
+  uint32_t _active;
+  Subscriber _subscribers[SUBSCRIBE_MAX];
+  uint32_t _nodeMask[256];
+  uint32_t _typeMask[256];
+  uint32_t _rssiMask[128];
+  SubscribeStats _stats;
+};
+
+/** @}
+ *
+ */
+
+#endif /* SUBSCRIBE_HXX_ */
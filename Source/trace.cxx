@@ -0,0 +1,206 @@
+/**
+ * @file trace.cxx
+ *
+ * @brief Latency of the stages a received frame goes through.
+ */
+
+/** @addtogroup Forward
+ * @{
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.hxx"
+
+/** Name of each interval in dumps and metrics. */
+static const char* const intervalNames[TRACE_INTERVALS] =
+{
+  "irq", "fifo", "prepare", "queue", "forward", "total"
+};
+
+static LatencyHistogram histograms[TRACE_INTERVALS];
+
+/**
+ * Get the bucket of a value.
+ */
+static unsigned int bucketOf(uint64_t value)
+{
+  if (value >> TRACE_MAX_BITS)
+    value = ((uint64_t) 1 << TRACE_MAX_BITS) - 1;
+
+  if (value < (1 << TRACE_PRECISION_BITS))
+    return value;
+
+  // the top TRACE_PRECISION_BITS bits select the bucket
+  unsigned int shift = 63 - __builtin_clzll(value) - (TRACE_PRECISION_BITS - 1);
+  unsigned int sub = (value >> shift) - TRACE_SUB_BUCKETS;
+
+  return (1 << TRACE_PRECISION_BITS) + (shift - 1) * TRACE_SUB_BUCKETS + sub;
+}
+
+/**
+ * Get the largest value of a bucket.
+ */
+static uint64_t bucketMax(unsigned int bucket)
+{
+  if (bucket < (1 << TRACE_PRECISION_BITS))
+    return bucket;
+
+  unsigned int shift = (bucket - (1 << TRACE_PRECISION_BITS)) / TRACE_SUB_BUCKETS + 1;
+  uint64_t sub = (bucket - (1 << TRACE_PRECISION_BITS)) % TRACE_SUB_BUCKETS + TRACE_SUB_BUCKETS;
+
+  return ((sub + 1) << shift) - 1;
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+  reset();
+}
+
+/**
+ * Record a value.
+ *
+ * @param value Latency [ns]
+ */
+void LatencyHistogram::record(uint64_t value)
+{
+  _buckets[bucketOf(value)]++;
+  _count++;
+  _sum += value;
+  if (value > _max)
+    _max = value;
+}
+
+/**
+ * Get a percentile: the largest value of the bucket the percentile falls into,
+ * at most the largest value recorded.
+ *
+ * @param permille Percentile in 1/1000, e.g. 999 for p99.9
+ * @return Latency [ns]; 0 if nothing has been recorded
+ */
+uint64_t LatencyHistogram::percentile(unsigned int permille) const
+{
+  if (0 == _count)
+    return 0;
+
+  // rank of the value, rounded up
+  uint64_t rank = (_count * permille + 999) / 1000;
+  if (0 == rank)
+    rank = 1;
+
+  uint64_t seen = 0;
+  for (unsigned int bucket = 0; bucket < TRACE_BUCKETS; bucket++)
+  {
+    seen += _buckets[bucket];
+    if (seen >= rank)
+    {
+      uint64_t value = bucketMax(bucket);
+      return (value < _max) ? value : _max;
+    }
+  }
+
+  return _max;
+}
+
+/**
+ * Forget all values.
+ */
+void LatencyHistogram::reset()
+{
+  memset(_buckets, 0, sizeof(_buckets));
+  _count = 0;
+  _sum = 0;
+  _max = 0;
+}
+
+/**
+ * Record the stage intervals of a frame that has been handed to all sinks.
+ * Frames without a trace (DIO0 edge 0) are ignored.
+ *
+ * @param frame The frame
+ * @param done frameClock() after the last sink
+ */
+void traceRecord(const Frame& frame, uint64_t done)
+{
+  if (0 == frame.edge || done < frame.edge)
+    return;
+
+  const uint32_t* stages = frame.stages;
+  uint64_t total = done - frame.edge;
+
+  histograms[TRACE_IRQ].record(stages[FRAME_STAGE_DRAIN_START]);
+  histograms[TRACE_FIFO].record(stages[FRAME_STAGE_DRAIN_END] - stages[FRAME_STAGE_DRAIN_START]);
+  histograms[TRACE_PREPARE].record(stages[FRAME_STAGE_ENQUEUE] - stages[FRAME_STAGE_DRAIN_END]);
+  histograms[TRACE_QUEUE].record(stages[FRAME_STAGE_DEQUEUE] - stages[FRAME_STAGE_ENQUEUE]);
+  histograms[TRACE_FORWARD].record(total - stages[FRAME_STAGE_DEQUEUE]);
+  histograms[TRACE_TOTAL].record(total);
+}
+
+/**
+ * Get the histogram of an interval.
+ */
+const LatencyHistogram& traceHistogram(TraceInterval interval)
+{
+  return histograms[interval];
+}
+
+/**
+ * Print count, p50, p99, p99.9 and maximum of every interval [us].
+ */
+void traceDump()
+{
+  for (unsigned int i = 0; i < TRACE_INTERVALS; i++)
+  {
+    const LatencyHistogram& histogram = histograms[i];
+    if (0 == histogram.getCount())
+      continue;
+
+    printf("latency %-7s %llu frames, p50 %.1f p99 %.1f p99.9 %.1f max %.1f us\r\n", intervalNames[i],
+        (unsigned long long) histogram.getCount(), histogram.percentile(500) / 1000.0,
+        histogram.percentile(990) / 1000.0, histogram.percentile(999) / 1000.0, histogram.getMax() / 1000.0);
+  }
+}
+
+/**
+ * Render the intervals as a Prometheus summary with the quantiles 0.5, 0.99 and
+ * 0.999 [us].
+ *
+ * @param text Output buffer
+ * @param size Size of the buffer
+ * @return Length of the text
+ */
+unsigned int traceRender(char* text, unsigned int size)
+{
+  static const unsigned int quantiles[] = { 500, 990, 999 };
+  const char* name = "rfmbridge_stage_latency_microseconds";
+  unsigned int length = 0;
+
+  length += snprintf(text, size, "# HELP %s Latency of the stages of a received frame\n# TYPE %s summary\n",
+      name, name);
+
+  for (unsigned int i = 0; i < TRACE_INTERVALS && length < size; i++)
+  {
+    const LatencyHistogram& histogram = histograms[i];
+
+    for (unsigned int q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]) && length < size; q++)
+    {
+      length += snprintf(text + length, size - length, "%s{stage=\"%s\",quantile=\"%g\"} %.3f\n", name,
+          intervalNames[i], quantiles[q] / 1000.0, histogram.percentile(quantiles[q]) / 1000.0);
+    }
+
+    if (length < size)
+    {
+      length += snprintf(text + length, size - length, "%s_sum{stage=\"%s\"} %.3f\n%s_count{stage=\"%s\"} %llu\n",
+          name, intervalNames[i], histogram.getSum() / 1000.0, name, intervalNames[i],
+          (unsigned long long) histogram.getCount());
+    }
+  }
+
+  return (length < size) ? length : size - 1;
+}
+
+/** @}
+ *
+ */
@@ -0,0 +1,107 @@
+/**
+ * @file trace.hxx
+ *
+ * @brief Latency of the stages a received frame goes through.
+ *
+ * Every frame read from a radio carries the time of the DIO0 edge and of each
+ * stage after it (see FrameStage): start and end of the FIFO drain, push into
+ * the event ring of the radio thread, dispatch on the main thread. When the
+ * forwarder has handed it to all sinks (the sendto() of the uplink returned),
+ * the intervals between the stages are recorded in histograms:
+ *
+ *   irq      DIO0 edge until the FIFO drain starts (interrupt and wake-up)
+ *   fifo     FIFO drain over SPI, including the mode switches
+ *   prepare  RSSI, frequency error and metadata until the event is pushed
+ *   queue    event ring until the main thread dispatches it
+ *   forward  duplicate check and all sinks (a frame held by dedup includes the window)
+ *   total    DIO0 edge until all sinks have the frame
+ *
+ * The histograms are log-linear like HdrHistogram: TRACE_SUB_BUCKETS buckets
+ * per power of two, so a percentile is exact to within 1/TRACE_SUB_BUCKETS
+ * (about 6 %) from 1 ns to about a minute, at a fixed size and O(1) recording.
+ * Recording and reading happen on the main thread.
+ */
+
+#ifndef TRACE_HXX_
+#define TRACE_HXX_
+
+#include <stdint.h>
+
+#include "frame.hxx"
+
+/** @addtogroup Forward
+ * @{
+ */
+#define TRACE_PRECISION_BITS  5   ///< log2 of the linear range
+#define TRACE_SUB_BUCKETS     (1 << (TRACE_PRECISION_BITS - 1)) ///< Buckets per power of two
+#define TRACE_MAX_BITS        36  ///< Largest value 2^36 - 1 ns (68 s)
+#define TRACE_BUCKETS         ((1 << TRACE_PRECISION_BITS) + (TRACE_MAX_BITS - TRACE_PRECISION_BITS) * TRACE_SUB_BUCKETS)
+
+/** Intervals between the stages of a frame. */
+typedef enum
+{
+  TRACE_IRQ = 0,    //!< DIO0 edge until the FIFO drain starts
+  TRACE_FIFO,       //!< FIFO drain
+  TRACE_PREPARE,    //!< End of the drain until the event is pushed
+  TRACE_QUEUE,      //!< Event ring between the threads
+  TRACE_FORWARD,    //!< Dispatch until all sinks have the frame
+  TRACE_TOTAL,      //!< DIO0 edge until all sinks have the frame
+  TRACE_INTERVALS
+} TraceInterval;
+
+/** Log-linear latency histogram [ns]. */
+class LatencyHistogram
+{
+public:
+  LatencyHistogram();
+
+  void record(uint64_t value);
+
+  uint64_t percentile(unsigned int permille) const;
+
+  void reset();
+
+  /**
+   * Get the number of values recorded.
+   */
+  uint64_t getCount() const
+  {
+    return _count;
+  }
+
+  /**
+   * Get the sum of the values recorded [ns].
+   */
+  uint64_t getSum() const
+  {
+    return _sum;
+  }
+
+  /**
+   * Get the largest value recorded [ns].
+   */
+  uint64_t getMax() const
+  {
+    return _max;
+  }
+
+private:
+  uint32_t _buckets[TRACE_BUCKETS];
+  uint64_t _count;
+  uint64_t _sum;
+  uint64_t _max;
+};
+
+void traceRecord(const Frame& frame, uint64_t done);
+
+const LatencyHistogram& traceHistogram(TraceInterval interval);
+
+void traceDump();
+
+unsigned int traceRender(char* text, unsigned int size);
+
+/** @}
+ *
+ */
+
+#endif /* TRACE_HXX_ */